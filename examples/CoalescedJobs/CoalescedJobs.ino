@@ -0,0 +1,88 @@
+/*
+********************************************************************************
+*
+* This example shows how to let periodic jobs on the Nicla Vision share
+* wakeups, by giving each job a window of time in which it may run.
+*
+* Upload the same sketch to both the M7 and the M4 core.
+*
+* There are two jobs: "sample" every 20 seconds, which may run up to 5 seconds
+* early or late, and "upload" every 70 seconds, which may run up to 30 seconds
+* early or late. Whenever the "upload" job is due within its window of the
+* "sample" job, the two run in the same wakeup instead of one after the other.
+*
+* After each wakeup, the sketch prints how many times the jobs have run so far,
+* how many wakeups that took, and how many wakeups were saved compared to
+* waking up once for each run. Open the Serial Monitor within a second of the
+* board waking up to see it.
+*
+* The LED light should follow this sequence:
+*
+*   - Green  = The "sample" job runs
+*   - Blue   = The "upload" job runs
+*   - Off    = Standby Mode until the next job is due
+*
+* This sequence repeats indefinitely.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+WakeupScheduler scheduler;
+
+void setup() {
+#if defined CORE_CM7
+  pinMode(LEDR, OUTPUT);
+  pinMode(LEDG, OUTPUT);
+  pinMode(LEDB, OUTPUT);
+  digitalWrite(LEDR, HIGH);
+  digitalWrite(LEDG, HIGH);
+  digitalWrite(LEDB, HIGH);
+  LowPower.ensureOptionBytes();
+  bootM4();
+
+  // These keep their schedules if they were added before Standby Mode
+  scheduler.add("sample", 20_s, 5_s);
+  scheduler.add("upload", 70_s, 30_s);
+#else
+  LowPower.standbyM4();
+#endif
+}
+
+void loop() {
+#if defined CORE_CM7
+  // The statistics cover the wakeups before this one
+  Serial.begin(9600);
+  const unsigned long start = millis();
+  while (!Serial && ((millis() - start) < 1000))
+    ;
+  Serial.print("Job runs: ");
+  Serial.print(scheduler.runs());
+  Serial.print(", wakeups: ");
+  Serial.print(scheduler.wakeups());
+  Serial.print(", wakeups saved: ");
+  Serial.println(scheduler.savedWakeups());
+  Serial.flush();
+
+  if (scheduler.isDue("sample"))
+  {
+    digitalWrite(LEDG, LOW);
+    delay(500);
+    digitalWrite(LEDG, HIGH);
+  }
+  if (scheduler.isDue("upload"))
+  {
+    digitalWrite(LEDB, LOW);
+    delay(500);
+    digitalWrite(LEDB, HIGH);
+  }
+
+  // One wakeup serves every job within its tolerance. If the printing above
+  // has run into that wakeup, standbyM7() returns instead of sleeping, and
+  // loop() takes the due jobs now
+  LowPower.standbyM7(scheduler.wakeupSources());
+#endif
+}
@@ -8,6 +8,16 @@
 * number should (in this default case) be either 2 or 3. Which of these is
 * printed can vary from run to run.
 *
+* Next, the sketch takes two tracked Deep Sleep Locks, one named "Sensor" and
+* one named after the sketch file, and releases the first of them after half a
+* second. A DeepSleepGuard named "Transfer", with a hold limit of 100 ms, is
+* also held for the half second, and is released when it goes out of scope.
+* After that, a lock named "Transfer" is taken and left held on purpose. The
+* sketch then prints the table of tracked holders, with how many times each
+* lock was taken, how many are held now, for how long they have been held, and
+* whether they have been held for longer than their limit. The locks that are
+* not tracked belong to Mbed drivers, such as USB.
+*
 * Original author: A. Vidstrom (http://arduino.cc)
 *
 * This code is in the public domain
@@ -26,6 +36,49 @@ void setup() {
   // The expected number here is 2 or 3 (can vary from run to run)
   Serial.print("Number of Deep Sleep Locks currently active: ");
   Serial.println(LowPower.numberOfDeepSleepLocks());
+
+  // Take two tracked locks and release one of them again
+  LowPower.lockDeepSleep("Sensor");
+  LOWPOWER_LOCK_DEEP_SLEEP();
+  {
+    // Released at the end of this block, which takes longer than its limit
+    DeepSleepGuard transfer("Transfer", 100_ms);
+    delay(500);
+  }
+  LowPower.unlockDeepSleep("Sensor");
+
+  // A lock of the same holder that is never released, as if from a
+  // forgotten return path. The limit from the guard still applies to it.
+  LowPower.lockDeepSleep("Transfer");
+  delay(200);
+
+  const DeepSleepLockTable locks = LowPower.deepSleepLocks();
+  for (const DeepSleepLockRecord& record : locks) {
+    Serial.print(record.holder);
+    Serial.print(": taken ");
+    Serial.print(record.acquisitions);
+    Serial.print(" times, held now ");
+    Serial.print(record.held);
+    Serial.print(" times, held for ");
+    Serial.print(static_cast<unsigned long>(record.heldTime));
+    Serial.print(" us in total, ");
+    Serial.print(static_cast<unsigned long>(record.longestHold));
+    Serial.print(" us at most");
+    if (record.overdue) {
+      Serial.print(", overdue");
+    }
+    Serial.println();
+  }
+  const char* overdueHolder = nullptr;
+  LowPower.canDeepSleep(overdueHolder);
+  if (nullptr != overdueHolder) {
+    Serial.print("Held for longer than its limit: ");
+    Serial.println(overdueHolder);
+  }
+  Serial.print("Number of Deep Sleep Locks not tracked: ");
+  Serial.println(LowPower.numberOfDeepSleepLocks() - locks.held());
+
+  LOWPOWER_UNLOCK_DEEP_SLEEP();
 }
 
 void loop() {
@@ -0,0 +1,77 @@
+/*
+********************************************************************************
+*
+* This example shows how to estimate the charge used by the Nicla Vision, and
+* how long a battery would last, without measuring the current.
+*
+* Upload the same sketch to both the M7 and the M4 core.
+*
+* The sketch works for one second at a lower performance level, waits for one
+* second with Deep Sleep Mode allowed, and prints the estimate. Open the Serial
+* Monitor within a second of the board waking up to see it. It then goes into
+* Standby Mode for 10 seconds, which is counted in the next estimate.
+*
+* The currents used for the estimate are rough defaults. For a useful
+* estimate, measure the current of your own board in each mode once, and set
+* them in the profile.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+// The capacity of the battery in milliampere-hours
+const float batteryCapacity = 200;
+
+void setup() {
+#if defined CORE_CM7
+  LowPower.ensureOptionBytes();
+  bootM4();
+
+  EnergyEstimator estimator;
+  // Replace with your own measurements, in microamperes
+  estimator.profile().standby = 150;
+
+  // Some work at a lower frequency
+  LowPower.setPerformanceLevel(PerformanceLevel::medium);
+  const unsigned long workStart = millis();
+  while ((millis() - workStart) < 1000)
+    ;
+  LowPower.setPerformanceLevel(PerformanceLevel::max);
+
+  // Some waiting
+  LowPower.allowDeepSleep();
+  delay(1000);
+  LowPower.disallowDeepSleep();
+
+  Serial.begin(9600);
+  const unsigned long start = millis();
+  while (!Serial && ((millis() - start) < 1000))
+    ;
+  const Residency times = estimator.residency();
+  Serial.print("Seconds awake: ");
+  Serial.print(static_cast<unsigned long>((times.run[0] + times.run[1] +
+                                           times.run[2] + times.run[3]) / 1000000));
+  Serial.print(", in Deep Sleep: ");
+  Serial.print(static_cast<unsigned long>(times.stop / 1000000));
+  Serial.print(", in Standby: ");
+  Serial.println(static_cast<unsigned long>(times.standby / 1000000));
+  Serial.print("Used: ");
+  Serial.print(estimator.microampHours());
+  Serial.print(" uAh, average current: ");
+  Serial.print(estimator.averageCurrent());
+  Serial.println(" uA");
+  Serial.print("Projected battery life: ");
+  Serial.print(estimator.projectedBatteryLife(batteryCapacity));
+  Serial.println(" hours");
+
+  LowPower.standbyM7(10_s);
+#else
+  LowPower.standbyM4();
+#endif
+}
+
+void loop() {
+}
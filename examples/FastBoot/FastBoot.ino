@@ -0,0 +1,94 @@
+/*
+********************************************************************************
+*
+* This example shows how to make short timed wakeups from Standby Mode skip
+* the usual boot of the Nicla Vision. The M7 core wakes up every 2 seconds,
+* and a small function counts the wakeup in the backup SRAM and goes back to
+* Standby Mode before Mbed, the RTOS and setup() have started. Every tenth
+* wakeup boots the usual way instead, and setup() prints the counts.
+*
+* Upload the same sketch to both the M7 and the M4 core, and open the Serial
+* Monitor. It disconnects during Standby Mode, and reconnects when setup()
+* runs.
+*
+* The LED light should follow this sequence:
+*
+*   - Green  = setup() is running after a wakeup through the usual boot
+*   - Off    = Standby Mode, with nine short wakeups through the fast path
+*
+* This sequence repeats indefinitely.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+// The data to keep, shared by the fast path and setup()
+struct Counters {
+  uint32_t fastWakeups = 0;
+  uint32_t usualBoots = 0;
+};
+
+// The delay for both standbyM7() and FastBoot::arm()
+const RTCWakeupDelay wakeupDelay = 2_s;
+
+// Every this many wakeups boot the usual way
+const uint32_t usualBootEvery = 10;
+
+// Runs before Mbed has started, so only the backup SRAM and the registers can
+// be used here, but not the LowPower object, Serial or the Arduino functions
+static bool fastWakeup() {
+  Counters* const counters = FastBoot::persistent<Counters>(1);
+  if (nullptr == counters) {
+    return false;
+  }
+  counters->fastWakeups++;
+  return 0 != (counters->fastWakeups % usualBootEvery);
+}
+
+LOWPOWER_FAST_BOOT(fastWakeup)
+
+void setup() {
+#if defined CORE_CM7
+  pinMode(LEDG, OUTPUT);
+  digitalWrite(LEDG, LOW);
+  LowPower.ensureOptionBytes();
+  bootM4();
+
+  Serial.begin(9600);
+  const unsigned long start = millis();
+  while (!Serial && ((millis() - start) < 3000))
+    ;
+
+  Counters& counters = LowPower.persistent<Counters>(1);
+  if (!LowPower.persistentRestored()) {
+    counters = Counters();
+  }
+  counters.usualBoots++;
+
+  FastBoot fastBoot;
+  Serial.print("Usual boots: ");
+  Serial.print(counters.usualBoots);
+  Serial.print(", fast wakeups: ");
+  Serial.print(counters.fastWakeups);
+  Serial.print(", since the last usual boot: ");
+  Serial.println(fastBoot.wakeups());
+
+  // Also resets the count from wakeups()
+  if (LowPowerReturnCode::success != fastBoot.arm(wakeupDelay)) {
+    Serial.println("Couldn't arm the fast path");
+  }
+
+  Serial.flush();
+  delay(500);
+  digitalWrite(LEDG, HIGH);
+  LowPower.standbyM7(wakeupDelay);
+#else
+  LowPower.standbyM4();
+#endif
+}
+
+void loop() {
+}
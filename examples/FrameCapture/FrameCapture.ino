@@ -0,0 +1,52 @@
+/*
+********************************************************************************
+*
+* This example shows how to capture camera frames on the Nicla Vision with the
+* M7 core asleep while the DMA transfers each frame.
+*
+* The sketch sets up the GC2145 camera with the Arduino Camera library, and
+* then captures a QVGA frame once per second straight into a buffer, without
+* any copy afterwards. It prints how long each capture took, and the first
+* pixel of the frame.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+#include "camera.h"
+#include "gc2145.h"
+
+GC2145 galaxyCore;
+Camera cam(galaxyCore);
+
+// The buffer must start on a cache line and fill whole cache lines
+alignas(32) static uint8_t frame[320 * 240 * 2];
+
+void setup() {
+  Serial.begin(9600);
+  while (!Serial)
+    ;
+  if (!cam.begin(CAMERA_R320x240, CAMERA_RGB565, 30)) {
+    Serial.println("The camera couldn't be set up");
+    while (true)
+      ;
+  }
+}
+
+void loop() {
+  const unsigned long start = millis();
+  const LowPowerReturnCode result = FrameCapture().capture(frame, sizeof(frame));
+  const unsigned long elapsed = millis() - start;
+
+  if (LowPowerReturnCode::success == result) {
+    Serial.print("Captured a frame in ");
+    Serial.print(elapsed);
+    Serial.print(" ms, first pixel: 0x");
+    Serial.println((frame[0] << 8) | frame[1], HEX);
+  } else {
+    Serial.println("The capture failed");
+  }
+  delay(1000);
+}
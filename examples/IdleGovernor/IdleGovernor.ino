@@ -0,0 +1,80 @@
+/*
+********************************************************************************
+*
+* This example shows how to let the library pick the power mode for each wait,
+* from how long the wait is and what it costs to enter and leave each mode.
+*
+* Upload the same sketch to both the M7 and the M4 core.
+*
+* The sketch waits for 2, 20, 200 and 2000 milliseconds, and prints which mode
+* was used for each wait and the costs measured so far. Open the Serial
+* Monitor within a second of the board starting up to see it. The last wait
+* of 20 seconds may also use Standby Mode, after which the sketch starts over
+* with the cost of Standby Mode measured.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+static const char* modeName(const IdleMode mode) {
+  switch (mode) {
+    case IdleMode::sleep:
+      return "Sleep";
+    case IdleMode::stop:
+      return "Stop";
+    case IdleMode::standby:
+      return "Standby";
+    default:
+      return "none";
+  }
+}
+
+void setup() {
+#if defined CORE_CM7
+  LowPower.ensureOptionBytes();
+  bootM4();
+
+  Serial.begin(9600);
+  const unsigned long start = millis();
+  while (!Serial && ((millis() - start) < 1000))
+    ;
+
+  Serial.print("Mode before this boot: ");
+  Serial.println(modeName(LowPower.lastIdleMode()));
+
+  // Replace with your own measurements, in microamperes
+  CurrentProfile profile;
+  profile.standby = 150;
+  LowPower.setIdleProfile(profile);
+#else
+  LowPower.standbyM4();
+#endif
+}
+
+void loop() {
+#if defined CORE_CM7
+  for (unsigned long long int wait = 2; wait <= 2000; wait *= 10) {
+    LowPower.idleFor(RTCWakeupDelay(0, 0, 0, wait));
+    const IdleCosts costs = LowPower.idleCosts();
+    Serial.print("Waited ");
+    Serial.print(static_cast<unsigned long>(wait));
+    Serial.print(" ms in ");
+    Serial.print(modeName(LowPower.lastIdleMode()));
+    Serial.print(", Stop costs ");
+    Serial.print(costs.stop);
+    Serial.print(" us (");
+    Serial.print(costs.stopSamples);
+    Serial.print(" samples), Standby costs ");
+    Serial.print(costs.standby);
+    Serial.print(" us (");
+    Serial.print(costs.standbySamples);
+    Serial.println(" samples)");
+  }
+
+  Serial.flush();
+  LowPower.idleFor(20_s, IdleMode::all);
+#endif
+}
@@ -0,0 +1,75 @@
+/*
+********************************************************************************
+*
+* This example shows how to keep logging while Deep Sleep is allowed and USB is
+* turned off, and to see the log in the Serial Monitor afterwards.
+*
+* Upload the same sketch to both the M7 and the M4 core, and open the Serial
+* Monitor.
+*
+* The sketch allows Deep Sleep, which turns off USB, and logs a line once per
+* second for 10 seconds. The lines are kept in the backup SRAM in the
+* meantime. It then turns USB on again, and once the Serial Monitor has
+* connected again, all the lines are written in one burst. Every third round
+* ends in Standby Mode instead, and the lines logged before are written out
+* after waking up.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+LowPowerLog logger;
+
+static bool serialConnected() {
+  return static_cast<bool>(Serial);
+}
+
+void setup() {
+#if defined CORE_CM7
+  LowPower.ensureOptionBytes();
+  bootM4();
+
+  Serial.begin(9600);
+  logger.begin(Serial);
+  // Only write the log when someone is listening
+  logger.setFlushHook(&serialConnected);
+  logger.println("Started");
+#else
+  LowPower.standbyM4();
+#endif
+}
+
+void loop() {
+#if defined CORE_CM7
+  static unsigned int round = 0;
+  round++;
+
+  LowPower.allowDeepSleep();
+  for (unsigned int second = 0; second < 10; second++) {
+    logger.print("Round ");
+    logger.print(round);
+    logger.print(", second ");
+    logger.println(second);
+    delay(1000);
+  }
+  LowPower.disallowDeepSleep();
+
+  if (0 == (round % 3)) {
+    logger.println("Entering Standby Mode for 5 seconds");
+    LowPower.standbyM7(5_s);
+  }
+
+  // Wait for the Serial Monitor to connect again
+  const unsigned long start = millis();
+  while (!Serial && ((millis() - start) < 5000))
+    ;
+  logger.flush();
+  if (0 != logger.dropped()) {
+    logger.print("Bytes dropped so far: ");
+    logger.println(logger.dropped());
+  }
+#endif
+}
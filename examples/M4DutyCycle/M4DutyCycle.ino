@@ -0,0 +1,63 @@
+/*
+********************************************************************************
+*
+* This example shows how the M4 core of the Nicla Vision can duty-cycle on its
+* own, with Standby Mode between short bursts of work, while the M7 core keeps
+* running.
+*
+* Upload the same sketch to both the M7 and the M4 core.
+*
+* The M4 core works for 100 milliseconds, which lights the green LED, and then
+* enters Standby Mode for 2 seconds, after which it starts over. The M7 core
+* prints what the M4 core has published about its time every 5 seconds.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+#if defined CORE_CM7
+void setup() {
+  Serial.begin(9600);
+  while (!Serial)
+    ;
+  // Start the RTC here, so that the two cores don't set it up at once
+  LowPower.rtcMilliseconds();
+  bootM4();
+}
+
+void loop() {
+  delay(5000);
+
+  const M4Residency residency = LowPower.m4Residency();
+  if (!residency.valid) {
+    Serial.println("The M4 core hasn't published anything yet");
+    return;
+  }
+  Serial.print("M4 boots: ");
+  Serial.print(residency.boots);
+  Serial.print(", Standby Mode entries: ");
+  Serial.print(residency.standbyEntries);
+  Serial.print(", time in Standby Mode: ");
+  Serial.print(static_cast<unsigned long>(residency.standby / 1000));
+  Serial.print(" ms, awake in the last boot: ");
+  Serial.print(static_cast<unsigned long>((residency.uptime - residency.idle) / 1000));
+  Serial.println(" ms");
+}
+#else
+void setup() {
+  pinMode(LEDG, OUTPUT);
+  digitalWrite(LEDG, LOW);
+  // Stands in for the real work, such as sensor fusion
+  delay(100);
+  digitalWrite(LEDG, HIGH);
+
+  // Only returns if Standby Mode couldn't be entered
+  LowPower.standbyM4(2_s);
+}
+
+void loop() {
+}
+#endif
@@ -0,0 +1,69 @@
+/*
+********************************************************************************
+*
+* This example shows how to run periodic jobs on the Nicla Vision at fixed
+* times, with Standby Mode in between.
+*
+* Upload the same sketch to both the M7 and the M4 core.
+*
+* There are two jobs: "capture" every 10 seconds and "report" every 60
+* seconds. The times are counted from when each job was first added, and are
+* kept by the RTC, so the time spent awake doesn't make the schedule drift.
+* Every sixth wakeup, both jobs are due at the same time and share the wakeup.
+*
+* The LED light should follow this sequence:
+*
+*   - Green  = The "capture" job runs
+*   - Blue   = The "report" job runs
+*   - Off    = Standby Mode until the next job is due
+*
+* This sequence repeats indefinitely.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+WakeupScheduler scheduler;
+
+void setup() {
+#if defined CORE_CM7
+  pinMode(LEDR, OUTPUT);
+  pinMode(LEDG, OUTPUT);
+  pinMode(LEDB, OUTPUT);
+  digitalWrite(LEDR, HIGH);
+  digitalWrite(LEDG, HIGH);
+  digitalWrite(LEDB, HIGH);
+  LowPower.ensureOptionBytes();
+  bootM4();
+
+  // These keep their schedules if they were added before Standby Mode
+  scheduler.add("capture", 10_s);
+  scheduler.add("report", 60_s);
+#else
+  LowPower.standbyM4();
+#endif
+}
+
+void loop() {
+#if defined CORE_CM7
+  if (scheduler.isDue("capture"))
+  {
+    digitalWrite(LEDG, LOW);
+    delay(500);
+    digitalWrite(LEDG, HIGH);
+  }
+  if (scheduler.isDue("report"))
+  {
+    digitalWrite(LEDB, LOW);
+    delay(500);
+    digitalWrite(LEDB, HIGH);
+  }
+
+  // Sleep until the next capture or report. If the blinks above took so long
+  // that it's already due, standbyM7() returns right away, and loop() runs it
+  LowPower.standbyM7(scheduler.wakeupSources());
+#endif
+}
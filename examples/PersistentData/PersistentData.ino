@@ -0,0 +1,72 @@
+/*
+********************************************************************************
+*
+* This example shows how to keep data in the backup SRAM of the Nicla Vision
+* while the microcontroller is in Standby Mode.
+*
+* Upload the same sketch to both the M7 and the M4 core.
+*
+* The LED light should follow this sequence:
+*
+*   - Red    = The data was created again, which happens after power-on
+*   - Green  = Blinks once for every wakeup so far, up to five times, which
+*              shows that the data survived Standby Mode
+*   - Off    = Standby Mode for 5 seconds
+*
+* This sequence repeats indefinitely.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+// The data to keep. Change the version passed to persistent() whenever the
+// layout of this struct changes.
+struct State {
+  unsigned int wakeups = 0;
+  float calibration = 1.0f;
+};
+
+void setup() {
+#if defined CORE_CM7
+  pinMode(LEDR, OUTPUT);
+  pinMode(LEDG, OUTPUT);
+  pinMode(LEDB, OUTPUT);
+  digitalWrite(LEDR, HIGH);
+  digitalWrite(LEDG, HIGH);
+  digitalWrite(LEDB, HIGH);
+  if (LowPowerReturnCode::success != LowPower.checkOptionBytes())
+  {
+    LowPower.prepareOptionBytes();
+  }
+  bootM4();
+
+  State& state = LowPower.persistent<State>(1);
+  if (!LowPower.persistentRestored())
+  {
+    digitalWrite(LEDR, LOW);
+    delay(1000);
+    digitalWrite(LEDR, HIGH);
+    delay(500);
+  }
+
+  for (unsigned int i = 0; i < (state.wakeups % 5) + 1; i++)
+  {
+    digitalWrite(LEDG, LOW);
+    delay(200);
+    digitalWrite(LEDG, HIGH);
+    delay(200);
+  }
+  state.wakeups++;
+
+  // standbyM7() updates the checksum, so the new count is kept
+  LowPower.standbyM7(5_s);
+#else
+  LowPower.standbyM4();
+#endif
+}
+
+void loop() {
+}
@@ -0,0 +1,95 @@
+/*
+********************************************************************************
+*
+* This example shows how to measure the VBAT voltage and the temperature of
+* the Nicla Vision, and wake up less often as the voltage drops.
+*
+* Upload the same sketch to both the M7 and the M4 core, and open the Serial
+* Monitor. It disconnects during Standby Mode, and reconnects after each
+* wakeup.
+*
+* The "measure" job runs every 10 seconds while VBAT is above 3.0 V, and up
+* to four times less often as it drops to 2.6 V. Each run takes a reading,
+* which is kept in the backup SRAM, and prints all the readings kept so far.
+* The voltage at the VBAT pin depends on what it's connected to on your
+* board, so change the voltages to fit it.
+*
+* The LED light should follow this sequence:
+*
+*   - Green  = The "measure" job runs
+*   - Red    = ADC3 couldn't take a reading
+*   - Off    = Standby Mode until the next run
+*
+* This sequence repeats indefinitely.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+WakeupScheduler scheduler;
+PowerMonitor monitor;
+
+// The period with a full battery, and where it starts to stretch
+const RTCWakeupDelay period = 10_s;
+const float lowVoltage = 3.0f;
+const float emptyVoltage = 2.6f;
+
+void setup() {
+#if defined CORE_CM7
+  pinMode(LEDR, OUTPUT);
+  pinMode(LEDG, OUTPUT);
+  digitalWrite(LEDR, HIGH);
+  digitalWrite(LEDG, HIGH);
+  LowPower.ensureOptionBytes();
+  bootM4();
+
+  Serial.begin(9600);
+  const unsigned long start = millis();
+  while (!Serial && ((millis() - start) < 3000))
+    ;
+
+  // The period only changes, and the job starts over, when the multiple
+  // from stretch() changes
+  scheduler.add("measure", monitor.stretch(period, lowVoltage, emptyVoltage));
+#else
+  LowPower.standbyM4();
+#endif
+}
+
+void loop() {
+#if defined CORE_CM7
+  if (scheduler.isDue("measure"))
+  {
+    digitalWrite(LEDG, LOW);
+    if (LowPowerReturnCode::success != monitor.sample())
+    {
+      digitalWrite(LEDR, LOW);
+    }
+
+    for (size_t i = 0; i < monitor.count(); i++)
+    {
+      const PowerReading reading = monitor.at(i);
+      Serial.print(static_cast<unsigned long>(reading.time / 1000));
+      Serial.print(" s: VBAT ");
+      Serial.print(reading.vbat, 3);
+      Serial.print(" V, VDDA ");
+      Serial.print(reading.vdda, 3);
+      Serial.print(" V, ");
+      Serial.print(reading.temperature, 1);
+      Serial.println(" C");
+    }
+    Serial.flush();
+    delay(100);
+    digitalWrite(LEDG, HIGH);
+    digitalWrite(LEDR, HIGH);
+  }
+
+  // With a short period, printing all the readings can run into the next
+  // measurement. standbyM7() then returns without sleeping, and loop()
+  // measures again right away.
+  LowPower.standbyM7(scheduler.wakeupSources());
+#endif
+}
@@ -0,0 +1,80 @@
+/*
+********************************************************************************
+*
+* This example shows how to profile the time that the Nicla Vision spends
+* awake, in Sleep, and in Deep Sleep.
+*
+* The sketch alternates between a busy phase and an idle phase, and records
+* each phase with its own tag. After every 16 recorded phases, it prints the
+* logged intervals and a histogram of the duty cycle, which is the share of
+* each interval spent awake. The busy phases should end up in the last bin,
+* and the idle phases in the first bin.
+*
+* The log is kept in the backup SRAM, so the intervals from before a reset
+* are still there after it, with a lower boot number.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+const uint16_t busyTag = 1;
+const uint16_t idleTag = 2;
+
+PowerProfiler profiler;
+unsigned int phases = 0;
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial)
+    ;
+  Serial.print("Intervals kept from before: ");
+  Serial.println(profiler.size());
+  // Start a new interval from here, so that the first busy phase doesn't
+  // include the time waiting for the serial port
+  profiler.record();
+}
+
+void loop() {
+  // Busy phase
+  const unsigned long start = micros();
+  while (micros() - start < 200000)
+    ;
+  profiler.record(busyTag);
+
+  // Idle phase, where delay() lets Mbed put the board to sleep
+  delay(200);
+  profiler.record(idleTag);
+
+  phases += 2;
+  if (0 == phases % 16) {
+    for (size_t i = 0; i < profiler.size(); i++) {
+      const PowerProfiler::Interval entry = profiler.interval(i);
+      Serial.print("Boot ");
+      Serial.print(entry.boot);
+      Serial.print(", tag ");
+      Serial.print(entry.tag);
+      Serial.print(": ");
+      Serial.print(entry.duration);
+      Serial.print(" us in total, ");
+      Serial.print(entry.awake);
+      Serial.print(" us awake, ");
+      Serial.print(entry.sleep);
+      Serial.print(" us in Sleep, ");
+      Serial.print(entry.deepSleep);
+      Serial.println(" us in Deep Sleep");
+    }
+
+    uint16_t bins[4];
+    profiler.histogram(PowerProfiler::Metric::dutyCycle, bins, 4);
+    Serial.print("Duty cycle histogram (0-25%, 25-50%, 50-75%, 75-100%): ");
+    for (size_t i = 0; i < 4; i++) {
+      Serial.print(bins[i]);
+      Serial.print(" ");
+    }
+    Serial.println();
+    Serial.println();
+  }
+}
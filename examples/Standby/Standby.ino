@@ -31,10 +31,7 @@ void setup() {
   pinMode(LEDR, OUTPUT);
   pinMode(LEDG, OUTPUT);
   pinMode(LEDB, OUTPUT);
-  if (LowPowerReturnCode::success != LowPower.checkOptionBytes())
-  {
-    LowPower.prepareOptionBytes();
-  }
+  LowPower.ensureOptionBytes();
   bootM4();
 #endif
 
@@ -126,6 +123,9 @@ void setup() {
   LowPower.standbyM7();
   // The following is an alternative way to go into standby for 10 seconds
 //  LowPower.standbyM7(RTCWakeupDelay(0, 0, 10));
+  // The following wakes up after 10 seconds, or earlier on a rising edge on
+  // the WKUP1 pin
+//  LowPower.standbyM7(WakeupSources().pin(WakeupPin::wkup1, WakeupEdge::rising).rtc(10_s));
 #else
   LowPower.standbyM4();
 #endif
@@ -0,0 +1,67 @@
+/*
+********************************************************************************
+*
+* This example shows how long standbyM7() takes to prepare the Nicla Vision for
+* Standby Mode, with and without the RTC fast path.
+*
+* Upload the same sketch to both the M7 and the M4 core, and open the Serial
+* Monitor.
+*
+* The sketch alternates between two ways of entering Standby Mode for 5
+* seconds. Every other time, the RTC is set up from scratch, and the rest of the
+* time, the already running RTC is reused so that only the wakeup timer is
+* programmed. After each wakeup, the number of CPU cycles that were spent
+* before entering Standby Mode is printed, together with the way the RTC was
+* prepared.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+void setup() {
+#if defined CORE_CM7
+  if (LowPowerReturnCode::success != LowPower.checkOptionBytes())
+  {
+    LowPower.prepareOptionBytes();
+  }
+  bootM4();
+
+  Serial.begin(9600);
+  while (!Serial)
+    ;
+
+  if (LowPower.wasInCPUMode(CPUMode::standby) ||
+      LowPower.wasInCPUMode(CPUMode::d1DomainStandby))
+  {
+    const uint32_t cycles = LowPower.lastStandbyEntryCycles();
+    Serial.print(LowPower.lastStandbyUsedRTCFastPath() ? "RTC reused:   "
+                                                       : "RTC set up:   ");
+    Serial.print(cycles);
+    Serial.print(" cycles (");
+    Serial.print(cycles / (SystemCoreClock / 1000000));
+    Serial.println(" us) before entering Standby Mode");
+  }
+  LowPower.resetPreviousCPUModeFlags();
+
+  // Give the Serial Monitor some time to receive the output
+  delay(1000);
+
+  // Alternate between the two ways of preparing the RTC
+  if (LowPower.lastStandbyUsedRTCFastPath())
+  {
+    LowPower.standbyM7(5_s, RTCSetup::full);
+  }
+  else
+  {
+    LowPower.standbyM7(5_s, RTCSetup::reuseIfConfigured);
+  }
+#else
+  LowPower.standbyM4();
+#endif
+}
+
+void loop() {
+}
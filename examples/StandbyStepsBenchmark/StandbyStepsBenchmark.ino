@@ -0,0 +1,90 @@
+/*
+********************************************************************************
+*
+* This example shows how much time the optional steps of standbyM7() take,
+* by entering Standby Mode with a different set of steps each time.
+*
+* Upload the same sketch to both the M7 and the M4 core, and open the Serial
+* Monitor.
+*
+* The sketch cycles through four ways of entering Standby Mode for 5 seconds:
+* with all the steps, with only the bus resets, with only the full D-cache
+* clean, and with neither, where only the buffer below is cleaned from the
+* D-cache. After each wakeup, the number of CPU cycles that were spent before
+* entering Standby Mode is printed, together with the set of steps. The set of
+* steps to use next is kept in the backup SRAM.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+struct Benchmark {
+  unsigned int steps = 0;
+};
+
+const char* const names[] = {
+  "All steps:          ",
+  "Bus resets only:    ",
+  "Full clean only:    ",
+  "Range clean only:   "
+};
+
+// Some data that the sketch wants to be written to memory before Standby Mode
+uint8_t buffer[256];
+
+void setup() {
+#if defined CORE_CM7
+  if (LowPowerReturnCode::success != LowPower.checkOptionBytes())
+  {
+    LowPower.prepareOptionBytes();
+  }
+  bootM4();
+
+  Serial.begin(9600);
+  while (!Serial)
+    ;
+
+  Benchmark& benchmark = LowPower.persistent<Benchmark>();
+  if (LowPower.persistentRestored() &&
+      (LowPower.wasInCPUMode(CPUMode::standby) ||
+       LowPower.wasInCPUMode(CPUMode::d1DomainStandby)))
+  {
+    const uint32_t cycles = LowPower.lastStandbyEntryCycles();
+    Serial.print(names[benchmark.steps]);
+    Serial.print(cycles);
+    Serial.print(" cycles (");
+    Serial.print(cycles / (SystemCoreClock / 1000000));
+    Serial.println(" us) before entering Standby Mode");
+    benchmark.steps = (benchmark.steps + 1) % 4;
+  }
+  LowPower.resetPreviousCPUModeFlags();
+
+  // Give the Serial Monitor some time to receive the output
+  delay(1000);
+
+  switch (benchmark.steps)
+  {
+    case 0:
+      LowPower.standbyM7<StandbySteps::all>(5_s);
+      break;
+    case 1:
+      LowPower.standbyM7<StandbySteps::resetBuses>(5_s);
+      break;
+    case 2:
+      LowPower.standbyM7<StandbySteps::cleanCache>(5_s);
+      break;
+    default:
+      LowPower.standbyM7<StandbySteps::none>(5_s, RTCSetup::reuseIfConfigured,
+                                              buffer, sizeof(buffer));
+      break;
+  }
+#else
+  LowPower.standbyM4();
+#endif
+}
+
+void loop() {
+}
@@ -0,0 +1,76 @@
+/*
+********************************************************************************
+*
+* This example shows how to get the whole microcontroller of the Nicla Vision
+* into Standby Mode from the M7 core, with the M4 core following on request.
+*
+* Upload the same sketch to both the M7 and the M4 core.
+*
+* The LED light should follow this sequence:
+*
+*   - Blue   = The M7 core is running
+*   - Green  = The whole microcontroller was in Standby Mode (not the first
+*              time), followed by the time the handshake took, as one red
+*              blink per 10 microseconds
+*   - Red    = The M4 core didn't enter Standby Mode when requested
+*   - Off    = Standby Mode for 10 seconds
+*
+* This sequence repeats indefinitely.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+void setup() {
+#if defined CORE_CM7
+  pinMode(LEDR, OUTPUT);
+  pinMode(LEDG, OUTPUT);
+  pinMode(LEDB, OUTPUT);
+  digitalWrite(LEDR, HIGH);
+  digitalWrite(LEDG, HIGH);
+  digitalWrite(LEDB, HIGH);
+  if (LowPowerReturnCode::success != LowPower.checkOptionBytes())
+  {
+    LowPower.prepareOptionBytes();
+  }
+  bootM4();
+
+  digitalWrite(LEDB, LOW);
+  delay(2000);
+  digitalWrite(LEDB, HIGH);
+  delay(500);
+
+  if (LowPower.wasInCPUMode(CPUMode::standby))
+  {
+    digitalWrite(LEDG, LOW);
+    delay(2000);
+    digitalWrite(LEDG, HIGH);
+    delay(500);
+
+    const uint32_t microseconds =
+      LowPower.lastStandbyHandshakeCycles() / (SystemCoreClock / 1000000);
+    for (uint32_t i = 0; i < (microseconds / 10) + 1; i++)
+    {
+      digitalWrite(LEDR, LOW);
+      delay(200);
+      digitalWrite(LEDR, HIGH);
+      delay(200);
+    }
+  }
+  LowPower.resetPreviousCPUModeFlags();
+
+  if (LowPowerReturnCode::success != LowPower.standbySystem(10_s))
+  {
+    digitalWrite(LEDR, LOW);
+  }
+#else
+  // The M4 core enters Standby Mode as soon as the M7 core asks for it
+  LowPower.enableStandbyRequests();
+#endif
+}
+
+void loop() {
+}
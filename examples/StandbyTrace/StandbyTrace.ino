@@ -0,0 +1,89 @@
+/*
+********************************************************************************
+*
+* This example shows how to find out which step of standbyM7() takes the time
+* before the microcontroller enters Standby Mode.
+*
+* Upload the same sketch to both the M7 and the M4 core, and open the Serial
+* Monitor.
+*
+* The sketch enables the standby trace and enters Standby Mode for 5 seconds,
+* alternately with the RTC set up from scratch and with the RTC reused. After
+* each wakeup, it prints how many microseconds each step took, so that a slow
+* start of LSE, for example, stands out.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+const char* const checkpointNames[StandbyTrace::checkpoints] = {
+  "Flash ready:           ",
+  "Voltage scaled:        ",
+  "LSE started:           ",
+  "RTC initialized:       ",
+  "Wakeup timer writable: ",
+  "RTC programmed:        ",
+  "Interrupts masked:     ",
+  "Buses reset:           ",
+  "Data committed:        ",
+  "Cache cleaned:         "
+};
+
+struct Run {
+  bool fullRTCSetup = true;
+};
+
+void setup() {
+#if defined CORE_CM7
+  LowPower.ensureOptionBytes();
+  bootM4();
+
+  Serial.begin(9600);
+  while (!Serial)
+    ;
+
+  const StandbyTrace trace = LowPower.lastStandbyTrace();
+  if (trace.valid)
+  {
+    const uint32_t cyclesPerMicrosecond = trace.coreClock / 1000000;
+    for (size_t i = 0; i < StandbyTrace::checkpoints; ++i)
+    {
+      Serial.print(checkpointNames[i]);
+      const uint32_t cycles =
+        trace.duration(static_cast<StandbyCheckpoint>(i));
+      if (0 == cycles)
+      {
+        Serial.println("skipped");
+      }
+      else
+      {
+        Serial.print(cycles / cyclesPerMicrosecond);
+        Serial.println(" us");
+      }
+    }
+    Serial.print("Total:                 ");
+    Serial.print(trace.total / cyclesPerMicrosecond);
+    Serial.println(" us");
+    Serial.println();
+  }
+
+  // Give the Serial Monitor some time to receive the output
+  delay(1000);
+
+  Run& run = LowPower.persistent<Run>();
+  const RTCSetup setup = run.fullRTCSetup ? RTCSetup::full :
+                                            RTCSetup::reuseIfConfigured;
+  run.fullRTCSetup = !run.fullRTCSetup;
+
+  LowPower.enableStandbyTrace();
+  LowPower.standbyM7(5_s, setup);
+#else
+  LowPower.standbyM4();
+#endif
+}
+
+void loop() {
+}
@@ -0,0 +1,62 @@
+/*
+********************************************************************************
+*
+* This example shows how to get the microcontroller of the Nicla Vision into
+* Stop Mode for 2 seconds at a time, while keeping the contents of SRAM.
+*
+* Upload the same sketch to both the M7 and the M4 core.
+*
+* The LED light should follow this sequence:
+*
+*   - Green  = Blinks once for every wakeup so far, up to five times, which
+*              shows that the counter in SRAM survived Stop Mode
+*   - Off    = Stop Mode for 2 seconds
+*   - Red    = Stop Mode could not be entered, or the clocks were not restored
+*
+* This sequence repeats indefinitely.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+#if defined CORE_CM7
+// This counter is kept in SRAM while the microcontroller is in Stop Mode
+unsigned int wakeups = 0;
+#endif
+
+void setup() {
+#if defined CORE_CM7
+  pinMode(LEDR, OUTPUT);
+  pinMode(LEDG, OUTPUT);
+  pinMode(LEDB, OUTPUT);
+  digitalWrite(LEDR, HIGH);
+  digitalWrite(LEDG, HIGH);
+  digitalWrite(LEDB, HIGH);
+  bootM4();
+#endif
+}
+
+void loop() {
+#if defined CORE_CM7
+  for (unsigned int i = 0; i < (wakeups % 5) + 1; i++)
+  {
+    digitalWrite(LEDG, LOW);
+    delay(200);
+    digitalWrite(LEDG, HIGH);
+    delay(200);
+  }
+
+  if (LowPowerReturnCode::success != LowPower.stopM7(2_s))
+  {
+    digitalWrite(LEDR, LOW);
+    delay(2000);
+    digitalWrite(LEDR, HIGH);
+  }
+  wakeups++;
+#else
+  LowPower.stopM4();
+#endif
+}
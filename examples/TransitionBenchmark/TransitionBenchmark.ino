@@ -0,0 +1,203 @@
+/*
+********************************************************************************
+*
+* This example shows how fast the Nicla Vision enters and leaves each of the
+* low power modes, so that a new release of the library can be checked for a
+* slower wakeup. Each transition is repeated a number of times, and the
+* shortest, mean and longest times are printed.
+*
+* Upload the same sketch to both the M7 and the M4 core, and open the Serial
+* Monitor.
+*
+* On the first boot, both cores measure the time from a timer interrupt until
+* the thread that waits for it runs again, after the core has been in Sleep
+* Mode. The M4 core sends its results to the M7 core through RPC. The M7 core
+* then measures the time stopM7() spends entering Stop Mode and restoring the
+* clocks. After that, it enters Standby Mode once per iteration, and measures
+* the time spent before entering Standby Mode, and the time from the RTC
+* wakeup until setup() runs again. The results so far are kept in the backup
+* SRAM, and are printed when all the iterations are done.
+*
+* The times are also visible on pin D1 with a logic analyzer:
+* - Sleep Mode: a pulse from the interrupt until the thread runs again.
+* - Stop Mode: a pulse from the call to stopM7() until it returns, which
+*   includes the delay of 10 milliseconds.
+* - Standby Mode: low from the call to standbyM7() until setup() runs again,
+*   which includes the delay of 1 second.
+* Both cores use the pin, but never at the same time.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+#include "SerialRPC.h"
+
+// The number of times each transition is measured
+const uint32_t iterations = 20;
+
+// The pin that marks the transitions for a logic analyzer
+const int markerPin = D1;
+
+// The M7 core sends this to ask the M4 core for its results
+const char benchmarkRequest = 'b';
+
+struct Statistics {
+  uint32_t count = 0;
+  float minimum = 0;
+  float maximum = 0;
+  float total = 0;
+
+  void add(const float microseconds) {
+    if ((0 == count) || (microseconds < minimum)) {
+      minimum = microseconds;
+    }
+    if ((0 == count) || (microseconds > maximum)) {
+      maximum = microseconds;
+    }
+    total += microseconds;
+    count++;
+  }
+
+  void print(const char* const name) const {
+    Serial.print(name);
+    Serial.print(" min ");
+    Serial.print(minimum);
+    Serial.print(" us, mean ");
+    Serial.print((0 != count) ? total / count : 0);
+    Serial.print(" us, max ");
+    Serial.print(maximum);
+    Serial.print(" us (");
+    Serial.print(count);
+    Serial.println(" times)");
+  }
+};
+
+// Kept in the backup SRAM through Standby Mode
+struct StandbyBenchmark {
+  Statistics entry;
+  Statistics boot;
+};
+
+static osThreadId_t benchmarkThread = nullptr;
+static volatile uint32_t interruptCycles = 0;
+
+static void timerInterrupt() {
+  interruptCycles = DWT->CYCCNT;
+  digitalWrite(markerPin, HIGH);
+  osThreadFlagsSet(benchmarkThread, 1);
+}
+
+static float cyclesToMicroseconds(const uint32_t cycles) {
+  return static_cast<float>(cycles) / (SystemCoreClock / 1000000);
+}
+
+static void benchmarkSleep(const char* const name) {
+  // The Mbed timers hold a Deep Sleep lock, so the core only enters Sleep Mode
+  mbed::Timeout timer;
+  Statistics sleep;
+  benchmarkThread = rtos::ThisThread::get_id();
+  for (uint32_t i = 0; i < iterations; i++) {
+    timer.attach(&timerInterrupt, std::chrono::milliseconds(10));
+    rtos::ThisThread::flags_wait_any(1);
+    const uint32_t cycles = DWT->CYCCNT - interruptCycles;
+    digitalWrite(markerPin, LOW);
+    sleep.add(cyclesToMicroseconds(cycles));
+  }
+  sleep.print(name);
+}
+
+void setup() {
+  // Read this first, so that the rest of setup() isn't part of the result
+  const uint32_t setupCycles = LowPower.wakeupInfo().cyclesSinceCapture();
+  pinMode(markerPin, OUTPUT);
+  digitalWrite(markerPin, HIGH);
+
+#if defined CORE_CM7
+  LowPower.ensureOptionBytes();
+
+  Serial.begin(9600);
+  while (!Serial)
+    ;
+  digitalWrite(markerPin, LOW);
+
+  StandbyBenchmark& standby = LowPower.persistent<StandbyBenchmark>();
+  const bool fromStandby = LowPower.persistentRestored() &&
+                           (LowPower.wasInCPUMode(CPUMode::standby) ||
+                            LowPower.wasInCPUMode(CPUMode::d1DomainStandby));
+  LowPower.resetPreviousCPUModeFlags();
+
+  if (!fromStandby) {
+    standby = StandbyBenchmark();
+    LowPower.commitPersistent();
+
+    Serial.println("M7 core:");
+    benchmarkSleep("Sleep exit:         ");
+
+    Statistics stop;
+    for (uint32_t i = 0; i < iterations; i++) {
+      digitalWrite(markerPin, HIGH);
+      LowPower.stopM7(10_ms);
+      digitalWrite(markerPin, LOW);
+      stop.add(LowPower.lastStopOverhead());
+    }
+    stop.print("Stop entry and exit:");
+
+    // Ask the M4 core until it answers, and print what it sends for a while
+    bootM4();
+    SerialRPC.begin();
+    Serial.println("M4 core:");
+    bool answered = false;
+    const unsigned long start = millis();
+    while ((millis() - start) < 3000) {
+      if (!answered && (0 == ((millis() - start) % 200))) {
+        SerialRPC.write(benchmarkRequest);
+        delay(1);
+      }
+      while (SerialRPC.available()) {
+        answered = true;
+        Serial.write(SerialRPC.read());
+      }
+    }
+  } else {
+    bootM4();
+
+    const WakeupInfo& info = LowPower.wakeupInfo();
+    standby.entry.add(cyclesToMicroseconds(LowPower.lastStandbyEntryCycles()));
+    if (info.hasWakeupLatency()) {
+      // The latency up to the capture only has a resolution of a millisecond
+      standby.boot.add(info.wakeupLatency() * 1000.0f +
+                       cyclesToMicroseconds(setupCycles));
+    }
+    LowPower.commitPersistent();
+  }
+
+  if (standby.entry.count < iterations) {
+    // Give the Serial Monitor some time to receive the output
+    Serial.flush();
+    delay(100);
+    digitalWrite(markerPin, LOW);
+    LowPower.standbyM7(1_s);
+  }
+
+  Serial.println("M7 core:");
+  standby.entry.print("Standby entry:      ");
+  standby.boot.print("Standby to setup(): ");
+#else
+  // Only measure when asked to, so that the results are only sent on the
+  // first boot, and not after each time the M7 core wakes up
+  Serial.begin(9600);
+  const unsigned long start = millis();
+  while ((millis() - start) < 3000) {
+    if (Serial.available() && (benchmarkRequest == Serial.read())) {
+      benchmarkSleep("Sleep exit:         ");
+      break;
+    }
+  }
+  LowPower.standbyM4();
+#endif
+}
+
+void loop() {
+}
@@ -0,0 +1,79 @@
+/*
+********************************************************************************
+*
+* This example shows why the Nicla Vision woke up, and how long it took from the
+* wakeup until setup() started running.
+*
+* Upload the same sketch to both the M7 and the M4 core, and open the Serial
+* Monitor.
+*
+* The sketch enters Standby Mode for 5 seconds at a time. After each wakeup, it
+* prints what woke the board up. For RTC wakeups, it also prints the time from
+* the wakeup until the wakeup information was captured early during startup,
+* which is mostly spent starting Mbed, and the time from the capture until
+* setup() started running, which is mostly spent in the rest of the startup.
+*
+* This code is in the public domain
+*
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+void setup() {
+#if defined CORE_CM7
+  // Read this first, so that the rest of setup() isn't part of the result
+  const uint32_t setupCycles = LowPower.wakeupInfo().cyclesSinceCapture();
+
+  if (LowPowerReturnCode::success != LowPower.checkOptionBytes())
+  {
+    LowPower.prepareOptionBytes();
+  }
+  bootM4();
+
+  Serial.begin(9600);
+  while (!Serial)
+    ;
+
+  const WakeupInfo& info = LowPower.wakeupInfo();
+  Serial.print("Woken up by:");
+  if (info.wokeUpByRTC())
+  {
+    Serial.print(" RTC");
+  }
+  if (info.wakeupPinFlags)
+  {
+    Serial.print(" wakeup pin");
+  }
+  if (info.wasResetByNRST())
+  {
+    Serial.print(" NRST");
+  }
+  if (info.wasResetByWatchdog())
+  {
+    Serial.print(" watchdog");
+  }
+  Serial.println();
+
+  if (info.hasWakeupLatency())
+  {
+    Serial.print("Wakeup to capture: ");
+    Serial.print(info.wakeupLatency());
+    Serial.println(" ms");
+  }
+  Serial.print("Capture to setup(): ");
+  Serial.print(setupCycles / (SystemCoreClock / 1000000));
+  Serial.println(" us");
+  LowPower.resetPreviousCPUModeFlags();
+
+  // Give the Serial Monitor some time to receive the output
+  delay(1000);
+
+  LowPower.standbyM7(5_s);
+#else
+  LowPower.standbyM4();
+#endif
+}
+
+void loop() {
+}
@@ -25,6 +25,474 @@
 */
 
 #include "Arduino_LowPowerNiclaVision.h"
+#include "BackupSRAM.h"
+
+/*
+********************************************************************************
+*                             Backup registers
+********************************************************************************
+*/
+
+// The RTC backup registers keep their values through Standby Mode. We use
+// registers from the top of the range, because the bootloader uses BKP0R.
+#define STANDBY_ENTRY_CYCLES_REGISTER       (RTC->BKP31R)
+#define STANDBY_RTC_FAST_PATH_REGISTER      (RTC->BKP30R)
+#define SCHEDULED_WAKEUP_HIGH_REGISTER      (RTC->BKP29R)
+#define SCHEDULED_WAKEUP_LOW_REGISTER       (RTC->BKP28R)
+#define STANDBY_HANDSHAKE_CYCLES_REGISTER   (RTC->BKP27R)
+#define OPTION_BYTES_VERIFIED_REGISTER      (RTC->BKP26R)
+
+// Combined with the option byte word that was verified, so that the mark no
+// longer matches if the option bytes change
+static const uint32_t OPTION_BYTES_VERIFIED_MARK = 0x4f425631;    // "OBV1"
+
+/*
+********************************************************************************
+*                              Persistent data
+********************************************************************************
+*/
+
+static const uint32_t PERSISTENT_MAGIC = 0x50455231;     // "PER1"
+
+// Set once the persistent data has been checked after a reset. From then on,
+// the checksum is out of date until the next commit, so it isn't checked again.
+static bool persistentChecked = false;
+static bool persistentWasRestored = false;
+
+/*
+********************************************************************************
+*                               Flash waiting
+********************************************************************************
+*/
+
+static bool isFlashBusy()
+{
+    // 0x07 = QW, WBNE, and BSY flags
+    return (FLASH->SR1 & 0x07) || (FLASH->SR2 & 0x07);
+}
+
+// A thread flag that Mbed doesn't use itself
+static const uint32_t FLASH_READY_FLAG = 1UL << 30;
+static osThreadId_t flashReadyThread = nullptr;
+
+// How often to check a flash bank that is locked, in milliseconds
+static const uint32_t FLASH_POLL_INTERVAL = 10;
+
+// The banks whose end of operation interrupt was enabled here, as bits 0 and
+// 1. The interrupts that the code writing to the flash has enabled itself,
+// such as through HAL_FLASHEx_Erase_IT(), are left to it and to the handler
+// that was installed before.
+static uint32_t flashReadyBanks = 0;
+// The banks that were locked again before their interrupt could be disabled.
+// The unlock keys belong to the code writing to the flash, so the interrupt
+// is left enabled, and is disabled in the next end of operation interrupt of
+// the bank, while it's unlocked. flashReadyHandler() stays installed until
+// then, without waking a thread or passing the end of operation on.
+static uint32_t flashStaleBanks = 0;
+static uint32_t previousFlashHandler = 0;
+
+// Only a bank that is unlocked can have its interrupt enabled, which is
+// always the case while its owner is writing to it
+static void enableFlashReadyInterrupt(volatile uint32_t& cr,
+                                      const uint32_t bank)
+{
+    if (cr & (FLASH_CR_LOCK | (FLASH_IT_ALL_BANK1 & ~FLASH_CR_EOPIE)))
+    {
+        return;
+    }
+    if (!(cr & FLASH_CR_EOPIE) || (flashStaleBanks & bank))
+    {
+        cr |= FLASH_CR_EOPIE;
+        flashReadyBanks |= bank;
+        flashStaleBanks &= ~bank;
+    }
+}
+
+static void disableFlashReadyInterrupt(volatile uint32_t& cr,
+                                       const uint32_t bank)
+{
+    if (!((flashReadyBanks | flashStaleBanks) & bank))
+    {
+        return;
+    }
+    flashReadyBanks &= ~bank;
+
+    // If the owner has started an operation with interrupts since, it has
+    // enabled the error interrupts too, and the end of operation one is its
+    // own now
+    if (cr & (FLASH_IT_ALL_BANK1 & ~FLASH_CR_EOPIE))
+    {
+        flashStaleBanks &= ~bank;
+        return;
+    }
+    if (cr & FLASH_CR_LOCK)
+    {
+        flashStaleBanks |= bank;
+        return;
+    }
+    cr &= ~FLASH_CR_EOPIE;
+    flashStaleBanks &= ~bank;
+}
+
+static bool flashOwnerInterruptsEnabled()
+{
+    return ((FLASH->CR1 | FLASH->CR2) & FLASH_IT_ALL_BANK1) != 0;
+}
+
+// The interrupt only has to wake the waiting thread up. The EOP flag is left
+// set for the code that started the operation, since the HAL clears it
+// itself, either after polling or in the handler from before. A bank that is
+// already locked again is done with it, so the flag is cleared there, or the
+// interrupt left enabled on it would keep coming.
+static void flashReadyHandler(void)
+{
+    disableFlashReadyInterrupt(FLASH->CR1, 1);
+    disableFlashReadyInterrupt(FLASH->CR2, 2);
+    if ((flashStaleBanks & 1) && (FLASH->SR1 & FLASH_SR_EOP))
+    {
+        FLASH->CCR1 = FLASH_CCR_CLR_EOP;
+    }
+    if ((flashStaleBanks & 2) && (FLASH->SR2 & FLASH_SR_EOP))
+    {
+        FLASH->CCR2 = FLASH_CCR_CLR_EOP;
+    }
+    if (nullptr != flashReadyThread)
+    {
+        osThreadFlagsSet(flashReadyThread, FLASH_READY_FLAG);
+    }
+    if (flashOwnerInterruptsEnabled() && (0 != previousFlashHandler))
+    {
+        reinterpret_cast<void (*)(void)>(previousFlashHandler)();
+    }
+    if ((nullptr == flashReadyThread) && (0 == flashStaleBanks))
+    {
+        NVIC_SetVector(FLASH_IRQn, previousFlashHandler);
+    }
+}
+
+/*
+********************************************************************************
+*                            Performance levels
+********************************************************************************
+*/
+
+// How much PLL1P is divided compared to boot, or 0 for HSI, and the voltage
+// scaling for each PerformanceLevel, in the same order as the enum
+struct PerformanceSetup
+{
+    uint32_t pllDivider;
+    uint32_t voltageScaling;
+};
+
+static const PerformanceSetup performanceSetups[] = {
+    {1, PWR_REGULATOR_VOLTAGE_SCALE0},
+    {2, PWR_REGULATOR_VOLTAGE_SCALE1},
+    {4, PWR_REGULATOR_VOLTAGE_SCALE2},
+    {0, PWR_REGULATOR_VOLTAGE_SCALE3}
+};
+
+static PerformanceLevel currentPerformanceLevel = PerformanceLevel::max;
+
+// The time spent awake at each level up to the last change of level, and the
+// total time spent awake at that change
+static uint64_t performanceLevelTime[4] = {};
+static uint64_t performanceLevelSince = 0;
+
+/*
+********************************************************************************
+*                             RTC wakeup timer
+********************************************************************************
+*/
+
+// RTCWakeupDelay works out the WUCKSEL bits as plain numbers, so that the
+// header doesn't depend on the LL definitions
+static_assert((0 == LL_RTC_WAKEUPCLOCK_DIV_16) &&
+              (1 == LL_RTC_WAKEUPCLOCK_DIV_8) &&
+              (2 == LL_RTC_WAKEUPCLOCK_DIV_4) &&
+              (3 == LL_RTC_WAKEUPCLOCK_DIV_2) &&
+              (4 == LL_RTC_WAKEUPCLOCK_CKSPRE) &&
+              (6 == LL_RTC_WAKEUPCLOCK_CKSPRE_WUT),
+              "The WUCKSEL values in RTCWakeupDelay don't match the LL ones");
+static_assert((10_s).fitsWakeupTimer() && !(36_h + 25_min).fitsWakeupTimer(),
+              "RTCWakeupDelay doesn't work out the wakeup timer at compile time");
+
+/*
+********************************************************************************
+*                               Standby steps
+********************************************************************************
+*/
+
+// A constant expression in standbyM7Sequence(), so that the steps that are
+// left out don't end up in the code
+constexpr bool includesStep(const StandbySteps steps, const StandbySteps step)
+{
+    return 0 != (static_cast<uint32_t>(steps) & static_cast<uint32_t>(step));
+}
+
+/*
+********************************************************************************
+*                               Standby trace
+********************************************************************************
+*/
+
+static const uint32_t STANDBY_TRACE_MAGIC = 0x53545231;   // "STR1"
+
+static bool standbyTraceEnabled = false;
+// Only set while standbyM7() runs, since initializeRTC() and
+// programRTCWakeup() are also used outside of it
+static bool standbyTraceActive = false;
+static uint32_t standbyTraceStart = 0;
+
+static void traceStandby(const StandbyCheckpoint checkpoint)
+{
+    if (standbyTraceActive)
+    {
+        backupSRAM().standbyTrace.cycles[static_cast<size_t>(checkpoint)] =
+            DWT->CYCCNT - standbyTraceStart;
+    }
+}
+
+/*
+********************************************************************************
+*                       Clock restore after Stop Mode
+********************************************************************************
+*/
+
+// What clockReadyHandler() still has to do after stopM7() has returned on HSI
+static volatile bool clockRestoreRunning = false;
+static uint32_t restorePLLs = 0;
+static uint32_t restoreReadyMask = 0;
+static uint32_t restoreSysclk = 0;
+static uint32_t restoreVoltageScaling = 0;
+
+// The RCC interrupt setup from before, which is put back when done
+static uint32_t previousRCCHandler = 0;
+static uint32_t previousRCCInterrupts = 0;
+static uint32_t previousRCCPriority = 0;
+static bool rccInterruptEnabled = false;
+
+/*
+********************************************************************************
+*                              Stop Mode time
+********************************************************************************
+*/
+
+// Mbed doesn't know about stopM7(), and counts the time in it as awake
+static uint64_t stopModeTime = 0;
+// Microseconds that the last stopM7() spent awake, entering and leaving it
+static uint32_t stopOverhead = 0;
+
+static uint64_t timeSpentAwake()
+{
+    mbed_stats_cpu_t stats{};
+    mbed_stats_cpu_get(&stats);
+    const uint64_t awake = stats.uptime - stats.idle_time;
+    return (awake > stopModeTime) ? (awake - stopModeTime) : 0;
+}
+
+/*
+********************************************************************************
+*                               M4 residency
+********************************************************************************
+*/
+
+// The M4 core publishes its residency at the end of SRAM4 in domain D3, where
+// the M7 core can read it. The RPC library keeps its buffers at the start of
+// SRAM4, and SRAM4 keeps its contents as long as either core is running.
+static const uint32_t M4_RESIDENCY_ADDRESS = 0x3800ff80;
+static const uint32_t M4_RESIDENCY_MAGIC = 0x4d345231;    // "M4R1"
+
+struct alignas(32) M4ResidencyBlock
+{
+    uint32_t magic;
+    // Odd while the M4 core is writing, so that the M7 core can tell if it
+    // read a mix of old and new values
+    volatile uint32_t sequence;
+    uint32_t boots;
+    uint32_t standbyEntries;
+    uint64_t standbyStart;          // RTC time of entering Standby Mode, or 0
+    uint64_t uptime;
+    uint64_t idle;
+    uint64_t sleep;
+    uint64_t deepSleep;
+    uint64_t stop;
+    uint64_t standby;
+};
+
+static_assert(sizeof(M4ResidencyBlock) <= 128,
+              "The M4 residency must fit at the end of SRAM4");
+
+// How many times the M7 core tries to read the block while the M4 core is
+// writing to it, before giving up
+static const uint32_t M4_RESIDENCY_READ_ATTEMPTS = 100;
+
+static M4ResidencyBlock& m4ResidencyBlock()
+{
+    return *reinterpret_cast<M4ResidencyBlock*>(M4_RESIDENCY_ADDRESS);
+}
+
+static void beginM4ResidencyUpdate(M4ResidencyBlock& block)
+{
+    block.sequence = block.sequence + 1;
+    __DMB();
+}
+
+static void endM4ResidencyUpdate(M4ResidencyBlock& block)
+{
+    __DMB();
+    block.sequence = block.sequence + 1;
+}
+
+/*
+********************************************************************************
+*                               Idle governor
+********************************************************************************
+*/
+
+static const uint32_t IDLE_GOVERNOR_MAGIC = 0x49444c31;   // "IDL1"
+
+// Rough figures until the first measurements. Stop Mode mostly waits for HSE
+// and PLL1 after waking up, and Standby Mode for the bootloader and Mbed.
+static const uint32_t DEFAULT_STOP_COST = 2000;           // In microseconds
+static const uint32_t DEFAULT_STANDBY_COST = 500000;      // In microseconds
+
+// Each measurement counts for this fraction of a cost, so that a single
+// unusual wakeup doesn't throw the choice off
+static const uint32_t IDLE_COST_WEIGHT = 8;
+
+static CurrentProfile idleProfile;
+
+static decltype(BackupSRAMLayout::idleGovernor)& idleGovernorState()
+{
+    auto& state = backupSRAM().idleGovernor;
+    if (IDLE_GOVERNOR_MAGIC != state.magic)
+    {
+        memset(&state, 0, sizeof(state));
+        state.magic = IDLE_GOVERNOR_MAGIC;
+        state.stopCost = DEFAULT_STOP_COST;
+        state.standbyCost = DEFAULT_STANDBY_COST;
+    }
+    return state;
+}
+
+static void refineIdleCost(uint32_t& cost,
+                           uint16_t& samples,
+                           const uint32_t measured)
+{
+    cost = (0 == samples) ? measured :
+           cost - cost / IDLE_COST_WEIGHT + measured / IDLE_COST_WEIGHT;
+    if (samples < UINT16_MAX)
+    {
+        samples++;
+    }
+}
+
+/*
+********************************************************************************
+*                            Deep Sleep options
+********************************************************************************
+*/
+
+// The subsystems that allowDeepSleep() has turned off, so that they are only
+// turned off once and can be turned on again by disallowDeepSleep()
+static uint8_t deepSleepTurnedOff = 0;
+
+static bool hasOption(const DeepSleepOption options,
+                      const DeepSleepOption option)
+{
+    return 0 != (static_cast<uint8_t>(options) & static_cast<uint8_t>(option));
+}
+
+/*
+********************************************************************************
+*                          Deep Sleep lock tracking
+********************************************************************************
+*/
+
+// The holders of locks taken through lockDeepSleep(). The last record is kept
+// for the holders that don't fit in the table.
+static DeepSleepLockRecord deepSleepLockRecords[DeepSleepLockTable::capacity];
+// The time when each holder went from holding no locks to holding one
+static uint64_t deepSleepLockedSince[DeepSleepLockTable::capacity];
+static size_t deepSleepLockHolders = 0;
+
+// Must be called from within a critical section
+static size_t findDeepSleepLockHolder(const char* const holder)
+{
+    const char* const name = (nullptr != holder) ? holder : "unknown";
+
+    for (size_t i = 0; i < deepSleepLockHolders; ++i)
+    {
+        // Compare the contents, because the same literal can have different
+        // addresses in different translation units
+        if (0 == strcmp(deepSleepLockRecords[i].holder, name))
+        {
+            return i;
+        }
+    }
+
+    if (deepSleepLockHolders < DeepSleepLockTable::capacity - 1)
+    {
+        deepSleepLockRecords[deepSleepLockHolders].holder = name;
+        return deepSleepLockHolders++;
+    }
+
+    const size_t other = DeepSleepLockTable::capacity - 1;
+    deepSleepLockRecords[other].holder = "other";
+    deepSleepLockHolders = DeepSleepLockTable::capacity;
+    return other;
+}
+
+// Must be called from within a critical section
+static bool isDeepSleepLockOverdue(const size_t index, const uint64_t now)
+{
+    const DeepSleepLockRecord& record = deepSleepLockRecords[index];
+    return (0 != record.held) && (0 != record.holdLimit) &&
+           ((now - deepSleepLockedSince[index]) / 1000 > record.holdLimit);
+}
+
+// The end of the time from noDeepSleepFor(), while its lock is held
+static mbed::Timeout noDeepSleepTimeout;
+static bool noDeepSleepActive = false;
+static uint64_t noDeepSleepUntil = 0;
+
+static void noDeepSleepExpired()
+{
+    LowPower.unlockDeepSleep("noDeepSleepFor");
+    noDeepSleepActive = false;
+}
+
+/*
+********************************************************************************
+*                          Dual-core standby handshake
+********************************************************************************
+*/
+
+// The hardware semaphore that the M7 core releases to tell the M4 core to
+// enter Standby Mode. The RPC library uses the lowest semaphores.
+static const uint32_t STANDBY_REQUEST_SEMAPHORE = 29;
+// How long the M7 core waits for the D2 domain to enter Standby Mode
+static const uint32_t STANDBY_HANDSHAKE_TIMEOUT = 100;      // In milliseconds
+
+// The interrupt handler that was installed for the HSEM before ours, which
+// handles the notifications for all the other semaphores
+static void (*previousHSEMHandler)(void) = nullptr;
+
+static void standbyRequestHandler(void)
+{
+    const uint32_t mask = 1 << STANDBY_REQUEST_SEMAPHORE;
+
+    if (HSEM->C2MISR & mask)
+    {
+        HSEM->C2ICR = mask;
+        // Only returns if Standby Mode couldn't be entered
+        LowPower.standbyM4();
+    }
+    if ((HSEM->C2MISR & ~mask) && (nullptr != previousHSEMHandler))
+    {
+        previousHSEMHandler();
+    }
+}
 
 /*
 ********************************************************************************
@@ -64,24 +532,10 @@ extern "C" void NMI_Handler(void)
 ********************************************************************************
 */
 
-RTCWakeupDelay operator+(const RTCWakeupDelay d1, const RTCWakeupDelay d2)
-{
-    return RTCWakeupDelay(d1.value + d2.value);
-}
-
-RTCWakeupDelay operator""_s(const unsigned long long int seconds)
-{
-    return RTCWakeupDelay(seconds);
-}
-
-RTCWakeupDelay operator""_min(const unsigned long long int minutes)
-{
-    return RTCWakeupDelay(minutes * 60);
-}
-
-RTCWakeupDelay operator""_h(const unsigned long long int hours)
+DeepSleepOption operator|(const DeepSleepOption o1, const DeepSleepOption o2)
 {
-    return RTCWakeupDelay(hours * 60 * 60);
+    return static_cast<DeepSleepOption>(static_cast<uint8_t>(o1) |
+                                         static_cast<uint8_t>(o2));
 }
 
 /*
@@ -98,13 +552,117 @@ const LowPowerNiclaVision& LowPower = LowPowerNiclaVision::getInstance();
 ********************************************************************************
 */
 
-void LowPowerNiclaVision::allowDeepSleep() const
+LowPowerNiclaVision::LowPowerNiclaVision()
+{
+    // This runs during static initialization, through the global LowPower
+    // reference, so it happens after Mbed has started but before setup()
+    enableCycleCounter();
+    info.cycles = DWT->CYCCNT;
+    info.resetFlags = RCC->RSR;
+    info.wakeupPinFlags = PWR->WKUPFR & 0x3f;
+
+    if (isRTCConfigured())
+    {
+#if defined CORE_CM7
+        info.rtcWakeupFlag = RTC->ISR & RTC_ISR_WUTF;
+        info.rtcAlarmFlag = RTC->ISR & RTC_ISR_ALRAF;
+#else
+        // The M4 core only wakes itself up with Alarm B
+        info.rtcAlarmFlag = RTC->ISR & RTC_ISR_ALRBF;
+#endif
+
+        HAL_PWR_EnableBkUpAccess();
+        LL_RTC_DisableWriteProtection(RTC);
+        // The shadow registers must be synchronized after a reset before the
+        // time can be read
+        LL_RTC_WaitForSynchro(RTC);
+        info.rtcTime = readRTCMilliseconds();
+#if defined CORE_CM7
+        info.scheduledRTCTime =
+            (static_cast<uint64_t>(SCHEDULED_WAKEUP_HIGH_REGISTER) << 32) |
+            SCHEDULED_WAKEUP_LOW_REGISTER;
+
+        // The wakeup timer keeps running periodically after waking up. Stop it
+        // and acknowledge everything, so that the next capture is correct.
+        LL_RTC_DisableIT_WUT(RTC);
+        LL_RTC_WAKEUP_Disable(RTC);
+        LL_RTC_ClearFlag_WUT(RTC);
+        LL_RTC_DisableIT_ALRA(RTC);
+        LL_RTC_ALMA_Disable(RTC);
+        LL_RTC_ClearFlag_ALRA(RTC);
+        LL_RTC_EnableWriteProtection(RTC);
+        SCHEDULED_WAKEUP_HIGH_REGISTER = 0;
+        SCHEDULED_WAKEUP_LOW_REGISTER = 0;
+#else
+        // The M4 core restarts on its own while the M7 core may be waiting
+        // for the wakeup timer or Alarm A, so it only touches Alarm B
+        LL_RTC_DisableIT_ALRB(RTC);
+        LL_RTC_ALMB_Disable(RTC);
+        LL_RTC_ClearFlag_ALRB(RTC);
+        LL_RTC_EnableWriteProtection(RTC);
+#endif
+    }
+#if defined CORE_CM7
+    // Bits 5:0 in WKUPCR clear the wakeup pin flags
+    PWR->WKUPCR = 0x3f;
+#else
+    M4ResidencyBlock& block = m4ResidencyBlock();
+    if (M4_RESIDENCY_MAGIC != block.magic)
+    {
+        memset(&block, 0, sizeof(block));
+        block.magic = M4_RESIDENCY_MAGIC;
+    }
+    else if (block.sequence & 1)
+    {
+        // The M4 core was reset in the middle of an update
+        block.sequence = block.sequence + 1;
+    }
+    beginM4ResidencyUpdate(block);
+    block.boots++;
+    if ((0 != block.standbyStart) && (info.rtcTime > block.standbyStart))
+    {
+        block.standby += (info.rtcTime - block.standbyStart) * 1000;
+    }
+    block.standbyStart = 0;
+    block.uptime = 0;
+    block.idle = 0;
+    block.sleep = 0;
+    block.deepSleep = 0;
+    block.stop = 0;
+    endM4ResidencyUpdate(block);
+#endif
+
+    bootSysclkSource = RCC->CFGR & RCC_CFGR_SW;
+    bootPLL1Divider = ((RCC->PLL1DIVR & RCC_PLL1DIVR_P1) >> RCC_PLL1DIVR_P1_Pos) + 1;
+    bootVoltageScaling = HAL_PWREx_GetVoltageRange();
+}
+
+void LowPowerNiclaVision::allowDeepSleep(const DeepSleepOption options) const
 {
+  const uint8_t usb = static_cast<uint8_t>(DeepSleepOption::usb);
+  const uint8_t microsTimer = static_cast<uint8_t>(DeepSleepOption::microsTimer);
+
   // Turn off USB
-  USBPhy * const phy = get_usb_phy();
-  phy->deinit();
+  if (hasOption(options, DeepSleepOption::usb) && !(deepSleepTurnedOff & usb))
+  {
+#if defined(SERIAL_CDC)
+    // Go through the USB device, so that it knows to initialize the PHY
+    // again in disallowDeepSleep()
+    PluggableUSBD().deinit();
+#else
+    USBPhy * const phy = get_usb_phy();
+    phy->deinit();
+#endif
+    deepSleepTurnedOff |= usb;
+    LowPowerLog::usbChanged(false);
+  }
   // Turn off the micros() timer
-  getTimer(TIMER).stop();
+  if (hasOption(options, DeepSleepOption::microsTimer) &&
+      !(deepSleepTurnedOff & microsTimer))
+  {
+    getTimer(TIMER).stop();
+    deepSleepTurnedOff |= microsTimer;
+  }
 }
 
 bool LowPowerNiclaVision::canDeepSleep() const
@@ -112,6 +670,37 @@ bool LowPowerNiclaVision::canDeepSleep() const
     return sleep_manager_can_deep_sleep();
 }
 
+bool LowPowerNiclaVision::canDeepSleep(const char*& overdueHolder) const
+{
+    overdueHolder = nullptr;
+
+    core_util_critical_section_enter();
+    const uint64_t now = ticker_read_us(get_us_ticker_data());
+    for (size_t i = 0; i < deepSleepLockHolders; ++i)
+    {
+        if (isDeepSleepLockOverdue(i, now))
+        {
+            overdueHolder = deepSleepLockRecords[i].holder;
+            break;
+        }
+    }
+    core_util_critical_section_exit();
+
+    return canDeepSleep();
+}
+
+void LowPowerNiclaVision::cancelRTCWakeup()
+{
+    HAL_PWR_EnableBkUpAccess();
+    LL_RTC_DisableWriteProtection(RTC);
+    LL_RTC_DisableIT_WUT(RTC);
+    LL_RTC_WAKEUP_Disable(RTC);
+    LL_RTC_ClearFlag_WUT(RTC);
+    LL_RTC_EnableWriteProtection(RTC);
+    SCHEDULED_WAKEUP_HIGH_REGISTER = 0;
+    SCHEDULED_WAKEUP_LOW_REGISTER = 0;
+}
+
 LowPowerReturnCode LowPowerNiclaVision::checkOptionBytes() const
 {
     FLASH_OBProgramInitTypeDef flashOBProgramInit{};
@@ -133,11 +722,654 @@ LowPowerReturnCode LowPowerNiclaVision::checkOptionBytes() const
     return LowPowerReturnCode::success;
 }
 
-// This function uses undocumented features of Mbed to retrieve the number
-// of active deep sleep locks. It is experimental and may break at any time,
-// but can be handy for some users to debug deep sleep lock problems.
-// It uses features of the compiled machine code to find the number of locks.
-uint16_t LowPowerNiclaVision::numberOfDeepSleepLocks() const
+LowPowerReturnCode LowPowerNiclaVision::checkRTCAlarm(const uint64_t alarmTime)
+{
+    // The alarm compares the day of the month, so it can't be more than the
+    // shortest month ahead. It must also be at least one subsecond tick ahead,
+    // or it may pass before the microcontroller has gone to sleep.
+    const uint64_t now = readRTCMilliseconds();
+    if (alarmTime < now + 4)
+    {
+        return LowPowerReturnCode::wakeupTimePassed;
+    }
+    if (alarmTime - now >= 28ULL * 24 * 60 * 60 * 1000)
+    {
+        return LowPowerReturnCode::wakeupDelayTooLong;
+    }
+    return LowPowerReturnCode::success;
+}
+
+void LowPowerNiclaVision::clockReadyHandler()
+{
+    // The ready flags are only set while their interrupts are enabled, so
+    // check the ready bits themselves. This also covers an oscillator that
+    // was ready before the interrupt was enabled.
+    RCC->CICR = RCC->CIFR & (RCC_CIFR_HSERDYF | RCC_CIFR_PLLRDYF);
+    if (!clockRestoreRunning)
+    {
+        return;
+    }
+
+    if ((0 != restorePLLs) &&
+        (restoreReadyMask == (RCC->CR & restoreReadyMask)))
+    {
+        RCC->CR |= restorePLLs;
+        restorePLLs = 0;
+    }
+    if ((0 != restorePLLs) || !(RCC->CR & RCC_CR_PLL1RDY))
+    {
+        return;
+    }
+
+    // If the voltage scaling can't be raised, the M7 core stays on HSI,
+    // which is slower but safe
+    const bool voltageRestored =
+        (restoreVoltageScaling == HAL_PWREx_GetVoltageRange()) ||
+        (HAL_OK == HAL_PWREx_ControlVoltageScaling(restoreVoltageScaling));
+    if (voltageRestored)
+    {
+        const uint32_t previousCoreClock = SystemCoreClock;
+        MODIFY_REG(RCC->CFGR, RCC_CFGR_SW, restoreSysclk);
+        LowPower.waitForRegister(RCC->CFGR, RCC_CFGR_SWS,
+                                 restoreSysclk << RCC_CFGR_SWS_Pos,
+                                 CLOCKSWITCH_TIMEOUT_VALUE);
+        LowPower.retimeTickers(previousCoreClock);
+    }
+
+    RCC->CIER = previousRCCInterrupts;
+    if (!rccInterruptEnabled)
+    {
+        NVIC_DisableIRQ(RCC_IRQn);
+    }
+    NVIC_SetPriority(RCC_IRQn, previousRCCPriority);
+    NVIC_SetVector(RCC_IRQn, previousRCCHandler);
+    clockRestoreRunning = false;
+}
+
+bool LowPowerNiclaVision::clockRestorePending() const
+{
+    return clockRestoreRunning;
+}
+
+void LowPowerNiclaVision::commitPersistent() const
+{
+    // Don't turn on the backup regulator if persistent() hasn't been used,
+    // because it draws extra current in Standby Mode
+    if (!persistentChecked)
+    {
+        return;
+    }
+
+    auto& persistent = backupSRAM().persistent;
+
+    if ((PERSISTENT_MAGIC == persistent.magic) &&
+        (persistent.size <= persistentCapacity))
+    {
+        persistent.checksum = backupSRAMChecksum(persistent.data,
+                                                 persistent.size);
+    }
+}
+
+LowPowerReturnCode LowPowerNiclaVision::configureRTCWakeup(
+    const uint32_t wakeupClock,
+    const uint32_t autoReload,
+    const RTCSetup setup,
+    bool& rtcFastPath) const
+{
+    rtcFastPath = (RTCSetup::reuseIfConfigured == setup) && isRTCConfigured();
+    if (!rtcFastPath)
+    {
+        const LowPowerReturnCode rtcResult = initializeRTC();
+        if (LowPowerReturnCode::success != rtcResult)
+        {
+            return rtcResult;
+        }
+    }
+    programRTCWakeup(wakeupClock, autoReload);
+    return LowPowerReturnCode::success;
+}
+
+void LowPowerNiclaVision::configureWakeupPins(const uint32_t pinConfig) const
+{
+    // The wakeup pins are EXTI lines 55-60, which are bits 28:23 in IMR2
+    EXTI->IMR2 |= (pinConfig & 0x3f) << 23;
+
+    // The pin configuration is already in the format of WKUPEPR. The flags
+    // must be cleared after the pins are configured, or a stale flag would end
+    // the sleep right away. Bits 5:0 in WKUPCR clear the wakeup pin flags.
+    PWR->WKUPEPR = pinConfig;
+    PWR->WKUPCR = 0x3f;
+}
+
+DeepSleepLockTable LowPowerNiclaVision::deepSleepLocks() const
+{
+    DeepSleepLockTable table;
+
+    core_util_critical_section_enter();
+    const uint64_t now = ticker_read_us(get_us_ticker_data());
+    for (size_t i = 0; i < deepSleepLockHolders; ++i)
+    {
+        DeepSleepLockRecord& record = table.records[i];
+        record = deepSleepLockRecords[i];
+        if (0 != record.held)
+        {
+            const uint64_t hold = now - deepSleepLockedSince[i];
+            record.heldTime += hold;
+            if (hold > record.longestHold)
+            {
+                record.longestHold = hold;
+            }
+            record.overdue = isDeepSleepLockOverdue(i, now);
+        }
+    }
+    table.count = deepSleepLockHolders;
+    core_util_critical_section_exit();
+
+    return table;
+}
+
+void LowPowerNiclaVision::disallowDeepSleep() const
+{
+  const uint8_t usb = static_cast<uint8_t>(DeepSleepOption::usb);
+  const uint8_t microsTimer = static_cast<uint8_t>(DeepSleepOption::microsTimer);
+
+  // Turn the micros() timer on again. It continues from where it stopped.
+  if (deepSleepTurnedOff & microsTimer)
+  {
+    getTimer(TIMER).start();
+    deepSleepTurnedOff &= ~microsTimer;
+  }
+  // Turn USB on again, and connect to the host, which enumerates the board
+  // from the start
+  if (deepSleepTurnedOff & usb)
+  {
+#if defined(SERIAL_CDC)
+    PluggableUSBD().init();
+    PluggableUSBD().connect();
+    deepSleepTurnedOff &= ~usb;
+    LowPowerLog::usbChanged(true);
+#endif
+    // Without a USB device there is nothing to connect, and the PHY stays off
+  }
+}
+
+void LowPowerNiclaVision::enableCycleCounter() const
+{
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+#if defined CORE_CM7
+    // The DWT registers are locked after reset on the Cortex-M7
+    DWT->LAR = 0xC5ACCE55;
+#endif
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void LowPowerNiclaVision::enableStandbyRequests() const
+{
+    __HAL_RCC_HSEM_CLK_ENABLE();
+
+    core_util_critical_section_enter();
+    if (reinterpret_cast<uint32_t>(&standbyRequestHandler) !=
+        NVIC_GetVector(HSEM2_IRQn))
+    {
+        previousHSEMHandler = reinterpret_cast<void (*)(void)>(
+            NVIC_GetVector(HSEM2_IRQn));
+        NVIC_SetVector(HSEM2_IRQn,
+                       reinterpret_cast<uint32_t>(&standbyRequestHandler));
+    }
+    // C2IER holds the notifications for the M4 core
+    HSEM->C2ICR = 1 << STANDBY_REQUEST_SEMAPHORE;
+    HSEM->C2IER |= 1 << STANDBY_REQUEST_SEMAPHORE;
+    NVIC_EnableIRQ(HSEM2_IRQn);
+    core_util_critical_section_exit();
+}
+
+void LowPowerNiclaVision::enableStandbyTrace(const bool enable) const
+{
+    if (enable)
+    {
+        enableCycleCounter();
+    }
+    standbyTraceEnabled = enable;
+}
+
+LowPowerReturnCode LowPowerNiclaVision::ensureOptionBytes() const
+{
+    // Reading the current option byte word is much cheaper than the full
+    // check, which reads all the option bytes of the bank
+    const uint32_t mark = FLASH->OPTSR_CUR ^ OPTION_BYTES_VERIFIED_MARK;
+    if (mark == OPTION_BYTES_VERIFIED_REGISTER)
+    {
+        return LowPowerReturnCode::success;
+    }
+
+    if (LowPowerReturnCode::success == checkOptionBytes())
+    {
+        HAL_PWR_EnableBkUpAccess();
+        OPTION_BYTES_VERIFIED_REGISTER = mark;
+        return LowPowerReturnCode::success;
+    }
+
+    // This resets the board if it succeeds, and the check is made again
+    // after the reset
+    return prepareOptionBytes();
+}
+
+void* LowPowerNiclaVision::fastBootPersistent(const size_t size,
+                                              const uint16_t version)
+{
+    // The same check as persistentData(), but the data is left alone if it
+    // fails, so that persistent() starts it over in the usual boot
+    auto& persistent = backupSRAM().persistent;
+
+    if ((PERSISTENT_MAGIC != persistent.magic) ||
+        (size != persistent.size) ||
+        (version != persistent.version) ||
+        (!persistentChecked &&
+         (persistent.checksum !=
+          backupSRAMChecksum(persistent.data, persistent.size))))
+    {
+        return nullptr;
+    }
+    persistentChecked = true;
+
+    return persistent.data;
+}
+
+LowPowerReturnCode LowPowerNiclaVision::fastStandby(const uint32_t wakeupClock,
+                                                    const uint32_t autoReload)
+{
+    // A shorter standbyM7Sequence() for FastBoot. Only the boot code has run
+    // since the wakeup, so no peripheral needs a reset, HSE is already off,
+    // the voltage scaling is in VOS3, and the RTC runs as before. It only
+    // returns if Standby Mode couldn't be entered.
+    core_util_critical_section_enter();
+
+    HAL_PWREx_ConfigD3Domain(PWR_D3_DOMAIN_STOP);
+
+    // Clear all but the reserved bits in these registers to mask out external
+    // interrupts -->
+    EXTI->IMR1 = 0;
+    // Bit 13 in IMR2 is reserved and must always be 1
+    EXTI->IMR2 = 1 << 13;
+    // Bits 31:25, 19, and 18 in IMR3 are reserved and must be preserved
+    EXTI->IMR3 &= ~0x1f5ffff;
+    // <--
+
+    D3Batch::prepareStandby();
+
+    // Only the RTC wakeup timer ends this Standby Mode
+    HAL_EXTI_D1_EventInputConfig(EXTI_LINE19, EXTI_MODE_IT, ENABLE);
+
+    // FastBoot::run() has already synchronized the RTC shadow registers
+    programRTCWakeup(wakeupClock, autoReload);
+
+    // Set all but the reserved bits in these registers to clear pending
+    // interrupts -->
+    // Bits 31:22 in PR1 are reserved and the original value must be preserved
+    EXTI->PR1 |= 0x3fffff;
+    // All bits except 17 and 19 in PR2 are reserved and the original value must
+    // be preserved
+    EXTI->PR2 |= ((1 << 17) | (1 << 19));
+    // All bits except 18, 20, 21, and 22 in PR3 are reserved and the original
+    // value must be preserved
+    EXTI->PR3 |= ((1 << 18) | (1 << 20) | (1 << 21) | (1 << 22));
+    // <--
+
+    // Disable and clear all pending interrupts in the NVIC. There are 8
+    // registers in the Cortex-M7.
+    for (auto i = 0; i < 8; i++)
+    {
+        NVIC->ICER[i] = 0xffffffff;
+        NVIC->ICPR[i] = 0xffffffff;
+    }
+    HAL_NVIC_SetPriority(RTC_WKUP_IRQn, 0x0, 0);
+    HAL_NVIC_EnableIRQ(RTC_WKUP_IRQn);
+
+    // See standbyM7Sequence() for why this isn't __HAL_RCC_FLASH_C2_ALLOCATE()
+    RCC_C2->AHB3ENR |= RCC_AHB3ENR_FLASHEN;
+    __DSB();
+
+    // The same as commitPersistent(), for changes made through
+    // FastBoot::persistent()
+    auto& persistent = backupSRAM().persistent;
+    if (persistentChecked && (PERSISTENT_MAGIC == persistent.magic) &&
+        (persistent.size <= persistentCapacity))
+    {
+        persistent.checksum = backupSRAMChecksum(persistent.data,
+                                                 persistent.size);
+    }
+
+#if defined CORE_CM7
+    SCB_CleanDCache_by_Addr(reinterpret_cast<uint32_t*>(D3_BKPSRAM_BASE),
+                            sizeof(BackupSRAMLayout));
+#endif
+
+    STANDBY_RTC_FAST_PATH_REGISTER = 1;
+
+    HAL_PWREx_EnterSTANDBYMode(PWR_D1_DOMAIN);
+
+    core_util_critical_section_exit();
+    return LowPowerReturnCode::m7StandbyFailed;
+}
+
+IdleCosts LowPowerNiclaVision::idleCosts() const
+{
+    refineIdleCosts();
+    const auto& state = idleGovernorState();
+
+    IdleCosts costs;
+    costs.stop = state.stopCost;
+    costs.standby = state.standbyCost;
+    costs.stopSamples = state.stopSamples;
+    costs.standbySamples = state.standbySamples;
+    return costs;
+}
+
+LowPowerReturnCode LowPowerNiclaVision::idleFor(RTCWakeupDelay duration,
+                                                IdleMode allowed) const
+{
+    const unsigned long long int milliseconds = duration.value;
+    if (RTCWakeupDelay::infinite == milliseconds)
+    {
+        return LowPowerReturnCode::noWakeupSource;
+    }
+
+    refineIdleCosts();
+    auto& state = idleGovernorState();
+
+    // The charge of each mode in microampere-microseconds, where the time to
+    // enter and leave the mode is spent at the current while awake
+    const uint64_t idle = milliseconds * 1000;
+    const uint64_t run =
+        idleProfile.run[static_cast<int>(currentPerformanceLevel)];
+    const auto charge = [&](const uint64_t current, const uint64_t cost)
+    {
+        return (cost >= idle) ? UINT64_MAX : run * cost + current * (idle - cost);
+    };
+    const auto isAllowed = [&](const IdleMode mode)
+    {
+        return 0 != (static_cast<uint8_t>(allowed) & static_cast<uint8_t>(mode));
+    };
+
+    IdleMode mode = IdleMode::sleep;
+    uint64_t best = idleProfile.sleep * idle;
+    if (isAllowed(IdleMode::stop) &&
+        (charge(idleProfile.stop, state.stopCost) < best))
+    {
+        mode = IdleMode::stop;
+        best = charge(idleProfile.stop, state.stopCost);
+    }
+    if (isAllowed(IdleMode::standby) &&
+        (charge(idleProfile.standby, state.standbyCost) < best))
+    {
+        mode = IdleMode::standby;
+    }
+    state.lastMode = static_cast<uint8_t>(mode);
+
+    if (IdleMode::stop == mode)
+    {
+        const LowPowerReturnCode returnCode = stopM7(duration);
+        if (LowPowerReturnCode::success == returnCode)
+        {
+            refineIdleCost(state.stopCost, state.stopSamples, stopOverhead);
+        }
+        return returnCode;
+    }
+    if (IdleMode::standby == mode)
+    {
+        // The cost is measured after waking up, by refineIdleCosts()
+        state.standbyPending = true;
+        const LowPowerReturnCode returnCode = standbyM7(duration);
+        state.standbyPending = false;
+        return returnCode;
+    }
+
+    // Deep Sleep Mode would be Stop Mode without the measurements
+    lockDeepSleep("idleFor");
+    rtos::ThisThread::sleep_for(rtos::Kernel::Clock::duration_u32(
+        (milliseconds < UINT32_MAX) ? milliseconds : UINT32_MAX));
+    unlockDeepSleep("idleFor");
+    return LowPowerReturnCode::success;
+}
+
+LowPowerReturnCode LowPowerNiclaVision::initializeRTC() const
+{
+    RCC_OscInitTypeDef oscInit{};
+    oscInit.OscillatorType = RCC_OSCILLATORTYPE_LSE;
+    oscInit.LSEState = RCC_LSE_ON;
+    if (HAL_OK != HAL_RCC_OscConfig(&oscInit))
+    {
+        return LowPowerReturnCode::enableLSEFailed;
+    }
+    traceStandby(StandbyCheckpoint::lseStarted);
+
+    RCC_PeriphCLKInitTypeDef periphClkInit{};
+    periphClkInit.PeriphClockSelection = RCC_PERIPHCLK_RTC;
+    periphClkInit.RTCClockSelection = RCC_RTCCLKSOURCE_LSE;
+    if (HAL_OK != HAL_RCCEx_PeriphCLKConfig(&periphClkInit))
+    {
+        return LowPowerReturnCode::selectLSEFailed;
+    }
+
+    // This enables the RTC. It must not be called before the RTC input
+    // clock source is selected above.
+    __HAL_RCC_RTC_ENABLE();
+
+    LL_RTC_DisableWriteProtection(RTC);
+
+    // Enter init mode. We're doing this at the register level because of
+    // a bug in the LL that ships with the current version of Mbed, where,
+    // among other things, reserved bits are overwritten. Bit 7 is the INIT
+    // bit.
+    RTC->ISR |= 1 << 7;
+    while (1U != LL_RTC_IsActiveFlag_INIT(RTC))
+        ;
+
+    LL_RTC_SetHourFormat(RTC, LL_RTC_HOURFORMAT_24HOUR);
+    // LSE at 32767 Hz / (127+1) / (255 + 1) = 1 Hz for the RTC
+    LL_RTC_SetAsynchPrescaler(RTC, 127);
+    LL_RTC_SetSynchPrescaler(RTC, 255);
+
+    // Exit init mode
+    RTC->ISR &= ~(1 << 7);
+    // This is probably not necessary, but included just in case
+    while (0U != LL_RTC_IsActiveFlag_INIT(RTC))
+        ;
+
+    LL_RTC_EnableWriteProtection(RTC);
+    traceStandby(StandbyCheckpoint::rtcInitialized);
+
+    return LowPowerReturnCode::success;
+}
+
+bool LowPowerNiclaVision::isRTCConfigured()
+{
+    // The backup domain isn't reset by Standby Mode, so once initializeRTC()
+    // has run, the LSE is normally still running with the RTC clocked from it
+    // at 1 Hz. Mbed's own RTC driver uses the same prescalers.
+    const uint32_t bdcr = RCC->BDCR;
+    return (bdcr & RCC_BDCR_LSERDY) &&
+           (RCC_BDCR_RTCSEL_0 == (bdcr & RCC_BDCR_RTCSEL)) &&
+           (bdcr & RCC_BDCR_RTCEN) &&
+           (127U == LL_RTC_GetAsynchPrescaler(RTC)) &&
+           (255U == LL_RTC_GetSynchPrescaler(RTC));
+}
+
+IdleMode LowPowerNiclaVision::lastIdleMode() const
+{
+    return static_cast<IdleMode>(idleGovernorState().lastMode);
+}
+
+uint32_t LowPowerNiclaVision::lastStandbyEntryCycles() const
+{
+    return STANDBY_ENTRY_CYCLES_REGISTER;
+}
+
+uint32_t LowPowerNiclaVision::lastStandbyHandshakeCycles() const
+{
+    return STANDBY_HANDSHAKE_CYCLES_REGISTER;
+}
+
+StandbyTrace LowPowerNiclaVision::lastStandbyTrace() const
+{
+    StandbyTrace result;
+
+    const auto& trace = backupSRAM().standbyTrace;
+    if (STANDBY_TRACE_MAGIC == trace.magic)
+    {
+        result.valid = true;
+        result.coreClock = trace.coreClock;
+        result.total = trace.total;
+        for (size_t i = 0; i < StandbyTrace::checkpoints; ++i)
+        {
+            result.cycles[i] = trace.cycles[i];
+        }
+    }
+
+    return result;
+}
+
+bool LowPowerNiclaVision::lastStandbyUsedRTCFastPath() const
+{
+    return 0 != STANDBY_RTC_FAST_PATH_REGISTER;
+}
+
+uint32_t LowPowerNiclaVision::lastStopOverhead() const
+{
+    return stopOverhead;
+}
+
+void LowPowerNiclaVision::lockDeepSleep(const char* const holder) const
+{
+    lockDeepSleepFrom(holder, __builtin_return_address(0), 0);
+}
+
+void LowPowerNiclaVision::lockDeepSleepFrom(const char* const holder,
+                                            const void* const caller,
+                                            const uint32_t holdLimit) const
+{
+    core_util_critical_section_enter();
+    const size_t index = findDeepSleepLockHolder(holder);
+    DeepSleepLockRecord& record = deepSleepLockRecords[index];
+    if (0 == record.held)
+    {
+        deepSleepLockedSince[index] = ticker_read_us(get_us_ticker_data());
+    }
+    else
+    {
+        ++record.contended;
+    }
+    if (0 != holdLimit)
+    {
+        record.holdLimit = holdLimit;
+    }
+    // Mbed treats an overflow of its own counter as an error, so the same
+    // limit applies here
+    if (USHRT_MAX != record.held)
+    {
+        ++record.held;
+        ++record.acquisitions;
+        record.caller = caller;
+        sleep_manager_lock_deep_sleep();
+    }
+    core_util_critical_section_exit();
+}
+
+M4Residency LowPowerNiclaVision::m4Residency() const
+{
+    const M4ResidencyBlock& block = m4ResidencyBlock();
+    M4Residency residency;
+
+    for (uint32_t attempt = 0; attempt < M4_RESIDENCY_READ_ATTEMPTS; attempt++)
+    {
+#if defined CORE_CM7
+        // The M4 core writes to SRAM4 behind the back of the M7 core's D-cache
+        SCB_InvalidateDCache_by_Addr(const_cast<M4ResidencyBlock*>(&block),
+                                     sizeof(block));
+#endif
+        const uint32_t sequence = block.sequence;
+        __DMB();
+        if (M4_RESIDENCY_MAGIC != block.magic)
+        {
+            return M4Residency();
+        }
+        if (sequence & 1)
+        {
+            continue;
+        }
+
+        residency.boots = block.boots;
+        residency.standbyEntries = block.standbyEntries;
+        residency.uptime = block.uptime;
+        residency.idle = block.idle;
+        residency.sleep = block.sleep;
+        residency.deepSleep = block.deepSleep;
+        residency.stop = block.stop;
+        residency.standby = block.standby;
+        const uint64_t standbyStart = block.standbyStart;
+
+        __DMB();
+#if defined CORE_CM7
+        SCB_InvalidateDCache_by_Addr(const_cast<M4ResidencyBlock*>(&block),
+                                     sizeof(block));
+#endif
+        if (sequence == block.sequence)
+        {
+            // Include the time so far if the M4 core is in Standby Mode now
+            if ((0 != standbyStart) && isRTCConfigured())
+            {
+                const uint64_t now = readRTCMilliseconds();
+                residency.standby += (now > standbyStart) ?
+                                     (now - standbyStart) * 1000 : 0;
+            }
+            residency.valid = true;
+            return residency;
+        }
+    }
+
+    return M4Residency();
+}
+
+uint64_t LowPowerNiclaVision::micros() const
+{
+    // The low power ticker runs from LSE through LPTIM1, which keeps counting
+    // in Stop Mode, contrary to the timer behind the Arduino micros()
+    return ticker_read_us(get_lp_ticker_data());
+}
+
+void LowPowerNiclaVision::noDeepSleepFor(const RTCWakeupDelay duration) const
+{
+    if (0 == duration.value)
+    {
+        return;
+    }
+    // Capped at about 49 days, which also keeps an infinite delay finite
+    const uint64_t microseconds = (duration.value > UINT32_MAX) ?
+                                  UINT32_MAX * 1000ULL :
+                                  duration.value * 1000;
+
+    core_util_critical_section_enter();
+    const uint64_t until = ticker_read_us(get_us_ticker_data()) + microseconds;
+    const bool wasActive = noDeepSleepActive;
+    if (!wasActive)
+    {
+        lockDeepSleepFrom("noDeepSleepFor", __builtin_return_address(0), 0);
+        noDeepSleepActive = true;
+    }
+    if (!wasActive || (until > noDeepSleepUntil))
+    {
+        noDeepSleepUntil = until;
+        noDeepSleepTimeout.attach(&noDeepSleepExpired,
+                                  std::chrono::microseconds(microseconds));
+    }
+    core_util_critical_section_exit();
+}
+
+// This function uses undocumented features of Mbed to retrieve the number
+// of active deep sleep locks. It is experimental and may break at any time,
+// but can be handy for some users to debug deep sleep lock problems.
+// It uses features of the compiled machine code to find the number of locks.
+uint16_t LowPowerNiclaVision::numberOfDeepSleepLocks() const
 {
     // clang-format off
     return *((volatile uint16_t*) *((volatile uint32_t*) ((((volatile uint32_t)
@@ -145,289 +1377,1537 @@ uint16_t LowPowerNiclaVision::numberOfDeepSleepLocks() const
     // clang-format on
 }
 
-LowPowerReturnCode LowPowerNiclaVision::prepareOptionBytes() const
+void* LowPowerNiclaVision::persistentData(const size_t size,
+                                          const uint16_t version,
+                                          bool& fresh) const
+{
+    auto& persistent = backupSRAM().persistent;
+
+    core_util_critical_section_enter();
+    fresh = (PERSISTENT_MAGIC != persistent.magic) ||
+            (size != persistent.size) ||
+            (version != persistent.version) ||
+            (!persistentChecked &&
+             (persistent.checksum !=
+              backupSRAMChecksum(persistent.data, persistent.size)));
+    if (fresh)
+    {
+        persistent.magic = PERSISTENT_MAGIC;
+        persistent.version = version;
+        persistent.size = size;
+    }
+    persistentChecked = true;
+    persistentWasRestored = !fresh;
+    core_util_critical_section_exit();
+
+    return persistent.data;
+}
+
+bool LowPowerNiclaVision::persistentRestored() const
+{
+    return persistentWasRestored;
+}
+
+LowPowerReturnCode LowPowerNiclaVision::prepareOptionBytes() const
+{
+    FLASH_OBProgramInitTypeDef flashOBProgramInit{};
+
+    flashOBProgramInit.Banks        = FLASH_BANK_1;
+    flashOBProgramInit.OptionType   = OPTIONBYTE_USER;
+    flashOBProgramInit.USERType     = OB_USER_NRST_STDBY_D1 |
+                                      OB_USER_NRST_STDBY_D2 |
+                                      OB_USER_BCM4;
+    flashOBProgramInit.USERConfig   = OB_STDBY_NO_RST_D1 |
+                                      OB_STDBY_NO_RST_D2 |
+                                      OB_BCM4_DISABLE;
+    if (HAL_OK != HAL_FLASH_Unlock())
+    {
+        return LowPowerReturnCode::flashUnlockFailed;
+    }
+    if (HAL_OK != HAL_FLASH_OB_Unlock())
+    {
+        return LowPowerReturnCode::obUnlockFailed;
+    }
+    if (HAL_OK != HAL_FLASHEx_OBProgram(&flashOBProgramInit))
+    {
+        HAL_FLASH_OB_Lock();
+        HAL_FLASH_Lock();
+        return LowPowerReturnCode::obProgramFailed;
+    }
+    HAL_FLASH_OB_Launch();
+    // The board should reset at this point, so anything beyond this point
+    // is a failure
+    HAL_FLASH_OB_Lock();
+    HAL_FLASH_Lock();
+    return LowPowerReturnCode::obLaunchFailed;
+}
+
+LowPowerReturnCode LowPowerNiclaVision::programRTCAlarm(
+    const uint64_t alarmTime,
+    const bool keepEarlier,
+    const bool alarmB) const
+{
+    if (!isRTCConfigured())
+    {
+        const LowPowerReturnCode rtcResult = initializeRTC();
+        if (LowPowerReturnCode::success != rtcResult)
+        {
+            return rtcResult;
+        }
+    }
+
+    const LowPowerReturnCode checkResult = checkRTCAlarm(alarmTime);
+    if (LowPowerReturnCode::success != checkResult)
+    {
+        return checkResult;
+    }
+
+    // Round up to whole subsecond ticks, so that the RTC time is never before
+    // the requested time when the alarm goes off
+    const uint64_t ticks = (alarmTime * 256 + 999) / 1000;
+    const uint32_t subseconds = ticks % 256;
+    uint64_t totalSeconds = ticks / 256;
+    const uint32_t seconds = totalSeconds % 60;
+    totalSeconds /= 60;
+    const uint32_t minutes = totalSeconds % 60;
+    totalSeconds /= 60;
+    const uint32_t hours = totalSeconds % 24;
+    uint32_t days = static_cast<uint32_t>(totalSeconds / 24);
+
+    // Find the day of the month in the same calendar as readRTCMilliseconds()
+    static const uint8_t daysInMonth[] = {
+        31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31
+    };
+    uint32_t year = 0;
+    while (days >= ((0 == year % 4) ? 366U : 365U))
+    {
+        days -= (0 == year % 4) ? 366 : 365;
+        year++;
+    }
+    for (uint32_t month = 0; month < 12; month++)
+    {
+        const uint32_t length = daysInMonth[month] +
+                                (((1 == month) && (0 == year % 4)) ? 1 : 0);
+        if (days < length)
+        {
+            break;
+        }
+        days -= length;
+    }
+    const uint32_t day = days + 1;
+
+    const auto bcd = [](const uint32_t value, const uint32_t tensPos,
+                        const uint32_t unitsPos)
+    {
+        return ((value / 10) << tensPos) | ((value % 10) << unitsPos);
+    };
+
+    // All the mask bits are left cleared, so that the date, hours, minutes and
+    // seconds must all match. The time fields have the same layout as RTC_TR.
+    const uint32_t alarm = bcd(day, RTC_ALRMAR_DT_Pos, RTC_ALRMAR_DU_Pos) |
+                           bcd(hours, RTC_TR_HT_Pos, RTC_TR_HU_Pos) |
+                           bcd(minutes, RTC_TR_MNT_Pos, RTC_TR_MNU_Pos) |
+                           bcd(seconds, RTC_TR_ST_Pos, RTC_TR_SU_Pos);
+    // Compare the 8 bits of the subseconds that the prescaler uses. They
+    // count down from 255.
+    const uint32_t alarmSubseconds = (8 << RTC_ALRMASSR_MASKSS_Pos) |
+                                     (255 - subseconds);
+
+    HAL_PWR_EnableBkUpAccess();
+    LL_RTC_DisableWriteProtection(RTC);
+
+    // Alarm B has the same register layout as Alarm A
+    if (alarmB)
+    {
+        LL_RTC_DisableIT_ALRB(RTC);
+        LL_RTC_ALMB_Disable(RTC);
+        while (1 != LL_RTC_IsActiveFlag_ALRBW(RTC))
+            ;
+        RTC->ALRMBR = alarm;
+        RTC->ALRMBSSR = alarmSubseconds;
+        LL_RTC_ClearFlag_ALRB(RTC);
+        LL_RTC_ALMB_Enable(RTC);
+        LL_RTC_EnableIT_ALRB(RTC);
+    }
+    else
+    {
+        LL_RTC_DisableIT_ALRA(RTC);
+        LL_RTC_ALMA_Disable(RTC);
+        while (1 != LL_RTC_IsActiveFlag_ALRAW(RTC))
+            ;
+        RTC->ALRMAR = alarm;
+        RTC->ALRMASSR = alarmSubseconds;
+        LL_RTC_ClearFlag_ALRA(RTC);
+        LL_RTC_ALMA_Enable(RTC);
+        LL_RTC_EnableIT_ALRA(RTC);
+    }
+
+    LL_RTC_EnableWriteProtection(RTC);
+
+    // Alarm B belongs to the M4 core, and the wakeup latency is only measured
+    // for the M7 core
+    if (alarmB)
+    {
+        return LowPowerReturnCode::success;
+    }
+
+    // The wakeup latency is measured from whichever of the wakeup timer and
+    // the alarm is due first
+    const uint64_t scheduled =
+        (static_cast<uint64_t>(SCHEDULED_WAKEUP_HIGH_REGISTER) << 32) |
+        SCHEDULED_WAKEUP_LOW_REGISTER;
+    if (!keepEarlier || (alarmTime < scheduled))
+    {
+        SCHEDULED_WAKEUP_HIGH_REGISTER = alarmTime >> 32;
+        SCHEDULED_WAKEUP_LOW_REGISTER = alarmTime & 0xffffffff;
+    }
+
+    return LowPowerReturnCode::success;
+}
+
+void LowPowerNiclaVision::programRTCWakeup(const uint32_t wakeupClock,
+                                           const uint32_t autoReload)
+{
+    // The RTC registers are write protected through the backup domain, which
+    // initializeRTC() unlocks as a side effect of enabling LSE. Unlock it here
+    // too for when the RTC was already configured.
+    HAL_PWR_EnableBkUpAccess();
+    LL_RTC_DisableWriteProtection(RTC);
+
+    LL_RTC_DisableIT_WUT(RTC);
+    LL_RTC_WAKEUP_Disable(RTC);
+    while (1 != LL_RTC_IsActiveFlag_WUTW(RTC))
+        ;
+    traceStandby(StandbyCheckpoint::wakeupTimerWritable);
+
+    LL_RTC_WAKEUP_SetAutoReload(RTC, autoReload);
+    LL_RTC_WAKEUP_SetClock(RTC, wakeupClock);
+
+    LL_RTC_WAKEUP_Enable(RTC);
+
+    // Remember when the timer is due, so that the wakeup latency can be
+    // found after waking up
+    unsigned long long int ticks = autoReload + 1ULL;
+    unsigned long long int frequency = 1;
+    switch (wakeupClock)
+    {
+        case LL_RTC_WAKEUPCLOCK_CKSPRE_WUT:
+            ticks += 1ULL << 16;
+            break;
+        case LL_RTC_WAKEUPCLOCK_DIV_16:
+            frequency = 32768 / 16;
+            break;
+        case LL_RTC_WAKEUPCLOCK_DIV_8:
+            frequency = 32768 / 8;
+            break;
+        case LL_RTC_WAKEUPCLOCK_DIV_4:
+            frequency = 32768 / 4;
+            break;
+        case LL_RTC_WAKEUPCLOCK_DIV_2:
+            frequency = 32768 / 2;
+            break;
+        default:
+            break;
+    }
+    const uint64_t scheduled = readRTCMilliseconds() +
+                               ticks * 1000 / frequency;
+    SCHEDULED_WAKEUP_HIGH_REGISTER = scheduled >> 32;
+    SCHEDULED_WAKEUP_LOW_REGISTER = scheduled & 0xffffffff;
+    LL_RTC_EnableIT_WUT(RTC);
+    __HAL_RTC_WAKEUPTIMER_EXTI_ENABLE_RISING_EDGE();
+    LL_RTC_ClearFlag_WUT(RTC);
+
+    LL_RTC_EnableWriteProtection(RTC);
+}
+
+void LowPowerNiclaVision::publishM4Residency() const
+{
+#if defined CORE_CM4
+    mbed_stats_cpu_t stats{};
+    mbed_stats_cpu_get(&stats);
+
+    core_util_critical_section_enter();
+    M4ResidencyBlock& block = m4ResidencyBlock();
+    beginM4ResidencyUpdate(block);
+    block.uptime = stats.uptime;
+    block.idle = stats.idle_time;
+    block.sleep = stats.sleep_time;
+    block.deepSleep = stats.deep_sleep_time;
+    block.stop = stopModeTime;
+    endM4ResidencyUpdate(block);
+    core_util_critical_section_exit();
+#endif
+}
+
+uint64_t LowPowerNiclaVision::readRTCMilliseconds()
+{
+    // RSF is set when the shadow registers have been updated, which happens
+    // every two RTC clock cycles. It is cleared after waking up from Stop Mode.
+    while (0U == LL_RTC_IsActiveFlag_RS(RTC))
+        ;
+
+    // Reading SSR locks TR and DR until DR is read, so the order matters
+    const uint32_t ssr = RTC->SSR;
+    const uint32_t tr = RTC->TR;
+    const uint32_t dr = RTC->DR;
+
+    const auto bcd = [](const uint32_t reg, const uint32_t tensPos,
+                        const uint32_t tensBits, const uint32_t unitsPos)
+    {
+        return ((reg >> tensPos) & ((1UL << tensBits) - 1)) * 10 +
+               ((reg >> unitsPos) & 0xf);
+    };
+    const uint32_t years    = bcd(dr, RTC_DR_YT_Pos, 4, RTC_DR_YU_Pos);
+    const uint32_t month    = bcd(dr, RTC_DR_MT_Pos, 1, RTC_DR_MU_Pos);
+    const uint32_t day      = bcd(dr, RTC_DR_DT_Pos, 2, RTC_DR_DU_Pos);
+    const uint32_t hours    = bcd(tr, RTC_TR_HT_Pos, 2, RTC_TR_HU_Pos);
+    const uint32_t minutes  = bcd(tr, RTC_TR_MNT_Pos, 3, RTC_TR_MNU_Pos);
+    const uint32_t seconds  = bcd(tr, RTC_TR_ST_Pos, 3, RTC_TR_SU_Pos);
+
+    // The calendar covers 2000-2099, where every fourth year is a leap year
+    static const uint16_t daysBeforeMonth[] = {
+        0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334
+    };
+    uint64_t days = years * 365ULL + (years + 3) / 4;
+    if ((month >= 1) && (month <= 12))
+    {
+        days += daysBeforeMonth[month - 1];
+        if ((month > 2) && (0 == years % 4))
+        {
+            days++;
+        }
+    }
+    if (day >= 1)
+    {
+        days += day - 1;
+    }
+
+    const uint64_t totalSeconds = ((days * 24 + hours) * 60 + minutes) * 60 +
+                                  seconds;
+    // The subseconds count down from the synchronous prescaler value of 255
+    const uint32_t milliseconds = ((255 - (ssr & 0xff)) * 1000) / 256;
+    return totalSeconds * 1000 + milliseconds;
+}
+
+void LowPowerNiclaVision::refineIdleCosts() const
+{
+    auto& state = idleGovernorState();
+    if (!state.standbyPending)
+    {
+        return;
+    }
+    state.standbyPending = false;
+
+    // Only an RTC wakeup tells how long the boot took. The entry cycles were
+    // counted at the same clock as after boot, unless a lower
+    // PerformanceLevel was set before.
+    if (info.hasWakeupLatency())
+    {
+        const uint32_t entry = lastStandbyEntryCycles() /
+                               (SystemCoreClock / 1000000);
+        refineIdleCost(state.standbyCost, state.standbySamples,
+                       entry + info.wakeupLatency() * 1000);
+    }
+}
+
+LowPowerReturnCode LowPowerNiclaVision::requestStandby(RTCWakeupDelay delay,
+                                                       RTCSetup setup,
+                                                       const uint32_t timeout) const
+{
+    return requestStandby(WakeupSources().rtc(delay), setup, timeout);
+}
+
+LowPowerReturnCode LowPowerNiclaVision::requestStandby(
+    const WakeupSources& sources,
+    RTCSetup setup,
+    const uint32_t timeout) const
+{
+    // Here rather than in standbyM7(), which is called in a critical section
+    LowPowerLog::flushBeforeStandby();
+    PowerDomains::powerDownForStandby();
+
+    core_util_critical_section_enter();
+    // The handler may still be installed from the last time, for a bank
+    // whose interrupt couldn't be disabled
+    const uint32_t flashHandler = NVIC_GetVector(FLASH_IRQn);
+    if (reinterpret_cast<uint32_t>(&flashReadyHandler) != flashHandler)
+    {
+        previousFlashHandler = flashHandler;
+    }
+    const bool flashInterruptEnabled = NVIC_GetEnableIRQ(FLASH_IRQn);
+    flashReadyBanks = 0;
+    flashReadyThread = rtos::ThisThread::get_id();
+    rtos::ThisThread::flags_clear(FLASH_READY_FLAG);
+    NVIC_SetVector(FLASH_IRQn, reinterpret_cast<uint32_t>(&flashReadyHandler));
+    NVIC_EnableIRQ(FLASH_IRQn);
+    core_util_critical_section_exit();
+
+    // Must be called in a critical section. Only what was changed here is put
+    // back, and an interrupt that is still pending from here is dropped, so
+    // that it doesn't reach the handler from before. The handler stays
+    // installed for a bank that was locked before its interrupt could be
+    // disabled.
+    const auto restoreFlashInterrupt = [&]()
+    {
+        disableFlashReadyInterrupt(FLASH->CR1, 1);
+        disableFlashReadyInterrupt(FLASH->CR2, 2);
+        if (!flashOwnerInterruptsEnabled())
+        {
+            NVIC_ClearPendingIRQ(FLASH_IRQn);
+        }
+        if (!flashInterruptEnabled)
+        {
+            NVIC_DisableIRQ(FLASH_IRQn);
+        }
+        if (0 == flashStaleBanks)
+        {
+            NVIC_SetVector(FLASH_IRQn, previousFlashHandler);
+        }
+        flashReadyThread = nullptr;
+        rtos::ThisThread::flags_clear(FLASH_READY_FLAG);
+    };
+
+    const uint32_t tickStart = HAL_GetTick();
+    uint32_t elapsed = 0;
+    while (elapsed <= timeout)
+    {
+        core_util_critical_section_enter();
+        if (!isFlashBusy())
+        {
+            restoreFlashInterrupt();
+            // Nothing can start a new flash operation before standbyM7()
+            // waits for the flash controller, so that wait is short
+            const LowPowerReturnCode returnCode = standbyM7(sources, setup);
+            core_util_critical_section_exit();
+            PowerDomains::restoreAfterStandby();
+            return returnCode;
+        }
+        uint32_t busyBanks = 0;
+        if (FLASH->SR1 & 0x07)
+        {
+            busyBanks |= 1;
+            enableFlashReadyInterrupt(FLASH->CR1, 1);
+        }
+        else
+        {
+            disableFlashReadyInterrupt(FLASH->CR1, 1);
+        }
+        if (FLASH->SR2 & 0x07)
+        {
+            busyBanks |= 2;
+            enableFlashReadyInterrupt(FLASH->CR2, 2);
+        }
+        else
+        {
+            disableFlashReadyInterrupt(FLASH->CR2, 2);
+        }
+        core_util_critical_section_exit();
+
+        // Block the thread rather than spin, so that the thread that writes
+        // to the flash can run, and the core sleeps in the idle thread. The
+        // flag is kept if the interrupt comes before the wait starts. The
+        // wait is cut short if a busy bank doesn't have the interrupt enabled
+        // here, such as one that is locked, and must be polled instead.
+        const uint32_t remaining = timeout - elapsed + 1;
+        const bool polling = busyBanks != (busyBanks & flashReadyBanks);
+        rtos::ThisThread::flags_wait_any_for(FLASH_READY_FLAG,
+            rtos::Kernel::Clock::duration_u32(
+                (polling && (remaining > FLASH_POLL_INTERVAL)) ?
+                FLASH_POLL_INTERVAL : remaining));
+        elapsed = HAL_GetTick() - tickStart;
+    }
+
+    core_util_critical_section_enter();
+    restoreFlashInterrupt();
+    core_util_critical_section_exit();
+    PowerDomains::restoreAfterStandby();
+
+    return LowPowerReturnCode::flashBusyTimeout;
+}
+
+void LowPowerNiclaVision::resetPreviousCPUModeFlags() const
+{
+    PWR->CPUCR |= PWR_CPUCR_CSSF;
+}
+
+LowPowerReturnCode LowPowerNiclaVision::restoreClocks(
+    const uint32_t oscillators,
+    const uint32_t sysclkSource,
+    const uint32_t voltageScaling)
+{
+    // The microcontroller wakes up from Stop Mode running on HSI, with the
+    // other oscillators and the PLLs turned off. The PLL configuration and
+    // all the bus dividers are kept, so instead of a full clock setup it's
+    // enough to turn on what was running before and switch back to the same
+    // system clock. Each ready flag in RCC->CR is the bit after its on bit.
+    const uint32_t plls = RCC_CR_PLL1ON | RCC_CR_PLL2ON | RCC_CR_PLL3ON;
+
+    RCC->CR |= oscillators & ~plls;
+    if (!waitForRegister(RCC->CR, (oscillators & ~plls) << 1,
+                         (oscillators & ~plls) << 1, HSE_TIMEOUT_VALUE))
+    {
+        return LowPowerReturnCode::clockRestoreFailed;
+    }
+
+    RCC->CR |= oscillators & plls;
+    if (!waitForRegister(RCC->CR, (oscillators & plls) << 1,
+                         (oscillators & plls) << 1, PLL_TIMEOUT_VALUE))
+    {
+        return LowPowerReturnCode::clockRestoreFailed;
+    }
+
+    // VOS0 isn't kept through Stop Mode, so it must be restored before the
+    // system clock goes back to full speed
+    if (voltageScaling != HAL_PWREx_GetVoltageRange())
+    {
+        if (HAL_OK != HAL_PWREx_ControlVoltageScaling(voltageScaling))
+        {
+            return LowPowerReturnCode::voltageScalingFailed;
+        }
+    }
+
+    MODIFY_REG(RCC->CFGR, RCC_CFGR_SW, sysclkSource);
+    if (!waitForRegister(RCC->CFGR, RCC_CFGR_SWS,
+                         sysclkSource << RCC_CFGR_SWS_Pos,
+                         CLOCKSWITCH_TIMEOUT_VALUE))
+    {
+        return LowPowerReturnCode::clockRestoreFailed;
+    }
+
+    return LowPowerReturnCode::success;
+}
+
+void LowPowerNiclaVision::retimeTickers(const uint32_t previousCoreClock) const
+{
+    SystemCoreClockUpdate();
+
+    // SysTick counts CPU clock cycles, so keep the same tick period
+    if (SysTick->CTRL & SysTick_CTRL_ENABLE_Msk)
+    {
+        const uint64_t reload = static_cast<uint64_t>(SysTick->LOAD) + 1;
+        SysTick->LOAD = static_cast<uint32_t>(
+            (reload * SystemCoreClock) / previousCoreClock) - 1;
+        SysTick->VAL = 0;
+    }
+
+    // The Mbed microsecond ticker is TIM5, which must keep counting at 1 MHz.
+    // The timer clock is twice the APB1 clock when APB1 is divided. A new
+    // prescaler only takes effect at an update event, which also clears the
+    // counter, so the count is put back afterwards.
+    uint32_t timerClock = HAL_RCC_GetPCLK1Freq();
+    if (RCC_D2CFGR_D2PPRE1_DIV1 != (RCC->D2CFGR & RCC_D2CFGR_D2PPRE1))
+    {
+        timerClock *= 2;
+    }
+    const uint32_t count = TIM5->CNT;
+    TIM5->PSC = (timerClock / 1000000) - 1;
+    TIM5->EGR = TIM_EGR_UG;
+    TIM5->CNT = count;
+    TIM5->SR = ~TIM_SR_UIF;
+}
+
+uint64_t LowPowerNiclaVision::rtcMilliseconds() const
+{
+    if (!isRTCConfigured() &&
+        (LowPowerReturnCode::success != initializeRTC()))
+    {
+        return 0;
+    }
+    return readRTCMilliseconds();
+}
+
+void LowPowerNiclaVision::setIdleProfile(const CurrentProfile& profile) const
+{
+    idleProfile = profile;
+}
+
+LowPowerReturnCode LowPowerNiclaVision::setPerformanceLevel(
+    const PerformanceLevel level) const
+{
+    // The levels are relative to the PLL1 setup from boot
+    if (RCC_CFGR_SW_PLL1 != bootSysclkSource)
+    {
+        return LowPowerReturnCode::clockSwitchFailed;
+    }
+    // The clocks are being switched back already
+    if (clockRestoreRunning)
+    {
+        return LowPowerReturnCode::clockSwitchFailed;
+    }
+    if (level == currentPerformanceLevel)
+    {
+        return LowPowerReturnCode::success;
+    }
+
+    // Prevent Mbed from using the tickers while they are retimed
+    core_util_critical_section_enter();
+    const uint32_t previousCoreClock = SystemCoreClock;
+    const uint64_t awake = timeSpentAwake();
+    performanceLevelTime[static_cast<int>(currentPerformanceLevel)] +=
+        awake - performanceLevelSince;
+    performanceLevelSince = awake;
+    const LowPowerReturnCode returnCode = switchPerformanceLevel(level);
+    retimeTickers(previousCoreClock);
+    core_util_critical_section_exit();
+
+    return returnCode;
+}
+
+LowPowerReturnCode LowPowerNiclaVision::standbyM4() const
+{
+    return standbyM4Sequence(false);
+}
+
+LowPowerReturnCode LowPowerNiclaVision::standbyM4(RTCWakeupDelay delay) const
+{
+    const unsigned long long int wakeupDelay = delay.value;
+    if (RTCWakeupDelay::infinite == wakeupDelay)
+    {
+        return standbyM4Sequence(false);
+    }
+
+    // The alarm time is relative to the RTC calendar, so the RTC must be
+    // running before the time is read
+    if (!isRTCConfigured())
+    {
+        const LowPowerReturnCode rtcResult = initializeRTC();
+        if (LowPowerReturnCode::success != rtcResult)
+        {
+            return rtcResult;
+        }
+    }
+    // The alarm must be at least one subsecond tick ahead
+    const uint64_t alarmTime = readRTCMilliseconds() +
+                               ((wakeupDelay < 4) ? 4 : wakeupDelay);
+    const LowPowerReturnCode alarmResult = programRTCAlarm(alarmTime,
+                                                           false,
+                                                           true);
+    if (LowPowerReturnCode::success != alarmResult)
+    {
+        return alarmResult;
+    }
+
+    return standbyM4Sequence(true);
+}
+
+LowPowerReturnCode LowPowerNiclaVision::standbyM4Sequence(
+    const bool alarmWakeup) const
 {
-    FLASH_OBProgramInitTypeDef flashOBProgramInit{};
+    // Prevent Mbed from changing things
+    core_util_critical_section_enter();
 
-    flashOBProgramInit.Banks        = FLASH_BANK_1;
-    flashOBProgramInit.OptionType   = OPTIONBYTE_USER;
-    flashOBProgramInit.USERType     = OB_USER_NRST_STDBY_D1 |
-                                      OB_USER_NRST_STDBY_D2 |
-                                      OB_USER_BCM4;
-    flashOBProgramInit.USERConfig   = OB_STDBY_NO_RST_D1 |
-                                      OB_STDBY_NO_RST_D2 |
-                                      OB_BCM4_DISABLE;
-    if (HAL_OK != HAL_FLASH_Unlock())
+    waitForFlashReady();
+
+    // Clear all but the reserved bits in these registers to mask out external
+    // interrupts -->
+    EXTI->C2IMR1 = 0;
+    // Bit 13 of IMR is reserved and must always be 1
+    EXTI->C2IMR2 = 1 << 13;
+    // Bits 31:25, 19, and 18 of IMR are reserved and must be preserved
+    EXTI->C2IMR3 &= ~0x1f5ffff;
+    // <--
+
+    if (alarmWakeup)
     {
-        return LowPowerReturnCode::flashUnlockFailed;
+        // Enable RTC alarm wakeup in C2IMR. The alarm line is configurable, so
+        // it must also be triggered on the rising edge.
+        HAL_EXTI_D2_EventInputConfig(EXTI_LINE17, EXTI_MODE_IT, ENABLE);
+        EXTI->RTSR1 |= EXTI_RTSR1_TR17;
     }
-    if (HAL_OK != HAL_FLASH_OB_Unlock())
+
+    // Set all but the reserved bits in these registers to clear pending
+    // external interrupts -->
+    // Bits 31:22 in PR1 are reserved and the original value must be preserved
+    EXTI->C2PR1 |= 0x3fffff;
+    // All bits except 17 and 19 in PR2 are reserved and the original value must
+    // be preserved
+    EXTI->C2PR2 |= ((1 << 17) | (1 << 19));
+    // All bits except 18, 20, 21, and 22 in PR3 are reserved and the original
+    // value must be preserved
+    EXTI->C2PR3 |= ((1 << 18) | (1 << 20) | (1 << 21) | (1 << 22));
+    // <--
+
+    // Disable and clear all pending interrupts in the NVIC. There are 8
+    // registers in the Cortex-M4.
+    for (auto i = 0; i < 8; i++)
     {
-        return LowPowerReturnCode::obUnlockFailed;
+        NVIC->ICER[i] = 0xffffffff;
+        NVIC->ICPR[i] = 0xffffffff;
     }
-    if (HAL_OK != HAL_FLASHEx_OBProgram(&flashOBProgramInit))
+
+#if defined CORE_CM4
+    // The time in Standby Mode is added when the M4 core starts again
+    publishM4Residency();
+    M4ResidencyBlock& block = m4ResidencyBlock();
+    beginM4ResidencyUpdate(block);
+    block.standbyEntries++;
+    block.standbyStart = isRTCConfigured() ? readRTCMilliseconds() : 0;
+    endM4ResidencyUpdate(block);
+#endif
+
+    HAL_PWREx_EnterSTANDBYMode(PWR_D3_DOMAIN);
+
+    HAL_PWREx_EnterSTANDBYMode(PWR_D2_DOMAIN);
+
+#if defined CORE_CM4
+    beginM4ResidencyUpdate(block);
+    block.standbyStart = 0;
+    endM4ResidencyUpdate(block);
+#endif
+
+    return LowPowerReturnCode::m4StandbyFailed;
+}
+
+LowPowerReturnCode LowPowerNiclaVision::standbyM7(RTCWakeupDelay delay,
+                                                  RTCSetup setup) const
+{
+    return standbyM7(WakeupSources().rtc(delay), setup);
+}
+
+LowPowerReturnCode LowPowerNiclaVision::standbyM7(const WakeupSources& sources,
+                                                  RTCSetup setup) const
+{
+    return standbyM7Sequence<StandbySteps::all>(sources, setup, nullptr, 0);
+}
+
+template <StandbySteps steps>
+LowPowerReturnCode LowPowerNiclaVision::standbyM7Sequence(
+    const WakeupSources& sources,
+    RTCSetup setup,
+    const void* const cleanStart,
+    const size_t cleanSize) const
+{
+    // Before the trace starts, since writing the log out can take a while.
+    // requestStandby() has already done it before its critical section.
+    LowPowerLog::flushBeforeStandby();
+
+    enableCycleCounter();
+    const uint32_t entryStart = DWT->CYCCNT;
+
+    // Any return before entering Standby Mode ends the trace, which is then
+    // left without a valid magic number
+    struct TraceScope
     {
-        HAL_FLASH_OB_Lock();
-        HAL_FLASH_Lock();
-        return LowPowerReturnCode::obProgramFailed;
+        ~TraceScope()
+        {
+            standbyTraceActive = false;
+        }
+    } traceScope;
+    if (standbyTraceEnabled)
+    {
+        auto& trace = backupSRAM().standbyTrace;
+        trace.magic = 0;
+        for (auto& cycles : trace.cycles)
+        {
+            cycles = 0;
+        }
+        standbyTraceStart = entryStart;
+        standbyTraceActive = true;
+    }
+
+    const unsigned long long int wakeupDelay = sources.delay.value;
+
+    // The wakeup timer settings were worked out along with the delay, at
+    // compile time for a constant delay
+    if (!sources.delay.fitsWakeupTimer())
+    {
+        return LowPowerReturnCode::wakeupDelayTooLong;
+    }
+    if (wakeupDelay < RTCWakeupDelay::minWakeupTimerDelay)
+    {
+        return LowPowerReturnCode::wakeupDelayTooShort;
+    }
+    const uint32_t wakeupClock = sources.delay.wakeupClock;
+    const uint32_t autoReload = sources.delay.autoReload;
+
+    // An alarm time that has already passed is the most likely error, so it's
+    // found before anything is changed. It's checked again when programmed.
+    if ((0 != sources.alarmTime) && isRTCConfigured())
+    {
+        const LowPowerReturnCode alarmResult = checkRTCAlarm(sources.alarmTime);
+        if (LowPowerReturnCode::success != alarmResult)
+        {
+            return alarmResult;
+        }
+    }
+
+    // Before the critical section, since the parts may need some time after
+    // being turned off
+    PowerDomains::powerDownForStandby();
+
+    // Prevent Mbed from changing things
+    core_util_critical_section_enter();
+
+    waitForFlashReady();
+    traceStandby(StandbyCheckpoint::flashReady);
+
+    // Until the RTC has been programmed, an error leaves the sketch running
+    // on, so the D3 domain setup and the voltage scaling are put back as they
+    // were, as is the critical section. The parts are turned on again once
+    // interrupts are enabled, which is in requestStandby() when called from
+    // there.
+    const bool d3Running = PWR->CPUCR & PWR_CPUCR_RUN_D3;
+    const uint32_t voltageScaling = HAL_PWREx_GetVoltageRange();
+    const auto cancel = [&](const LowPowerReturnCode returnCode)
+    {
+        HAL_PWREx_ControlVoltageScaling(voltageScaling);
+        HAL_PWREx_ConfigD3Domain(d3Running ? PWR_D3_DOMAIN_RUN :
+                                             PWR_D3_DOMAIN_STOP);
+        core_util_critical_section_exit();
+        if (!core_util_in_critical_section())
+        {
+            PowerDomains::restoreAfterStandby();
+        }
+        return returnCode;
+    };
+
+    // Make the D3 domain follow the CPU subsystem modes. This also applies to
+    // Standby Mode according to the Reference Manual, even though the constant
+    // is called PWR_D3_DOMAIN_STOP.
+    HAL_PWREx_ConfigD3Domain(PWR_D3_DOMAIN_STOP);
+
+    // Make sure that the voltage scaling isn't in VOS0 by setting it to VOS1.
+    // While troubleshooting, change this to PWR_REGULATOR_VOLTAGE_SCALE3 to
+    // better differentiate the states of the uC while measuring VCORE at the
+    // VCAP pins.
+    if (HAL_OK != HAL_PWREx_ControlVoltageScaling(PWR_REGULATOR_VOLTAGE_SCALE1))
+    {
+        return cancel(LowPowerReturnCode::voltageScalingFailed);
+    }
+    traceStandby(StandbyCheckpoint::voltageScaled);
+
+    // The RTC is programmed before the interrupts are masked, as in stopM7(),
+    // so that nothing else has to be undone if it fails
+    bool rtcFastPath = false;
+    if (RTCWakeupDelay::infinite != wakeupDelay)
+    {
+        const LowPowerReturnCode rtcResult = configureRTCWakeup(wakeupClock,
+                                                                autoReload,
+                                                                setup,
+                                                                rtcFastPath);
+        if (LowPowerReturnCode::success != rtcResult)
+        {
+            return cancel(rtcResult);
+        }
+    }
+    if (0 != sources.alarmTime)
+    {
+        const LowPowerReturnCode alarmResult =
+            programRTCAlarm(sources.alarmTime,
+                            RTCWakeupDelay::infinite != wakeupDelay,
+                            false);
+        if (LowPowerReturnCode::success != alarmResult)
+        {
+            if (RTCWakeupDelay::infinite != wakeupDelay)
+            {
+                cancelRTCWakeup();
+            }
+            return cancel(alarmResult);
+        }
+    }
+    traceStandby(StandbyCheckpoint::rtcProgrammed);
+
+    // Kept in case the wakeup timer ends before Standby Mode is entered
+    const uint32_t extiMask1 = EXTI->IMR1;
+    const uint32_t extiMask2 = EXTI->IMR2;
+    const uint32_t extiMask3 = EXTI->IMR3;
+    const uint32_t wakeupPinConfig = PWR->WKUPEPR;
+
+    // Clear all but the reserved bits in these registers to mask out external
+    // interrupts -->
+    EXTI->IMR1 = 0;
+    // Bit 13 in IMR2 is reserved and must always be 1
+    EXTI->IMR2 = 1 << 13;
+    // Bits 31:25, 19, and 18 in IMR3 are reserved and must be preserved
+    EXTI->IMR3 &= ~0x1f5ffff;
+    // <--
+
+    // Keep the D3 domain running for D3Batch, which then wakes the M7 core up
+    // when a batch has been collected
+    const bool d3Batching = D3Batch::prepareStandby();
+
+    if (RTCWakeupDelay::infinite != wakeupDelay)
+    {
+        // Enable RTC wakeup in IMR
+        HAL_EXTI_D1_EventInputConfig(EXTI_LINE19, EXTI_MODE_IT, ENABLE);
+    }
+    if (0 != sources.alarmTime)
+    {
+        // Enable RTC alarm wakeup in IMR
+        HAL_EXTI_D1_EventInputConfig(EXTI_LINE17, EXTI_MODE_IT, ENABLE);
+    }
+
+    configureWakeupPins(sources.pinConfig);
+
+    // Set all but the reserved bits in these registers to clear pending
+    // external interrupts -->
+    // Bits 31:22 in PR1 are reserved and the original value must be preserved
+    EXTI->PR1 |= 0x3fffff;
+    // All bits except 17 and 19 in PR2 are reserved and the original value must
+    // be preserved
+    EXTI->PR2 |= ((1 << 17) | (1 << 19));
+    // All bits except 18, 20, 21, and 22 in PR3 are reserved and the original
+    // value must be preserved
+    EXTI->PR3 |= ((1 << 18) | (1 << 20) | (1 << 21) | (1 << 22));
+    // <--
+    traceStandby(StandbyCheckpoint::interruptsMasked);
+
+    // Before the peripherals are reset, since the Mbed CPU statistics use the
+    // low power ticker
+    EnergyEstimator::recordStandbyEntry(isRTCConfigured() ?
+                                        readRTCMilliseconds() : 0);
+
+    // Set all but the reserved bits in these registers to clear pending
+    // interrupts -->
+    // Bits 31:22 in PR1 are reserved and the original value must be preserved
+    EXTI->PR1 |= 0x3fffff;
+    // All bits except 17 and 19 in PR2 are reserved and the original value must
+    // be preserved
+    EXTI->PR2 |= ((1 << 17) | (1 << 19));
+    // All bits except 18, 20, 21, and 22 in PR3 are reserved and the original
+    // value must be preserved
+    EXTI->PR3 |= ((1 << 18) | (1 << 20) | (1 << 21) | (1 << 22));
+    // <--
+
+    // If the wakeup timer has already ended, the clears above may have thrown
+    // its wakeup away, and the board would never wake up. Nothing has been
+    // reset yet, so the sketch can carry on instead.
+    if ((RTCWakeupDelay::infinite != wakeupDelay) &&
+        (0 != (RTC->ISR & RTC_ISR_WUTF)))
+    {
+        EXTI->IMR1 = extiMask1;
+        EXTI->IMR2 = extiMask2;
+        EXTI->IMR3 = extiMask3;
+        PWR->WKUPEPR = wakeupPinConfig;
+        cancelRTCWakeup();
+        if (0 != sources.alarmTime)
+        {
+            LL_RTC_DisableWriteProtection(RTC);
+            LL_RTC_DisableIT_ALRA(RTC);
+            LL_RTC_ALMA_Disable(RTC);
+            LL_RTC_ClearFlag_ALRA(RTC);
+            LL_RTC_EnableWriteProtection(RTC);
+        }
+        EXTI->PR1 = EXTI_PR1_PR17 | EXTI_PR1_PR19;
+        return cancel(LowPowerReturnCode::wakeupDelayTooShort);
+    }
+
+    // Disable and clear all pending interrupts in the NVIC. There are 8
+    // registers in the Cortex-M7.
+    for (auto i = 0; i < 8; i++)
+    {
+        NVIC->ICER[i] = 0xffffffff;
+        NVIC->ICPR[i] = 0xffffffff;
+    }
+
+    if (RTCWakeupDelay::infinite != wakeupDelay)
+    {
+        HAL_NVIC_SetPriority(RTC_WKUP_IRQn, 0x0, 0);
+        HAL_NVIC_EnableIRQ(RTC_WKUP_IRQn);
+    }
+    if (0 != sources.alarmTime)
+    {
+        HAL_NVIC_SetPriority(RTC_Alarm_IRQn, 0x0, 0);
+        HAL_NVIC_EnableIRQ(RTC_Alarm_IRQn);
+    }
+
+    // When we reset the peripherals below, the OSCEN line will no longer enable
+    // the MEMS oscillator for the HSE. This creates a race condition, where the
+    // HSE sometimes stops before we enter Standby Mode, and sometimes keeps
+    // going until Standby Mode is reached. If the HSE stops before Standby
+    // Mode is reached, the STM32H747 goes into a frozen state where the SMPS
+    // step-down converter never enters OPEN mode, the LDO voltage regulator
+    // stays on, and NRST stops working. One solution to this is to enable the
+    // Clock Security System (CSS), which makes the uC automatically switch over
+    // to HSI when it detects an HSE failure. It also triggers an NMI, which
+    // must be handled correctly.
+    HAL_RCC_EnableCSS();
+
+    // Reset peripherals to prepare for entry into Standby Mode, unless the
+    // sketch has left them in a state that is fine for Standby Mode
+    if (includesStep(steps, StandbySteps::resetBuses))
+    {
+        __HAL_RCC_AHB3_FORCE_RESET();
+        __HAL_RCC_AHB3_RELEASE_RESET();
+        __HAL_RCC_AHB1_FORCE_RESET();
+        __HAL_RCC_AHB1_RELEASE_RESET();
+        __HAL_RCC_AHB2_FORCE_RESET();
+        __HAL_RCC_AHB2_RELEASE_RESET();
+        __HAL_RCC_APB3_FORCE_RESET();
+        __HAL_RCC_APB3_RELEASE_RESET();
+        __HAL_RCC_APB1L_FORCE_RESET();
+        __HAL_RCC_APB1L_RELEASE_RESET();
+        __HAL_RCC_APB1H_FORCE_RESET();
+        __HAL_RCC_APB1H_RELEASE_RESET();
+        __HAL_RCC_APB2_FORCE_RESET();
+        __HAL_RCC_APB2_RELEASE_RESET();
+        // The D3 peripherals, and the GPIOs, keep collecting for D3Batch
+        if (!d3Batching)
+        {
+            __HAL_RCC_APB4_FORCE_RESET();
+            __HAL_RCC_APB4_RELEASE_RESET();
+            __HAL_RCC_AHB4_FORCE_RESET();
+            __HAL_RCC_AHB4_RELEASE_RESET();
+        }
+        traceStandby(StandbyCheckpoint::busesReset);
+    }
+
+    // Make sure that the M7 core takes the M4 core's state into account before
+    // turning off the power to the flash memory. The normal way to do this
+    // would be with __HAL_RCC_FLASH_C2_ALLOCATE(), but there's a bug in GCC
+    // versions before 7.5.0, where the load instruction may sometimes be
+    // discarded when a volatile variable is cast to void and there are extra
+    // parentheses around the volatile variable's name. Extra parentheses should
+    // not make a difference - see the C++14 standard, section 5, paragraph 11
+    // - but we are currently running GCC 7.2.1. The data synchronization
+    // barrier instruction below replaces the void-casted register read in
+    // __HAL_RCC_FLASH_C2_ALLOCATE().
+    RCC_C2->AHB3ENR |= RCC_AHB3ENR_FLASHEN;
+    __DSB();
+
+    // The data from persistent() must have a correct checksum to be kept
+    // after waking up. The backup SRAM isn't affected by the resets above.
+    commitPersistent();
+    traceStandby(StandbyCheckpoint::dataCommitted);
+
+    // Clean the entire data cache if we're running on the M7 core. We must
+    // make sure we're compiling for the CM7 core with conditional compilation,
+    // or we won't get this through the first phase of template compilation.
+    // Without a full clean, only the given range and the backup SRAM, which
+    // the library itself writes to, are cleaned. The range is widened to
+    // whole cache lines.
+#if defined CORE_CM7
+    if (includesStep(steps, StandbySteps::cleanCache))
+    {
+        SCB_CleanDCache();
+    }
+    else
+    {
+        const uint32_t lineSize = 32;
+        if ((nullptr != cleanStart) && (0 != cleanSize))
+        {
+            const uint32_t start = reinterpret_cast<uint32_t>(cleanStart) &
+                                   ~(lineSize - 1);
+            const uint32_t end = reinterpret_cast<uint32_t>(cleanStart) +
+                                 cleanSize;
+            SCB_CleanDCache_by_Addr(reinterpret_cast<uint32_t*>(start),
+                                    static_cast<int32_t>(end - start));
+        }
+        SCB_CleanDCache_by_Addr(reinterpret_cast<uint32_t*>(D3_BKPSRAM_BASE),
+                                sizeof(BackupSRAMLayout));
+    }
+#else
+    (void) cleanStart;
+    (void) cleanSize;
+#endif
+
+    if (standbyTraceActive)
+    {
+        traceStandby(StandbyCheckpoint::cacheCleaned);
+        auto& trace = backupSRAM().standbyTrace;
+        trace.coreClock = SystemCoreClock;
+        trace.total = DWT->CYCCNT - entryStart;
+        trace.magic = STANDBY_TRACE_MAGIC;
+#if defined CORE_CM7
+        // The trace is written after the clean above, so it must be cleaned
+        // on its own, widened to whole cache lines
+        const uint32_t start = reinterpret_cast<uint32_t>(&trace) & ~0x1fUL;
+        const uint32_t end = reinterpret_cast<uint32_t>(&trace) + sizeof(trace);
+        SCB_CleanDCache_by_Addr(reinterpret_cast<uint32_t*>(start),
+                                static_cast<int32_t>(end - start));
+#endif
+    }
+
+    // Keep a record of the entry time, so that it can be read after waking up
+    HAL_PWR_EnableBkUpAccess();
+    STANDBY_RTC_FAST_PATH_REGISTER = rtcFastPath ? 1 : 0;
+    STANDBY_ENTRY_CYCLES_REGISTER = DWT->CYCCNT - entryStart;
+
+    HAL_PWREx_EnterSTANDBYMode(PWR_D1_DOMAIN);
+
+    return LowPowerReturnCode::m7StandbyFailed;
+}
+
+// The template versions of standbyM7() can only use these, which are all the
+// combinations of the steps. The linker leaves out the ones that aren't used.
+template LowPowerReturnCode LowPowerNiclaVision::standbyM7Sequence<
+    StandbySteps::none>(const WakeupSources&, RTCSetup, const void* const,
+                        const size_t) const;
+template LowPowerReturnCode LowPowerNiclaVision::standbyM7Sequence<
+    StandbySteps::resetBuses>(const WakeupSources&, RTCSetup, const void* const,
+                              const size_t) const;
+template LowPowerReturnCode LowPowerNiclaVision::standbyM7Sequence<
+    StandbySteps::cleanCache>(const WakeupSources&, RTCSetup, const void* const,
+                              const size_t) const;
+template LowPowerReturnCode LowPowerNiclaVision::standbyM7Sequence<
+    StandbySteps::all>(const WakeupSources&, RTCSetup, const void* const,
+                       const size_t) const;
+
+LowPowerReturnCode LowPowerNiclaVision::standbySystem(RTCWakeupDelay delay,
+                                                      RTCSetup setup) const
+{
+    return standbySystem(WakeupSources().rtc(delay), setup);
+}
+
+LowPowerReturnCode LowPowerNiclaVision::standbySystem(
+    const WakeupSources& sources,
+    RTCSetup setup) const
+{
+    enableCycleCounter();
+    const uint32_t handshakeStart = DWT->CYCCNT;
+
+    // The D2 domain clock also stops when the M4 core is only in Stop Mode, so
+    // the M4 core is only known to be in Standby Mode already if the D2
+    // standby flag is set as well. While the clock runs, the flag can only be
+    // left from an earlier Standby Mode, and is cleared so that it can be
+    // waited for.
+    const bool d2Running = RCC->CR & RCC_CR_D2CKRDY;
+    if (d2Running || !(PWR->CPUCR & PWR_CPUCR_SBF_D2))
+    {
+        if (d2Running)
+        {
+            resetPreviousCPUModeFlags();
+        }
+
+        // Releasing the semaphore notifies the M4 core, which has enabled the
+        // interrupt for it in enableStandbyRequests()
+        __HAL_RCC_HSEM_CLK_ENABLE();
+        if (HAL_OK != HAL_HSEM_FastTake(STANDBY_REQUEST_SEMAPHORE))
+        {
+            return LowPowerReturnCode::m4HandshakeTimeout;
+        }
+        HAL_HSEM_Release(STANDBY_REQUEST_SEMAPHORE, 0);
+
+        if (!waitForRegister(PWR->CPUCR, PWR_CPUCR_SBF_D2, PWR_CPUCR_SBF_D2,
+                             STANDBY_HANDSHAKE_TIMEOUT))
+        {
+            return LowPowerReturnCode::m4HandshakeTimeout;
+        }
     }
-    HAL_FLASH_OB_Launch();
-    // The board should reset at this point, so anything beyond this point
-    // is a failure
-    HAL_FLASH_OB_Lock();
-    HAL_FLASH_Lock();
-    return LowPowerReturnCode::obLaunchFailed;
+
+    HAL_PWR_EnableBkUpAccess();
+    STANDBY_HANDSHAKE_CYCLES_REGISTER = DWT->CYCCNT - handshakeStart;
+
+    return standbyM7(sources, setup);
 }
 
-void LowPowerNiclaVision::resetPreviousCPUModeFlags() const
+void LowPowerNiclaVision::startClockRestore(const uint32_t oscillators,
+                                            const uint32_t sysclkSource,
+                                            const uint32_t voltageScaling,
+                                            const uint32_t previousCoreClock) const
 {
-    PWR->CPUCR |= PWR_CPUCR_CSSF;
+    // The PLLs can only be turned on once their source is ready, which is
+    // HSE if it was running before, or else HSI, which already is
+    const uint32_t plls = RCC_CR_PLL1ON | RCC_CR_PLL2ON | RCC_CR_PLL3ON;
+    restorePLLs = oscillators & plls;
+    restoreReadyMask = (oscillators & RCC_CR_HSEON) << 1;
+    restoreSysclk = sysclkSource;
+    restoreVoltageScaling = voltageScaling;
+    clockRestoreRunning = true;
+
+    // Keep the tickers at the right rate while running on HSI
+    retimeTickers(previousCoreClock);
+
+    previousRCCHandler = NVIC_GetVector(RCC_IRQn);
+    previousRCCInterrupts = RCC->CIER;
+    previousRCCPriority = NVIC_GetPriority(RCC_IRQn);
+    rccInterruptEnabled = NVIC_GetEnableIRQ(RCC_IRQn);
+    NVIC_SetVector(RCC_IRQn, reinterpret_cast<uint32_t>(&clockReadyHandler));
+    HAL_NVIC_SetPriority(RCC_IRQn, 0x0, 0);
+    RCC->CIER = previousRCCInterrupts | RCC_CIER_HSERDYIE | RCC_CIER_PLLRDYIE;
+
+    RCC->CR |= oscillators & ~plls;
+
+    // Run the handler once right away, which turns on the PLLs if their
+    // source is already ready
+    NVIC_EnableIRQ(RCC_IRQn);
+    NVIC_SetPendingIRQ(RCC_IRQn);
 }
 
-LowPowerReturnCode LowPowerNiclaVision::standbyM4() const
+LowPowerReturnCode LowPowerNiclaVision::stopM4() const
 {
     // Prevent Mbed from changing things
     core_util_critical_section_enter();
 
     waitForFlashReady();
 
-    // Clear all but the reserved bits in these registers to mask out external
-    // interrupts -->
-    EXTI->C2IMR1 = 0;
-    // Bit 13 of IMR is reserved and must always be 1
-    EXTI->C2IMR2 = 1 << 13;
-    // Bits 31:25, 19, and 18 of IMR are reserved and must be preserved
-    EXTI->C2IMR3 &= ~0x1f5ffff;
-    // <--
+    // The RTOS tick would otherwise wake the M4 core up again right away
+    const uint32_t sysTickControl = SysTick->CTRL;
+    SysTick->CTRL &= ~SysTick_CTRL_TICKINT_Msk;
 
-    // Set all but the reserved bits in these registers to clear pending
-    // external interrupts -->
-    // Bits 31:22 in PR1 are reserved and the original value must be preserved
-    EXTI->C2PR1 |= 0x3fffff;
-    // All bits except 17 and 19 in PR2 are reserved and the original value must
-    // be preserved
-    EXTI->C2PR2 |= ((1 << 17) | (1 << 19));
-    // All bits except 18, 20, 21, and 22 in PR3 are reserved and the original
-    // value must be preserved
-    EXTI->C2PR3 |= ((1 << 18) | (1 << 20) | (1 << 21) | (1 << 22));
-    // <--
+    // The RTC keeps the time in Stop Mode, contrary to the Mbed tickers
+    const bool rtcRunning = isRTCConfigured();
+    const uint64_t stopStart = rtcRunning ? readRTCMilliseconds() : 0;
 
-    // Disable and clear all pending interrupts in the NVIC. There are 8
-    // registers in the Cortex-M4.
-    for (auto i = 0; i < 8; i++)
+    HAL_PWREx_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON,
+                            PWR_STOPENTRY_WFI,
+                            PWR_D2_DOMAIN);
+
+    if (rtcRunning)
     {
-        NVIC->ICER[i] = 0xffffffff;
-        NVIC->ICPR[i] = 0xffffffff;
+        // The shadow registers must be synchronized again before the time
+        // can be read
+        HAL_PWR_EnableBkUpAccess();
+        LL_RTC_DisableWriteProtection(RTC);
+        LL_RTC_ClearFlag_RS(RTC);
+        LL_RTC_EnableWriteProtection(RTC);
+        const uint64_t stopEnd = readRTCMilliseconds();
+        stopModeTime += (stopEnd > stopStart) ? (stopEnd - stopStart) * 1000 : 0;
     }
 
-    HAL_PWREx_EnterSTANDBYMode(PWR_D3_DOMAIN);
+    SysTick->CTRL = sysTickControl;
 
-    HAL_PWREx_EnterSTANDBYMode(PWR_D2_DOMAIN);
+    core_util_critical_section_exit();
 
-    return LowPowerReturnCode::m4StandbyFailed;
+    publishM4Residency();
+
+    return LowPowerReturnCode::success;
 }
 
-LowPowerReturnCode LowPowerNiclaVision::standbyM7(RTCWakeupDelay delay) const
+LowPowerReturnCode LowPowerNiclaVision::stopM7(RTCWakeupDelay delay,
+                                               RTCSetup setup,
+                                               ClockRestore restore) const
 {
-    const unsigned long long int wakeupDelay = delay.value;
+    return stopM7(WakeupSources().rtc(delay), setup, restore);
+}
+
+LowPowerReturnCode LowPowerNiclaVision::stopM7(const WakeupSources& sources,
+                                               RTCSetup setup,
+                                               ClockRestore restore) const
+{
+    const unsigned long long int wakeupDelay = sources.delay.value;
+    const bool rtcWakeup = RTCWakeupDelay::infinite != wakeupDelay;
+    const bool alarmWakeup = 0 != sources.alarmTime;
+    const bool pinWakeup = 0 != (sources.pinConfig & 0x3f);
+
+    if (!rtcWakeup && !alarmWakeup && !pinWakeup && (0 == sources.extiLines))
+    {
+        return LowPowerReturnCode::noWakeupSource;
+    }
+
+    // The switch back to PLL1 after the last stopM7() with
+    // ClockRestore::background needs the RCC interrupt, so it can only be
+    // waited for with interrupts enabled. Entering Stop Mode before it's done
+    // would race it.
+    if (clockRestoreRunning)
+    {
+        if (core_util_in_critical_section())
+        {
+            return LowPowerReturnCode::clockSwitchFailed;
+        }
+        const uint32_t tickStart = HAL_GetTick();
+        while (clockRestoreRunning)
+        {
+            if ((HAL_GetTick() - tickStart) >
+                (HSE_TIMEOUT_VALUE + PLL_TIMEOUT_VALUE))
+            {
+                return LowPowerReturnCode::clockSwitchFailed;
+            }
+        }
+    }
+
+    // The cycle counter stops in Stop Mode, so it only counts the time spent
+    // entering and leaving it
+    const uint32_t entryStart = DWT->CYCCNT;
 
-    if ((wakeupDelay >= (2ULL << 17)) && (RTCWakeupDelay::infinite != wakeupDelay))
+    if (!sources.delay.fitsWakeupTimer())
     {
         return LowPowerReturnCode::wakeupDelayTooLong;
     }
+    if (sources.delay.value < RTCWakeupDelay::minWakeupTimerDelay)
+    {
+        return LowPowerReturnCode::wakeupDelayTooShort;
+    }
+    const uint32_t wakeupClock = sources.delay.wakeupClock;
+    const uint32_t autoReload = sources.delay.autoReload;
+
+    // As in standbyM7(), an alarm time that has already passed is found
+    // before anything is changed
+    if (alarmWakeup && isRTCConfigured())
+    {
+        const LowPowerReturnCode alarmResult = checkRTCAlarm(sources.alarmTime);
+        if (LowPowerReturnCode::success != alarmResult)
+        {
+            return alarmResult;
+        }
+    }
 
     // Prevent Mbed from changing things
     core_util_critical_section_enter();
 
     waitForFlashReady();
 
-    // Make the D3 domain follow the CPU subsystem modes. This also applies to
-    // Standby Mode according to the Reference Manual, even though the constant
-    // is called PWR_D3_DOMAIN_STOP.
+    if (rtcWakeup)
+    {
+        bool rtcFastPath = false;
+        const LowPowerReturnCode rtcResult = configureRTCWakeup(wakeupClock,
+                                                                autoReload,
+                                                                setup,
+                                                                rtcFastPath);
+        if (LowPowerReturnCode::success != rtcResult)
+        {
+            core_util_critical_section_exit();
+            return rtcResult;
+        }
+    }
+    if (alarmWakeup)
+    {
+        const LowPowerReturnCode alarmResult =
+            programRTCAlarm(sources.alarmTime, rtcWakeup, false);
+        if (LowPowerReturnCode::success != alarmResult)
+        {
+            if (rtcWakeup)
+            {
+                cancelRTCWakeup();
+            }
+            core_util_critical_section_exit();
+            return alarmResult;
+        }
+    }
+
+    // Make the D3 domain follow the CPU subsystem modes, and make sure that it
+    // goes into Stop Mode rather than Standby Mode together with them
     HAL_PWREx_ConfigD3Domain(PWR_D3_DOMAIN_STOP);
+    HAL_PWREx_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON,
+                            PWR_STOPENTRY_WFI,
+                            PWR_D3_DOMAIN);
 
-    // Make sure that the voltage scaling isn't in VOS0 by setting it to VOS1.
-    // While troubleshooting, change this to PWR_REGULATOR_VOLTAGE_SCALE3 to
-    // better differentiate the states of the uC while measuring VCORE at the
-    // VCAP pins.
-    if (HAL_OK != HAL_PWREx_ControlVoltageScaling(PWR_REGULATOR_VOLTAGE_SCALE1))
+    // Everything that is changed below must be restored after waking up,
+    // since the sketch continues where it left off
+    uint32_t nvicEnabled[8];
+    for (auto i = 0; i < 8; i++)
     {
-        return LowPowerReturnCode::voltageScalingFailed;
+        nvicEnabled[i] = NVIC->ISER[i];
     }
+    const uint32_t extiMask1 = EXTI->IMR1;
+    const uint32_t extiMask2 = EXTI->IMR2;
+    const uint32_t extiMask3 = EXTI->IMR3;
+    const uint32_t wakeupPinConfig = PWR->WKUPEPR;
+    const uint32_t sysTickControl = SysTick->CTRL;
+    const uint32_t oscillators = RCC->CR & (RCC_CR_HSEON |
+                                            RCC_CR_CSION |
+                                            RCC_CR_HSI48ON |
+                                            RCC_CR_PLL1ON |
+                                            RCC_CR_PLL2ON |
+                                            RCC_CR_PLL3ON);
+    const uint32_t sysclkSource = RCC->CFGR & RCC_CFGR_SW;
+    const uint32_t voltageScaling = HAL_PWREx_GetVoltageRange();
+    const uint32_t previousCoreClock = SystemCoreClock;
+    // There is only something to wait for in the background if the system
+    // clock comes from PLL1
+    const bool backgroundRestore = (ClockRestore::background == restore) &&
+                                   (RCC_CFGR_SW_PLL1 == sysclkSource);
 
-    // Clear all but the reserved bits in these registers to mask out external
-    // interrupts -->
-    EXTI->IMR1 = 0;
+    // Only the given sources may wake the M7 core up. Pending interrupts are
+    // left as they are, so that they are handled after waking up. -->
+    for (auto i = 0; i < 8; i++)
+    {
+        NVIC->ICER[i] = 0xffffffff;
+    }
+
+    // GPIO EXTI lines 0-15 in IMR1
+    EXTI->IMR1 = sources.extiLines;
     // Bit 13 in IMR2 is reserved and must always be 1
     EXTI->IMR2 = 1 << 13;
     // Bits 31:25, 19, and 18 in IMR3 are reserved and must be preserved
     EXTI->IMR3 &= ~0x1f5ffff;
-    // <--
-
-    if (RTCWakeupDelay::infinite != wakeupDelay)
-    {
-        // Enable RTC wakeup in IMR
-        HAL_EXTI_D1_EventInputConfig(EXTI_LINE19, EXTI_MODE_IT, ENABLE);
-    }
-
-    // Set all but the reserved bits in these registers to clear pending
-    // external interrupts -->
-    // Bits 31:22 in PR1 are reserved and the original value must be preserved
-    EXTI->PR1 |= 0x3fffff;
-    // All bits except 17 and 19 in PR2 are reserved and the original value must
-    // be preserved
-    EXTI->PR2 |= ((1 << 17) | (1 << 19));
-    // All bits except 18, 20, 21, and 22 in PR3 are reserved and the original
-    // value must be preserved
-    EXTI->PR3 |= ((1 << 18) | (1 << 20) | (1 << 21) | (1 << 22));
-    // <--
 
-    if (RTCWakeupDelay::infinite != wakeupDelay)
+    // Only enable the EXTI interrupts that were already enabled, since the
+    // sketch must have attached handlers for them
+    static const IRQn_Type extiInterrupts[] = {
+        EXTI0_IRQn, EXTI1_IRQn, EXTI2_IRQn, EXTI3_IRQn, EXTI4_IRQn,
+        EXTI9_5_IRQn, EXTI15_10_IRQn
+    };
+    for (const auto irq : extiInterrupts)
     {
-        RCC_OscInitTypeDef oscInit{};
-        oscInit.OscillatorType = RCC_OSCILLATORTYPE_LSE;
-        oscInit.LSEState = RCC_LSE_ON;
-        if (HAL_OK != HAL_RCC_OscConfig(&oscInit))
+        if (nvicEnabled[irq >> 5] & (1UL << (irq & 0x1f)))
         {
-            return LowPowerReturnCode::enableLSEFailed;
-        }
-
-        RCC_PeriphCLKInitTypeDef periphClkInit{};
-        periphClkInit.PeriphClockSelection = RCC_PERIPHCLK_RTC;
-        periphClkInit.RTCClockSelection = RCC_RTCCLKSOURCE_LSE;
-        if (HAL_OK != HAL_RCCEx_PeriphCLKConfig(&periphClkInit))
-        {
-            return LowPowerReturnCode::selectLSEFailed;
+            NVIC->ISER[irq >> 5] = 1UL << (irq & 0x1f);
         }
+    }
 
-        // This enables the RTC. It must not be called before the RTC input
-        // clock source is selected above.
-        __HAL_RCC_RTC_ENABLE();
+    if (rtcWakeup)
+    {
+        HAL_EXTI_D1_EventInputConfig(EXTI_LINE19, EXTI_MODE_IT, ENABLE);
+        EXTI->PR1 = EXTI_PR1_PR19;
+        NVIC_ClearPendingIRQ(RTC_WKUP_IRQn);
+        HAL_NVIC_SetPriority(RTC_WKUP_IRQn, 0x0, 0);
+        HAL_NVIC_EnableIRQ(RTC_WKUP_IRQn);
+    }
+    if (alarmWakeup)
+    {
+        HAL_EXTI_D1_EventInputConfig(EXTI_LINE17, EXTI_MODE_IT, ENABLE);
+        EXTI->PR1 = EXTI_PR1_PR17;
+        NVIC_ClearPendingIRQ(RTC_Alarm_IRQn);
+        HAL_NVIC_SetPriority(RTC_Alarm_IRQn, 0x0, 0);
+        HAL_NVIC_EnableIRQ(RTC_Alarm_IRQn);
+    }
 
-        LL_RTC_DisableWriteProtection(RTC);
+    configureWakeupPins(sources.pinConfig);
+    if (pinWakeup)
+    {
+        NVIC_ClearPendingIRQ(WAKEUP_PIN_IRQn);
+        HAL_NVIC_SetPriority(WAKEUP_PIN_IRQn, 0x0, 0);
+        HAL_NVIC_EnableIRQ(WAKEUP_PIN_IRQn);
+    }
 
-        // Enter init mode. We're doing this at the register level because of
-        // a bug in the LL that ships with the current version of Mbed, where,
-        // among other things, reserved bits are overwritten. Bit 7 is the INIT
-        // bit.
-        RTC->ISR |= 1 << 7;
-        while (1U != LL_RTC_IsActiveFlag_INIT(RTC))
-            ;
+    // The RTOS tick would otherwise wake the M7 core up again right away
+    SysTick->CTRL &= ~SysTick_CTRL_TICKINT_Msk;
+    // <--
 
-        LL_RTC_SetHourFormat(RTC, LL_RTC_HOURFORMAT_24HOUR);
-        // LSE at 32767 Hz / (127+1) / (255 + 1) = 1 Hz for the RTC
-        LL_RTC_SetAsynchPrescaler(RTC, 127);
-        LL_RTC_SetSynchPrescaler(RTC, 255);
+    // The RTC keeps the time in Stop Mode, contrary to the Mbed tickers
+    const bool rtcRunning = isRTCConfigured();
+    const uint64_t stopStart = rtcRunning ? readRTCMilliseconds() : 0;
+    const uint32_t entryEnd = DWT->CYCCNT;
 
-        // Exit init mode
-        RTC->ISR &= ~(1 << 7);
-        // This is probably not necessary, but included just in case
-        while (0U != LL_RTC_IsActiveFlag_INIT(RTC))
-            ;
+    HAL_PWREx_EnterSTOPMode(PWR_LOWPOWERREGULATOR_ON,
+                            PWR_STOPENTRY_WFI,
+                            PWR_D1_DOMAIN);
+    const uint32_t wakeupStart = DWT->CYCCNT;
 
+    // Acknowledge the RTC and wakeup pin wakeups, so that there are no such
+    // interrupts left pending when the interrupts are enabled again. Any
+    // GPIO EXTI interrupt is left pending for its handler.
+    if (rtcWakeup)
+    {
+        LL_RTC_DisableWriteProtection(RTC);
         LL_RTC_DisableIT_WUT(RTC);
         LL_RTC_WAKEUP_Disable(RTC);
-        while (1 != LL_RTC_IsActiveFlag_WUTW(RTC))
-            ;
-
-        if (wakeupDelay < (2ULL << 16)) {
-            LL_RTC_WAKEUP_SetAutoReload(RTC, wakeupDelay);
-            LL_RTC_WAKEUP_SetClock(RTC, LL_RTC_WAKEUPCLOCK_CKSPRE);
-        }
-        else {
-            LL_RTC_WAKEUP_SetAutoReload(RTC, wakeupDelay - (2ULL << 16));
-            LL_RTC_WAKEUP_SetClock(RTC, LL_RTC_WAKEUPCLOCK_CKSPRE_WUT);
-        }
-
-        LL_RTC_WAKEUP_Enable(RTC);
-        LL_RTC_EnableIT_WUT(RTC);
-        __HAL_RTC_WAKEUPTIMER_EXTI_ENABLE_RISING_EDGE();
         LL_RTC_ClearFlag_WUT(RTC);
-
+        // The shadow registers must be synchronized again before the time
+        // can be read
+        LL_RTC_ClearFlag_RS(RTC);
+        LL_RTC_EnableWriteProtection(RTC);
+        EXTI->PR1 = EXTI_PR1_PR19;
+        NVIC_ClearPendingIRQ(RTC_WKUP_IRQn);
+    }
+    if (alarmWakeup)
+    {
+        LL_RTC_DisableWriteProtection(RTC);
+        LL_RTC_DisableIT_ALRA(RTC);
+        LL_RTC_ALMA_Disable(RTC);
+        LL_RTC_ClearFlag_ALRA(RTC);
+        LL_RTC_ClearFlag_RS(RTC);
         LL_RTC_EnableWriteProtection(RTC);
+        EXTI->PR1 = EXTI_PR1_PR17;
+        NVIC_ClearPendingIRQ(RTC_Alarm_IRQn);
     }
+    // Bits 5:0 in WKUPCR clear the wakeup pin flags
+    PWR->WKUPCR = 0x3f;
+    NVIC_ClearPendingIRQ(WAKEUP_PIN_IRQn);
 
-    // Set all but the reserved bits in these registers to clear pending
-    // interrupts -->
-    // Bits 31:22 in PR1 are reserved and the original value must be preserved
-    EXTI->PR1 |= 0x3fffff;
-    // All bits except 17 and 19 in PR2 are reserved and the original value must
-    // be preserved
-    EXTI->PR2 |= ((1 << 17) | (1 << 19));
-    // All bits except 18, 20, 21, and 22 in PR3 are reserved and the original
-    // value must be preserved
-    EXTI->PR3 |= ((1 << 18) | (1 << 20) | (1 << 21) | (1 << 22));
-    // <--
+    const LowPowerReturnCode clockResult = backgroundRestore ?
+                                           LowPowerReturnCode::success :
+                                           restoreClocks(oscillators,
+                                                         sysclkSource,
+                                                         voltageScaling);
+    const uint32_t restoreEnd = DWT->CYCCNT;
 
-    // Disable and clear all pending interrupts in the NVIC. There are 8
-    // registers in the Cortex-M7.
+    if (rtcRunning)
+    {
+        const uint64_t stopEnd = readRTCMilliseconds();
+        stopModeTime += (stopEnd > stopStart) ? (stopEnd - stopStart) * 1000 : 0;
+    }
+
+    PWR->WKUPEPR = wakeupPinConfig;
+    EXTI->IMR1 = extiMask1;
+    EXTI->IMR2 = extiMask2;
+    EXTI->IMR3 = extiMask3;
+    SysTick->CTRL = sysTickControl;
     for (auto i = 0; i < 8; i++)
     {
         NVIC->ICER[i] = 0xffffffff;
-        NVIC->ICPR[i] = 0xffffffff;
+        NVIC->ISER[i] = nvicEnabled[i];
     }
 
-    if (RTCWakeupDelay::infinite != wakeupDelay)
+    // Until the clocks have been restored, the core runs on HSI
+    stopOverhead =
+        (entryEnd - entryStart) / (previousCoreClock / 1000000) +
+        (restoreEnd - wakeupStart) / (HSI_VALUE / 1000000) +
+        (DWT->CYCCNT - restoreEnd) / (SystemCoreClock / 1000000);
+
+    // After the interrupts have been put back, since it enables its own
+    if (backgroundRestore)
     {
-        HAL_NVIC_SetPriority(RTC_WKUP_IRQn, 0x0, 0);
-        HAL_NVIC_EnableIRQ(RTC_WKUP_IRQn);
+        startClockRestore(oscillators, sysclkSource, voltageScaling,
+                          previousCoreClock);
     }
 
-    // When we reset the peripherals below, the OSCEN line will no longer enable
-    // the MEMS oscillator for the HSE. This creates a race condition, where the
-    // HSE sometimes stops before we enter Standby Mode, and sometimes keeps
-    // going until Standby Mode is reached. If the HSE stops before Standby
-    // Mode is reached, the STM32H747 goes into a frozen state where the SMPS
-    // step-down converter never enters OPEN mode, the LDO voltage regulator
-    // stays on, and NRST stops working. One solution to this is to enable the
-    // Clock Security System (CSS), which makes the uC automatically switch over
-    // to HSI when it detects an HSE failure. It also triggers an NMI, which
-    // must be handled correctly.
-    HAL_RCC_EnableCSS();
+    core_util_critical_section_exit();
 
-    // Reset peripherals to prepare for entry into Standby Mode
-    __HAL_RCC_AHB3_FORCE_RESET();
-    __HAL_RCC_AHB3_RELEASE_RESET();
-    __HAL_RCC_AHB1_FORCE_RESET();
-    __HAL_RCC_AHB1_RELEASE_RESET();
-    __HAL_RCC_AHB2_FORCE_RESET();
-    __HAL_RCC_AHB2_RELEASE_RESET();
-    __HAL_RCC_APB3_FORCE_RESET();
-    __HAL_RCC_APB3_RELEASE_RESET();
-    __HAL_RCC_APB1L_FORCE_RESET();
-    __HAL_RCC_APB1L_RELEASE_RESET();
-    __HAL_RCC_APB1H_FORCE_RESET();
-    __HAL_RCC_APB1H_RELEASE_RESET();
-    __HAL_RCC_APB2_FORCE_RESET();
-    __HAL_RCC_APB2_RELEASE_RESET();
-    __HAL_RCC_APB4_FORCE_RESET();
-    __HAL_RCC_APB4_RELEASE_RESET();
-    __HAL_RCC_AHB4_FORCE_RESET();
-    __HAL_RCC_AHB4_RELEASE_RESET();
+    return clockResult;
+}
 
-    // Make sure that the M7 core takes the M4 core's state into account before
-    // turning off the power to the flash memory. The normal way to do this
-    // would be with __HAL_RCC_FLASH_C2_ALLOCATE(), but there's a bug in GCC
-    // versions before 7.5.0, where the load instruction may sometimes be
-    // discarded when a volatile variable is cast to void and there are extra
-    // parentheses around the volatile variable's name. Extra parentheses should
-    // not make a difference - see the C++14 standard, section 5, paragraph 11
-    // - but we are currently running GCC 7.2.1. The data synchronization
-    // barrier instruction below replaces the void-casted register read in
-    // __HAL_RCC_FLASH_C2_ALLOCATE().
-    RCC_C2->AHB3ENR |= RCC_AHB3ENR_FLASHEN;
-    __DSB();
+LowPowerReturnCode LowPowerNiclaVision::switchPerformanceLevel(
+    const PerformanceLevel level) const
+{
+    const PerformanceSetup& setup = performanceSetups[static_cast<int>(level)];
+    // The levels are ordered from the highest voltage scaling to the lowest
+    const bool raiseVoltage = level < currentPerformanceLevel;
+    const uint32_t voltageScaling = (PerformanceLevel::max == level) ?
+                                    bootVoltageScaling : setup.voltageScaling;
 
-    // Clean the entire data cache if we're running on the M7 core. We must
-    // make sure we're compiling for the CM7 core with conditional compilation,
-    // or we won't get this through the first phase of template compilation.
-#if defined CORE_CM7
-    SCB_CleanDCache();
-#endif
+    // The voltage scaling must be raised before the frequency goes up, and
+    // lowered only after the frequency has gone down. The flash latency from
+    // boot is enough for all levels, since the AXI clock is lowered along
+    // with the voltage scaling.
+    if (raiseVoltage &&
+        (HAL_OK != HAL_PWREx_ControlVoltageScaling(voltageScaling)))
+    {
+        return LowPowerReturnCode::voltageScalingFailed;
+    }
 
-    HAL_PWREx_EnterSTANDBYMode(PWR_D1_DOMAIN);
+    // Run from HSI while PLL1 is reconfigured. The PLL dividers can only be
+    // changed while the PLL is off.
+    RCC->CR |= RCC_CR_HSION;
+    if (!waitForRegister(RCC->CR, RCC_CR_HSIRDY, RCC_CR_HSIRDY,
+                         HSI_TIMEOUT_VALUE))
+    {
+        return LowPowerReturnCode::clockSwitchFailed;
+    }
+    MODIFY_REG(RCC->CFGR, RCC_CFGR_SW, RCC_CFGR_SW_HSI);
+    if (!waitForRegister(RCC->CFGR, RCC_CFGR_SWS,
+                         RCC_CFGR_SW_HSI << RCC_CFGR_SWS_Pos,
+                         CLOCKSWITCH_TIMEOUT_VALUE))
+    {
+        return LowPowerReturnCode::clockSwitchFailed;
+    }
+    currentPerformanceLevel = PerformanceLevel::low;
 
-    return LowPowerReturnCode::m7StandbyFailed;
+    RCC->CR &= ~RCC_CR_PLL1ON;
+    if (!waitForRegister(RCC->CR, RCC_CR_PLL1RDY, 0, PLL_TIMEOUT_VALUE))
+    {
+        return LowPowerReturnCode::clockSwitchFailed;
+    }
+
+    if (0 != setup.pllDivider)
+    {
+        MODIFY_REG(RCC->PLL1DIVR, RCC_PLL1DIVR_P1,
+                   ((bootPLL1Divider * setup.pllDivider) - 1)
+                   << RCC_PLL1DIVR_P1_Pos);
+        RCC->CR |= RCC_CR_PLL1ON;
+        if (!waitForRegister(RCC->CR, RCC_CR_PLL1RDY, RCC_CR_PLL1RDY,
+                             PLL_TIMEOUT_VALUE))
+        {
+            return LowPowerReturnCode::clockSwitchFailed;
+        }
+        MODIFY_REG(RCC->CFGR, RCC_CFGR_SW, RCC_CFGR_SW_PLL1);
+        if (!waitForRegister(RCC->CFGR, RCC_CFGR_SWS,
+                             RCC_CFGR_SW_PLL1 << RCC_CFGR_SWS_Pos,
+                             CLOCKSWITCH_TIMEOUT_VALUE))
+        {
+            return LowPowerReturnCode::clockSwitchFailed;
+        }
+    }
+    currentPerformanceLevel = level;
+
+    if (!raiseVoltage &&
+        (HAL_OK != HAL_PWREx_ControlVoltageScaling(voltageScaling)))
+    {
+        return LowPowerReturnCode::voltageScalingFailed;
+    }
+
+    return LowPowerReturnCode::success;
 }
 
 uint64_t LowPowerNiclaVision::timeSinceBoot() const
@@ -437,6 +2917,20 @@ uint64_t LowPowerNiclaVision::timeSinceBoot() const
     return stats.uptime;
 }
 
+uint64_t LowPowerNiclaVision::timeSpentAtPerformanceLevel(
+    const PerformanceLevel level) const
+{
+    core_util_critical_section_enter();
+    uint64_t time = performanceLevelTime[static_cast<int>(level)];
+    if (level == currentPerformanceLevel)
+    {
+        time += timeSpentAwake() - performanceLevelSince;
+    }
+    core_util_critical_section_exit();
+
+    return time;
+}
+
 uint64_t LowPowerNiclaVision::timeSpentIdle() const
 {
     mbed_stats_cpu_t stats{};
@@ -458,16 +2952,68 @@ uint64_t LowPowerNiclaVision::timeSpentInSleep() const
     return stats.sleep_time;
 }
 
+uint64_t LowPowerNiclaVision::timeSpentInStop() const
+{
+    core_util_critical_section_enter();
+    const uint64_t time = stopModeTime;
+    core_util_critical_section_exit();
+
+    return time;
+}
+
+void LowPowerNiclaVision::unlockDeepSleep(const char* const holder) const
+{
+    core_util_critical_section_enter();
+    const size_t index = findDeepSleepLockHolder(holder);
+    DeepSleepLockRecord& record = deepSleepLockRecords[index];
+    // Ignore unbalanced calls rather than releasing a lock held by a driver
+    if (0 != record.held)
+    {
+        --record.held;
+        if (0 == record.held)
+        {
+            const uint64_t hold = ticker_read_us(get_us_ticker_data()) -
+                                  deepSleepLockedSince[index];
+            record.heldTime += hold;
+            if (hold > record.longestHold)
+            {
+                record.longestHold = hold;
+            }
+        }
+        sleep_manager_unlock_deep_sleep();
+    }
+    core_util_critical_section_exit();
+}
+
 void LowPowerNiclaVision::waitForFlashReady() const
 {
     // Make sure the flash controller isn't busy before we continue, since
     // that would block standby mode.
-    //
-    // 0x07 = QW, WBNE, and BSY flags
-    while ((FLASH->SR1 & 0x07) || (FLASH->SR2 & 0x07))
+    while (isFlashBusy())
       ;
 }
 
+bool LowPowerNiclaVision::waitForRegister(const volatile uint32_t& reg,
+                                          const uint32_t mask,
+                                          const uint32_t value,
+                                          const uint32_t timeout)
+{
+    const uint32_t tickStart = HAL_GetTick();
+    while (value != (reg & mask))
+    {
+        if ((HAL_GetTick() - tickStart) > timeout)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+const WakeupInfo& LowPowerNiclaVision::wakeupInfo() const
+{
+    return info;
+}
+
 bool LowPowerNiclaVision::wasInCPUMode(CPUMode mode) const
 {
     switch (mode)
@@ -31,6 +31,9 @@
 #include <mbed.h>
 #include <usb_phy_api.h>
 #include <limits>
+#include <new>
+#include <type_traits>
+#include "PowerProfiler.h"
 
 /*
 ********************************************************************************
@@ -57,6 +60,31 @@ enum class LowPowerReturnCode
     enableLSEFailed,            ///< Unable to enable external 32 kHz oscillator
     selectLSEFailed,            ///< Unable to select external 32 kHz oscillator
     voltageScalingFailed,       ///< Unable to set appropriate voltage scaling
+    clockRestoreFailed,         ///< Unable to restore the clocks after waking up
+    noWakeupSource,             ///< No wakeup source that can end the sleep
+    clockSwitchFailed,          ///< Unable to switch to a new system clock frequency
+    m4HandshakeTimeout,         ///< M4 core didn't enter Standby Mode when requested
+    wakeupTimePassed,           ///< RTC alarm time already passed, or too close to program
+    tooManyJobs,                ///< No room for another job in the WakeupScheduler
+    flashBusyTimeout,           ///< The flash controller stayed busy for longer than allowed
+    domainNotConfigured,        ///< No pin has been set up for the PowerDomain
+    invalidBatchSize,           ///< The D3Batch batch size is 0 or larger than D3Batch::maxBatchSize
+    invalidFrameBuffer,         ///< The FrameCapture buffer isn't aligned to 32 bytes, is too large, or can't be reached by the DMA
+    captureFailed,              ///< The DMA or the DCMI reported an error during the FrameCapture
+    captureTimeout,             ///< No frame arrived in the time allowed
+    adcBusy,                    ///< ADC3 is already in use by something else
+    adcTimeout,                 ///< ADC3 didn't become ready or finish a conversion in time
+    wakeupDelayTooShort,        ///< RTC delay too short to go to sleep before it ends
+};
+
+/**
+ * @enum ClockRestore
+ * @brief Provides the ways that stopM7() can restore the clocks after waking up.
+*/
+enum class ClockRestore
+{
+    wait,                   ///< Wait until the clocks run as before, then return
+    background              ///< Return at once on HSI, and switch back when PLL1 is ready
 };
 
 /**
@@ -72,6 +100,149 @@ enum class CPUMode
     stop                    ///< Stop mode for the whole microcontroller
 };
 
+/**
+ * @enum DeepSleepOption
+ * @brief Provides the subsystems that allowDeepSleep() can turn off, because
+ * they hold Deep Sleep locks. They can be combined with the | operator.
+*/
+enum class DeepSleepOption : uint8_t
+{
+    usb         = 0x01,     ///< Turn off USB, including the serial port over USB
+    microsTimer = 0x02,     ///< Stop the timer behind micros(), which then stops counting
+    all         = 0x03      ///< Turn off all of the above
+};
+
+/**
+ * @enum IdleMode
+ * @brief Provides the power modes that idleFor() can choose between. They can be combined with the | operator.
+*/
+enum class IdleMode : uint8_t
+{
+    none    = 0x00,     ///< No mode, e.g. before the first call to idleFor()
+    sleep   = 0x01,     ///< Sleep Mode, with the thread blocked and Deep Sleep locked
+    stop    = 0x02,     ///< Stop Mode through stopM7()
+    standby = 0x04,     ///< Standby Mode through standbyM7(), after which the sketch starts over
+    all     = 0x07      ///< All of the above
+};
+
+/**
+ * @brief Operator to combine modes for idleFor(). e.g. IdleMode::sleep | IdleMode::stop
+ * @param m1 The first modes.
+ * @param m2 The second modes.
+ * @return The combination of the modes.
+*/
+constexpr IdleMode operator|(const IdleMode m1, const IdleMode m2)
+{
+    return static_cast<IdleMode>(static_cast<uint8_t>(m1) |
+                                 static_cast<uint8_t>(m2));
+}
+
+/**
+ * @enum PerformanceLevel
+ * @brief Provides the combinations of CPU frequency and voltage scaling for the M7 core while awake.
+ * The buses run at the same fraction of the CPU frequency at all levels.
+*/
+enum class PerformanceLevel
+{
+    max,                    ///< 480 MHz from PLL1 in VOS0, as after boot
+    high,                   ///< 240 MHz from PLL1 in VOS1
+    medium,                 ///< 120 MHz from PLL1 in VOS2
+    low                     ///< 64 MHz from HSI in VOS3, with PLL1 turned off
+};
+
+/**
+ * @enum RTCSetup
+ * @brief Provides the ways to prepare the RTC before the wakeup timer is programmed.
+ * The RTC lives in the backup domain and keeps running through Standby Mode,
+ * so it is normally enough to set it up fully once after power-on.
+*/
+enum class RTCSetup
+{
+    reuseIfConfigured,      ///< Skip the LSE and prescaler setup if the RTC already runs at 1 Hz from LSE
+    full                    ///< Always enable LSE, select it for the RTC, and set the prescalers
+};
+
+/**
+ * @enum StandbySteps
+ * @brief Provides the optional steps of standbyM7(), for the template version that leaves some of them out.
+ * They can be combined with the | operator.
+*/
+enum class StandbySteps : uint32_t
+{
+    none       = 0x00,      ///< Leave out all of the optional steps
+    resetBuses = 0x01,      ///< Reset the peripherals on all AHB and APB buses
+    cleanCache = 0x02,      ///< Clean the whole D-cache, rather than only a given range
+    all        = 0x03       ///< All of the above, as in the non-template standbyM7()
+};
+
+/**
+ * @brief Operator to combine steps for standbyM7(). e.g. StandbySteps::resetBuses | StandbySteps::cleanCache
+ * @param s1 The first steps.
+ * @param s2 The second steps.
+ * @return The combination of the steps.
+*/
+constexpr StandbySteps operator|(const StandbySteps s1, const StandbySteps s2)
+{
+    return static_cast<StandbySteps>(static_cast<uint32_t>(s1) |
+                                     static_cast<uint32_t>(s2));
+}
+
+/**
+ * @enum StandbyCheckpoint
+ * @brief Provides the steps of standbyM7() that a StandbyTrace records the end of, in the order they run.
+*/
+enum class StandbyCheckpoint : uint8_t
+{
+    flashReady,             ///< The flash controller has finished any ongoing operation
+    voltageScaled,          ///< The voltage scaling is out of VOS0
+    lseStarted,             ///< LSE is running, only when the RTC is set up from scratch
+    rtcInitialized,         ///< The RTC prescalers are set, only when the RTC is set up from scratch
+    wakeupTimerWritable,    ///< The RTC wakeup timer can be written, only with a delay
+    rtcProgrammed,          ///< The RTC wakeup timer and alarm are programmed
+    interruptsMasked,       ///< The EXTI lines and wakeup pins are set up
+    busesReset,             ///< The peripherals are reset, only with StandbySteps::resetBuses
+    dataCommitted,          ///< The data in the backup SRAM is up to date
+    cacheCleaned            ///< The D-cache is cleaned, which is the last step
+};
+
+/**
+ * @enum WakeupPin
+ * @brief Provides the wakeup pins of the microcontroller.
+ * These can wake the microcontroller up from both Stop Mode and Standby Mode.
+*/
+enum class WakeupPin
+{
+    wkup1,                  ///< WKUP1 (PA0)
+    wkup2,                  ///< WKUP2 (PA2)
+    wkup3,                  ///< WKUP3 (PI8)
+    wkup4,                  ///< WKUP4 (PC13)
+    wkup5,                  ///< WKUP5 (PI11)
+    wkup6                   ///< WKUP6 (PC1)
+};
+
+/**
+ * @enum WakeupEdge
+ * @brief Provides the edges on a wakeup pin that can wake the microcontroller up.
+*/
+enum class WakeupEdge
+{
+    rising,                 ///< Wake up on a rising edge or high level
+    falling                 ///< Wake up on a falling edge or low level
+};
+
+/**
+ * @enum WakeupPull
+ * @brief Provides the pull resistor configurations for a wakeup pin.
+ * The pull resistor is kept by the power controller in Standby Mode, when the
+ * I/O pins themselves are floating.
+*/
+enum class WakeupPull
+{
+    none,                   ///< No pull resistor
+    up,                     ///< Pull-up resistor
+    down                    ///< Pull-down resistor
+};
+
 /*
 ********************************************************************************
 *                                 Classes
@@ -80,6 +251,8 @@ enum class CPUMode
 
 /**
  * @brief The RTCWakeupDelay class represents a delay before waking up from Standby Mode.
+ * All its functions are constexpr, so that a constant delay, such as 10_s, is
+ * worked out at compile time, including the settings of the RTC wakeup timer.
 */
 class RTCWakeupDelay {
     public:
@@ -88,37 +261,576 @@ class RTCWakeupDelay {
         * @param hours Hours to wait before wakeup.
         * @param minutes Minutes to wait before wakeup.
         * @param seconds Seconds to wait before wakeup.
+        * @param milliseconds Milliseconds to wait before wakeup.
+        */
+        constexpr RTCWakeupDelay(const unsigned long long int hours,
+                                 const unsigned long long int minutes,
+                                 const unsigned long long int seconds,
+                                 const unsigned long long int milliseconds = 0) :
+            RTCWakeupDelay(add(multiply(add(multiply(add(multiply(hours, 60),
+                                                         minutes),
+                                                     60),
+                                            seconds),
+                                        1000),
+                               milliseconds))
+        {
+        }
+
+        /**
+        * @brief Check if the RTC wakeup timer can wait this long, for example with static_assert((30_h + 10_h).fitsWakeupTimer(), "Too long").
+        * Longer delays are still fine for an RTC alarm or the WakeupScheduler.
+        * Delays shorter than 4 ms fit, but standbyM7() and stopM7() return
+        * LowPowerReturnCode::wakeupDelayTooShort for them, since the timer could
+        * end before the microcontroller has gone to sleep.
+        * @return Fits: true. Too long: false, and standbyM7() and stopM7() return LowPowerReturnCode::wakeupDelayTooLong.
         */
-        RTCWakeupDelay(const unsigned long long int hours,
-                       const unsigned long long int minutes,
-                       const unsigned long long int seconds) :
-            value(hours * 60 * 60 + minutes * 60 + seconds)
+        constexpr bool fitsWakeupTimer() const
         {
+            return wakeupTimerFits;
         }
 
     private:
         // To wait forever before waking up (used in combination with NRST)
         static const unsigned long long int infinite = ULONG_LONG_MAX;
+        // Where sums and products stop instead of overflowing. It's too long
+        // for anything, but not infinite.
+        static const unsigned long long int saturated = ULONG_LONG_MAX - 1;
+        // The longest delay of the wakeup timer, with the 1 Hz ck_spre clock
+        // and 2^16 added to the 16 bit counter, in milliseconds
+        static const unsigned long long int maxWakeupTimerDelay = (1ULL << 17) * 1000;
+        // The shortest delay of the wakeup timer, in milliseconds. It's the
+        // same margin as for an RTC alarm, since the timer mustn't end while
+        // the pending interrupts are cleared before going to sleep.
+        static const unsigned long long int minWakeupTimerDelay = 4;
         // We don't really need this large type, but we must use this specific
         // type for user-defined literals to work.
         unsigned long long int value;
+        // The WUCKSEL bits and auto-reload value of the wakeup timer, which are
+        // only valid if wakeupTimerFits is true
+        uint8_t wakeupClock = 0;
+        uint16_t autoReload = 0;
+        bool wakeupTimerFits = true;
+
         /**
         * @brief Private constructor to create a delay object with a specific delay value.
-        * @param delay The delay value in seconds.
+        * @param delay The delay value in milliseconds.
+        */
+        constexpr RTCWakeupDelay(const unsigned long long int delay) : value(delay)
+        {
+            if (infinite == delay)
+            {
+                return;
+            }
+            if (delay > maxWakeupTimerDelay)
+            {
+                wakeupTimerFits = false;
+                return;
+            }
+
+            // The wakeup clocks from the coarsest to the finest, as the values
+            // of the WUCKSEL bits. The RTC runs from LSE at 32768 Hz, and
+            // ck_spre is 1 Hz with the prescalers from initializeRTC().
+            const uint8_t clocks[] = { 4, 0, 1, 2, 3 };
+            const unsigned long long int frequencies[] = {
+                1, 32768 / 16, 32768 / 8, 32768 / 4, 32768 / 2
+            };
+            const unsigned long long int maxTicks[] = {
+                1ULL << 17, 1ULL << 16, 1ULL << 16, 1ULL << 16, 1ULL << 16
+            };
+
+            // Pick the coarsest clock that represents the delay exactly, or
+            // that has a resolution within 1% of the delay. If no clock is
+            // precise enough, pick the finest one that still has the range.
+            // ck_spre always has the range.
+            uint8_t selected = clocks[0];
+            unsigned long long int ticks = (delay + 500) / 1000;
+            for (int i = 0; i < 5; ++i)
+            {
+                const unsigned long long int scaled = delay * frequencies[i];
+                const unsigned long long int candidateTicks = (scaled + 500) / 1000;
+                if (candidateTicks > maxTicks[i])
+                {
+                    break;
+                }
+                selected = clocks[i];
+                ticks = candidateTicks;
+                // Half a tick of 1000 / frequency ms must be at most 1% of
+                // the delay
+                if ((0 != scaled) && ((0 == scaled % 1000) || (scaled >= 50000)))
+                {
+                    break;
+                }
+            }
+
+            // The wakeup flag is set every (WUT + 1) ticks, and ck_spre with
+            // WUCKSEL 6 adds 2^16 to WUT. The Reference Manual doesn't allow
+            // WUT 0 with RTCCLK/2 (WUCKSEL 3).
+            if (0 == ticks)
+            {
+                ticks = 1;
+            }
+            if ((3 == selected) && (ticks < 2))
+            {
+                ticks = 2;
+            }
+            if (ticks > (1ULL << 16))
+            {
+                wakeupClock = 6;
+                autoReload = static_cast<uint16_t>(ticks - (1ULL << 16) - 1);
+            }
+            else
+            {
+                wakeupClock = selected;
+                autoReload = static_cast<uint16_t>(ticks - 1);
+            }
+        }
+
+        static constexpr unsigned long long int add(
+            const unsigned long long int a,
+            const unsigned long long int b)
+        {
+            return ((a > saturated) || (b > saturated - a)) ? saturated : a + b;
+        }
+
+        static constexpr unsigned long long int multiply(
+            const unsigned long long int a,
+            const unsigned long long int factor)
+        {
+            return ((0 != factor) && (a > saturated / factor)) ? saturated
+                                                               : a * factor;
+        }
+
+        // The value of an integer literal, in any base and with digit
+        // separators, or saturated if it isn't one or is too large
+        static constexpr unsigned long long int parseLiteral(
+            const char* const text,
+            const size_t length)
+        {
+            unsigned long long int base = 10;
+            size_t start = 0;
+            if ((length > 2) && ('0' == text[0]) &&
+                (('x' == text[1]) || ('X' == text[1])))
+            {
+                base = 16;
+                start = 2;
+            }
+            else if ((length > 2) && ('0' == text[0]) &&
+                     (('b' == text[1]) || ('B' == text[1])))
+            {
+                base = 2;
+                start = 2;
+            }
+            else if ((length > 1) && ('0' == text[0]))
+            {
+                base = 8;
+                start = 1;
+            }
+
+            unsigned long long int result = 0;
+            for (size_t i = start; i < length; ++i)
+            {
+                const char c = text[i];
+                unsigned long long int digit = base;
+                if ('\'' == c)
+                {
+                    continue;
+                }
+                if ((c >= '0') && (c <= '9'))
+                {
+                    digit = c - '0';
+                }
+                else if ((c >= 'a') && (c <= 'f'))
+                {
+                    digit = c - 'a' + 10;
+                }
+                else if ((c >= 'A') && (c <= 'F'))
+                {
+                    digit = c - 'A' + 10;
+                }
+                if (digit >= base)
+                {
+                    return saturated;
+                }
+                result = add(multiply(result, base), digit);
+            }
+            return result;
+        }
+
+        template <unsigned long long int factor, char... digits>
+        static constexpr unsigned long long int literalValue()
+        {
+            const char text[] = { digits... };
+            return multiply(parseLiteral(text, sizeof...(digits)), factor);
+        }
+
+        template <char... digits>
+        friend constexpr RTCWakeupDelay operator""_ms();
+        template <char... digits>
+        friend constexpr RTCWakeupDelay operator""_s();
+        template <char... digits>
+        friend constexpr RTCWakeupDelay operator""_min();
+        template <char... digits>
+        friend constexpr RTCWakeupDelay operator""_h();
+        friend constexpr RTCWakeupDelay operator+(const RTCWakeupDelay d1,
+                                                  const RTCWakeupDelay d2);
+
+        friend class DeepSleepGuard;
+        friend class FastBoot;
+        friend class LowPowerNiclaVision;
+        friend class PowerMonitor;
+        friend class WakeupScheduler;
+        friend class WakeupSources;
+};
+
+/**
+ * @brief The WakeupSources class represents the sources that may end Stop Mode or Standby Mode.
+ * The sources are added with chained calls, e.g. WakeupSources().pin(WakeupPin::wkup1, WakeupEdge::rising).rtc(10_s)
+*/
+class WakeupSources {
+    public:
+        /**
+        * @brief Create a set of wakeup sources without any sources.
+        */
+        WakeupSources() : delay(RTCWakeupDelay::infinite)
+        {
+        }
+
+        /**
+        * @brief Wake up on the given edge of a wakeup pin.
+        * @param wakeupPin The wakeup pin to use.
+        * @param edge The edge that wakes the microcontroller up.
+        * @param pull The pull resistor to use on the pin.
+        * @return This object, so that more sources can be added.
+        */
+        WakeupSources& pin(const WakeupPin wakeupPin,
+                           const WakeupEdge edge,
+                           const WakeupPull pull = WakeupPull::none)
+        {
+            const uint32_t index = static_cast<uint32_t>(wakeupPin);
+            // Same layout as PWR_WKUPEPR: enable bits at 0, polarity bits at
+            // 8 (set for falling), and two pull bits per pin at 16
+            pinConfig &= ~((1UL << index) | (1UL << (8 + index)) |
+                           (3UL << (16 + 2 * index)));
+            pinConfig |= 1UL << index;
+            if (WakeupEdge::falling == edge)
+            {
+                pinConfig |= 1UL << (8 + index);
+            }
+            pinConfig |= static_cast<uint32_t>(pull) << (16 + 2 * index);
+            return *this;
+        }
+
+        /**
+        * @brief Wake up when the RTC wakeup timer expires.
+        * @param wakeupDelay The delay before waking up.
+        * @return This object, so that more sources can be added.
+        */
+        WakeupSources& rtc(const RTCWakeupDelay wakeupDelay)
+        {
+            delay = wakeupDelay;
+            return *this;
+        }
+
+        /**
+        * @brief Wake up when the RTC calendar reaches the given time, using RTC Alarm A.
+        * The time must be less than 28 days ahead.
+        * @param rtcMilliseconds The time in milliseconds since the start of the RTC calendar, as from LowPower.rtcMilliseconds().
+        * @return This object, so that more sources can be added.
+        */
+        WakeupSources& rtcAlarm(const uint64_t rtcMilliseconds)
+        {
+            alarmTime = rtcMilliseconds;
+            return *this;
+        }
+
+        /**
+        * @brief Wake up from Stop Mode on an interrupt from a GPIO EXTI line, e.g. one set up with attachInterrupt().
+        * This source has no effect in Standby Mode, where only the wakeup pins work.
+        * @param line The EXTI line, which is the same as the pin number in the port (0-15).
+        * @return This object, so that more sources can be added.
+        */
+        WakeupSources& extiLine(const uint8_t line)
+        {
+            if (line < 16)
+            {
+                extiLines |= 1U << line;
+            }
+            return *this;
+        }
+
+    private:
+        RTCWakeupDelay delay;
+        uint64_t alarmTime = 0;
+        uint32_t pinConfig = 0;
+        uint16_t extiLines = 0;
+
+        friend class LowPowerNiclaVision;
+};
+
+/**
+ * @brief The WakeupInfo struct describes why and when the microcontroller woke up.
+ * It is captured once, early during startup and before setup() runs, and is
+ * available through LowPower.wakeupInfo(). The RTC times are counted in
+ * milliseconds since the start of the RTC calendar, with a resolution of 1/256
+ * second.
+*/
+struct WakeupInfo
+{
+    uint32_t resetFlags = 0;            ///< The reset flags from RCC_RSR, which stay set until cleared
+    uint32_t wakeupPinFlags = 0;        ///< The wakeup pin flags from PWR_WKUPFR, with bit 0 for WKUP1
+    bool rtcWakeupFlag = false;         ///< True if the RTC wakeup timer had expired
+    bool rtcAlarmFlag = false;          ///< True if RTC Alarm A had gone off
+    uint64_t rtcTime = 0;               ///< RTC time at capture, or 0 if the RTC wasn't running
+    uint64_t scheduledRTCTime = 0;      ///< RTC time the wakeup timer or alarm was due, or 0 if unknown
+    uint32_t cycles = 0;                ///< DWT cycle count at capture
+
+    /**
+    * @brief Check if the RTC wakeup timer woke the microcontroller up.
+    * @return Woken up by the RTC: true. Otherwise: false.
+    */
+    bool wokeUpByRTC() const
+    {
+        return rtcWakeupFlag;
+    }
+
+    /**
+    * @brief Check if RTC Alarm A woke the microcontroller up.
+    * @return Woken up by the RTC alarm: true. Otherwise: false.
+    */
+    bool wokeUpByRTCAlarm() const
+    {
+        return rtcAlarmFlag;
+    }
+
+    /**
+    * @brief Check if a wakeup pin woke the microcontroller up.
+    * @param pin The wakeup pin to check.
+    * @return Woken up by the pin: true. Otherwise: false.
+    */
+    bool wokeUpByPin(const WakeupPin pin) const
+    {
+        return wakeupPinFlags & (1UL << static_cast<uint32_t>(pin));
+    }
+
+    /**
+    * @brief Check if the NRST pin has reset the microcontroller since the reset flags were last cleared.
+    * @return Reset by NRST: true. Otherwise: false.
+    */
+    bool wasResetByNRST() const
+    {
+        return resetFlags & RCC_RSR_PINRSTF;
+    }
+
+    /**
+    * @brief Check if a watchdog has reset the microcontroller since the reset flags were last cleared.
+    * @return Reset by the independent or window watchdog: true. Otherwise: false.
+    */
+    bool wasResetByWatchdog() const
+    {
+        return resetFlags & (RCC_RSR_IWDG1RSTF | RCC_RSR_WWDG1RSTF);
+    }
+
+    /**
+    * @brief Check if the time from the RTC wakeup to the capture is known.
+    * @return Known: true. Otherwise: false.
+    */
+    bool hasWakeupLatency() const
+    {
+        return (rtcWakeupFlag || rtcAlarmFlag) && (0 != scheduledRTCTime) &&
+               (rtcTime >= scheduledRTCTime);
+    }
+
+    /**
+    * @brief Time from the RTC wakeup until this struct was captured.
+    * @return Number of milliseconds, or 0 if hasWakeupLatency() is false.
+    */
+    uint32_t wakeupLatency() const
+    {
+        return hasWakeupLatency() ? rtcTime - scheduledRTCTime : 0;
+    }
+
+    /**
+    * @brief Number of CPU cycles since this struct was captured.
+    * @return The number of cycles, as counted by the DWT cycle counter.
+    */
+    uint32_t cyclesSinceCapture() const
+    {
+        return DWT->CYCCNT - cycles;
+    }
+};
+
+/**
+ * @brief The StandbyTrace struct holds the time at each step of the last entry into Standby Mode.
+ * It is recorded in the backup SRAM while the trace is enabled with
+ * LowPower.enableStandbyTrace(), and read after waking up with
+ * LowPower.lastStandbyTrace().
+*/
+struct StandbyTrace
+{
+    /// The number of constants in the StandbyCheckpoint enum
+    static const size_t checkpoints = 10;
+
+    bool valid = false;                 ///< A trace was recorded: true. No trace: false.
+    uint32_t coreClock = 0;             ///< The CPU frequency in Hz, to convert cycles to time
+    uint32_t total = 0;                 ///< Cycles from the start of standbyM7() until entering Standby Mode
+    uint32_t cycles[checkpoints] = {};  ///< Cycles from the start of standbyM7() to each checkpoint, or 0 for a step that didn't run
+
+    /**
+    * @brief Cycles from the start of standbyM7() to a checkpoint.
+    * @param checkpoint The checkpoint.
+    * @return The number of cycles, or 0 if the step didn't run.
+    */
+    uint32_t at(const StandbyCheckpoint checkpoint) const
+    {
+        return cycles[static_cast<size_t>(checkpoint)];
+    }
+
+    /**
+    * @brief Cycles that a step took, since the checkpoint before it.
+    * @param checkpoint The checkpoint at the end of the step.
+    * @return The number of cycles, or 0 if the step didn't run.
+    */
+    uint32_t duration(const StandbyCheckpoint checkpoint) const
+    {
+        const size_t index = static_cast<size_t>(checkpoint);
+        if (0 == cycles[index])
+        {
+            return 0;
+        }
+        // The steps that didn't run in between are left out
+        size_t previous = index;
+        while ((previous > 0) && (0 == cycles[previous - 1]))
+        {
+            --previous;
+        }
+        return cycles[index] - ((previous > 0) ? cycles[previous - 1] : 0);
+    }
+};
+
+/**
+ * @brief The IdleCosts struct holds what idleFor() has learned about entering and leaving each mode.
+ * The costs are the time spent awake, at the current of the PerformanceLevel,
+ * rather than in the mode itself. They are kept in the backup SRAM.
+*/
+struct IdleCosts
+{
+    uint32_t stop = 0;              ///< Microseconds to enter and leave Stop Mode
+    uint32_t standby = 0;           ///< Microseconds to enter Standby Mode and boot again until the library starts
+    uint16_t stopSamples = 0;       ///< Number of times the Stop Mode cost has been measured
+    uint16_t standbySamples = 0;    ///< Number of times the Standby Mode cost has been measured
+};
+
+/**
+ * @brief The M4Residency struct tells how the M4 core has spent its time, as published by the M4 core in SRAM4.
+ * The M4 core publishes it with LowPower.publishM4Residency(), and either core
+ * reads it with LowPower.m4Residency(). The Mbed times cover the current boot of
+ * the M4 core, which starts over every time it wakes up from Standby Mode. All
+ * times are in microseconds.
+*/
+struct M4Residency
+{
+    bool valid = false;             ///< The M4 core has published its residency: true. Nothing published: false.
+    uint32_t boots = 0;             ///< Number of times the M4 core has started since SRAM4 was powered up
+    uint32_t standbyEntries = 0;    ///< Number of times the M4 core has entered Standby Mode
+    uint64_t uptime = 0;            ///< Time since the M4 core started
+    uint64_t idle = 0;              ///< Time the M4 core has spent idle in this boot
+    uint64_t sleep = 0;             ///< Time the M4 core has spent in Sleep Mode in this boot
+    uint64_t deepSleep = 0;         ///< Time the M4 core has spent in Deep Sleep Mode in this boot
+    uint64_t stop = 0;              ///< Time the M4 core has spent in stopM4() in this boot, if the RTC runs
+    uint64_t standby = 0;           ///< Time the M4 core has spent in Standby Mode in total, if the RTC runs
+};
+
+/**
+ * @brief The DeepSleepLockRecord struct describes one holder of Deep Sleep locks.
+ * It only covers locks taken through LowPower.lockDeepSleep(), not the locks
+ * that Mbed drivers take internally.
+*/
+struct DeepSleepLockRecord
+{
+    const char* holder = nullptr;   ///< The name passed to lockDeepSleep()
+    const void* caller = nullptr;   ///< The code address of the latest call to lockDeepSleep()
+    uint32_t acquisitions = 0;      ///< Number of times the lock has been taken
+    uint16_t held = 0;              ///< Number of locks held at the moment
+    uint64_t heldTime = 0;          ///< Total time the lock has been held, in microseconds, including right now
+    uint32_t contended = 0;         ///< Number of times the lock was taken while this holder already held one, e.g. from another thread
+    uint64_t longestHold = 0;       ///< Longest time the lock has been held without a break, in microseconds, including right now
+    uint32_t holdLimit = 0;         ///< Time in milliseconds after which a DeepSleepGuard of this holder counts as overdue, or 0 for no limit
+    bool overdue = false;           ///< The lock has been held for longer than holdLimit at the moment, e.g. because it leaked
+};
+
+/**
+ * @brief The DeepSleepLockTable class is a snapshot of all the holders of tracked Deep Sleep locks.
+ * It can be iterated over with a range-based for loop.
+*/
+class DeepSleepLockTable {
+    public:
+        /**
+         * @brief The maximum number of holders that can be tracked. Any
+         * further holders are counted together under the name "other".
+        */
+        static const size_t capacity = 16;
+
+        /**
+        * @brief Iterator to the first record.
+        * @return Pointer to the first record.
+        */
+        const DeepSleepLockRecord* begin() const
+        {
+            return records;
+        }
+
+        /**
+        * @brief Iterator past the last record.
+        * @return Pointer past the last record.
+        */
+        const DeepSleepLockRecord* end() const
+        {
+            return records + count;
+        }
+
+        /**
+        * @brief Number of holders in the table.
+        * @return The number of records.
+        */
+        size_t size() const
+        {
+            return count;
+        }
+
+        /**
+        * @brief Get one record.
+        * @param index The index of the record, which must be less than size().
+        * @return The record.
+        */
+        const DeepSleepLockRecord& operator[](const size_t index) const
+        {
+            return records[index];
+        }
+
+        /**
+        * @brief Number of tracked locks held at the moment, by all holders together.
+        * @return The number held.
         */
-        RTCWakeupDelay(const unsigned long long int delay) : value(delay)
+        uint32_t held() const
         {
+            uint32_t total = 0;
+            for (size_t i = 0; i < count; ++i)
+            {
+                total += records[i].held;
+            }
+            return total;
         }
 
-        friend RTCWakeupDelay operator""_s(const unsigned long long int seconds);
-        friend RTCWakeupDelay operator""_min(const unsigned long long int minutes);
-        friend RTCWakeupDelay operator""_h(const unsigned long long int hours);
-        friend RTCWakeupDelay operator+(const RTCWakeupDelay d1,
-                                        const RTCWakeupDelay d2);
+    private:
+        DeepSleepLockRecord records[capacity];
+        size_t count = 0;
 
         friend class LowPowerNiclaVision;
 };
 
+// Defined in EnergyEstimator.h, which needs the LowPowerNiclaVision class
+struct CurrentProfile;
+
 /**
  * @class LowPowerNiclaVision
  * @brief A class that provides low power functionality for the Nicla Vision board.
@@ -135,10 +847,76 @@ class RTCWakeupDelay {
  */
 class LowPowerNiclaVision {
     private:
-        LowPowerNiclaVision()    = default;
+        LowPowerNiclaVision();
         ~LowPowerNiclaVision()   = default;
 
+        WakeupInfo info;
+        // The clock setup from boot, which PerformanceLevel::max goes back to
+        uint32_t bootSysclkSource;
+        uint32_t bootPLL1Divider;
+        uint32_t bootVoltageScaling;
+
+
+        // Stop the wakeup timer that programRTCWakeup() has started
+        static void cancelRTCWakeup();
+        // Whether an RTC alarm time is far enough ahead, and not too far
+        static LowPowerReturnCode checkRTCAlarm(const uint64_t alarmTime);
+        LowPowerReturnCode configureRTCWakeup(const uint32_t wakeupClock,
+                                              const uint32_t autoReload,
+                                              const RTCSetup setup,
+                                              bool& rtcFastPath) const;
+        void configureWakeupPins(const uint32_t pinConfig) const;
+        static void clockReadyHandler();
+        void enableCycleCounter() const;
+        // The parts of the fast boot path that need the RTC and the backup
+        // registers, which can't use the LowPower object
+        static void* fastBootPersistent(const size_t size,
+                                        const uint16_t version);
+        static LowPowerReturnCode fastStandby(const uint32_t wakeupClock,
+                                              const uint32_t autoReload);
+        LowPowerReturnCode initializeRTC() const;
+        static bool isRTCConfigured();
+        // The tracked lock behind lockDeepSleep() and DeepSleepGuard, with
+        // the code address that took it, and a limit in milliseconds, or 0 to
+        // keep the limit as it is
+        void lockDeepSleepFrom(const char* const holder,
+                               const void* const caller,
+                               const uint32_t holdLimit) const;
+        void* persistentData(const size_t size,
+                             const uint16_t version,
+                             bool& fresh) const;
+        static uint64_t readRTCMilliseconds();
+        LowPowerReturnCode programRTCAlarm(const uint64_t alarmTime,
+                                           const bool keepEarlier,
+                                           const bool alarmB) const;
+        static void programRTCWakeup(const uint32_t wakeupClock,
+                                     const uint32_t autoReload);
+        void refineIdleCosts() const;
+        static LowPowerReturnCode restoreClocks(const uint32_t oscillators,
+                                                const uint32_t sysclkSource,
+                                                const uint32_t voltageScaling);
+        void retimeTickers(const uint32_t previousCoreClock) const;
+        void startClockRestore(const uint32_t oscillators,
+                               const uint32_t sysclkSource,
+                               const uint32_t voltageScaling,
+                               const uint32_t previousCoreClock) const;
+        LowPowerReturnCode standbyM4Sequence(const bool alarmWakeup) const;
+        // Only instantiated in the .cpp file, for each combination of steps
+        template <StandbySteps steps>
+        LowPowerReturnCode standbyM7Sequence(const WakeupSources& sources,
+                                             RTCSetup setup,
+                                             const void* const cleanStart,
+                                             const size_t cleanSize) const;
+        LowPowerReturnCode switchPerformanceLevel(const PerformanceLevel level) const;
         void waitForFlashReady() const;
+        static bool waitForRegister(const volatile uint32_t& reg,
+                                    const uint32_t mask,
+                                    const uint32_t value,
+                                    const uint32_t timeout);
+
+        friend class DeepSleepGuard;
+        friend class FastBoot;
+        friend class PowerMonitor;
 
     public:
         /// @cond DEV
@@ -160,20 +938,69 @@ class LowPowerNiclaVision {
 
         /// @endcond
 
+        /**
+         * @brief The number of bytes available to persistent().
+        */
+        static const size_t persistentCapacity = 1024;
+
         /**
         * @brief Make Deep Sleep possible in the default case.
+        * @param options The subsystems to turn off. Use LowPower.micros() for a timebase that keeps counting.
         */
-        void allowDeepSleep() const;
+        void allowDeepSleep(const DeepSleepOption options = DeepSleepOption::all) const;
         /**
         * @brief Check if Deep Sleep is possible or not at the moment.
         * @return Possible: true. Not possible: false.
         */
         bool canDeepSleep() const;
         /**
+        * @brief Check if Deep Sleep is possible or not at the moment, and find a tracked holder that has held its lock for longer than its limit.
+        * @param overdueHolder Set to the name of the first overdue holder, as in DeepSleepLockRecord::overdue, or nullptr if there is none.
+        * @return Possible: true. Not possible: false.
+        */
+        bool canDeepSleep(const char*& overdueHolder) const;
+        /**
         * @brief Check if the option bytes are correct to enter Standby Mode.
         * @return A constant from the LowPowerReturnCode enum.
         */
         LowPowerReturnCode checkOptionBytes() const;
+        /**
+        * @brief Check if the clocks are still being restored in the background after stopM7() with ClockRestore::background.
+        * Until then, the M7 core runs on HSI, and peripherals clocked from the PLLs may not run at their usual speed.
+        * @return Still on HSI: true. Restored: false.
+        */
+        bool clockRestorePending() const;
+        /**
+        * @brief Update the checksum of the data from persistent(), so that it's kept after the next reset.
+        * standbyM7() does this automatically.
+        */
+        void commitPersistent() const;
+        /**
+        * @brief Turn the subsystems that allowDeepSleep() turned off back on.
+        */
+        void disallowDeepSleep() const;
+        /**
+        * @brief Make the M4 core enter Standby Mode whenever the M7 core calls standbySystem().
+        * Call this on the M4 core instead of standbyM4().
+        */
+        void enableStandbyRequests() const;
+        /**
+        * @brief Record the time at each step of standbyM7() in the backup SRAM, for lastStandbyTrace() after waking up.
+        * The setting only lasts until the next reset, so call this again after waking up to keep tracing.
+        * @param enable Record: true. Don't record: false.
+        */
+        void enableStandbyTrace(const bool enable = true) const;
+        /**
+        * @brief Make sure that the option bytes are correct to enter Standby Mode, and prepare them if not, which resets the board.
+        * The result of a successful check is kept in an RTC backup register, together with the option byte word it was made for, so later calls after waking up from Standby Mode skip the check as long as the option bytes stay the same.
+        * @return A constant from the LowPowerReturnCode enum. Returns only if the option bytes are correct, or if preparing them failed.
+        */
+        LowPowerReturnCode ensureOptionBytes() const;
+        /**
+        * @brief Get a snapshot of the holders of Deep Sleep locks taken through lockDeepSleep().
+        * @return The table of holders.
+        */
+        DeepSleepLockTable deepSleepLocks() const;
         // -->
         // The deprecated attribute is used here because we only want this
         // warning to be shown if the user actually calls the function
@@ -186,34 +1013,310 @@ class LowPowerNiclaVision {
         uint16_t numberOfDeepSleepLocks() const;
         // <--
         /**
+        * @brief What idleFor() has learned so far about the cost of entering and leaving each mode.
+        * @return The costs.
+        */
+        IdleCosts idleCosts() const;
+        /**
+        * @brief Stay idle for a while in the power mode that uses the least charge for that long.
+        * Each mode is weighed by its current from the profile, with the time it takes to enter and leave it
+        * counted at the current while awake. These costs start from rough figures and are refined from
+        * measurements of each Stop Mode, and of the wakeup latency and the entry time after each Standby Mode.
+        * Sleep Mode is used when none of the other allowed modes pays off.
+        * @param duration How long to stay idle.
+        * @param allowed The modes to choose between. With IdleMode::standby, the sketch may start over instead of returning.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode idleFor(RTCWakeupDelay duration,
+                                   IdleMode allowed = IdleMode::sleep |
+                                                      IdleMode::stop) const;
+        /**
+        * @brief The mode that the last call to idleFor() chose, also after waking up from Standby Mode.
+        * @return The mode, or IdleMode::none if idleFor() hasn't been called.
+        */
+        IdleMode lastIdleMode() const;
+        /**
+        * @brief Number of CPU cycles the last call to standbyM7() spent before entering Standby Mode.
+        * @return The number of cycles, as counted by the DWT cycle counter.
+        */
+        uint32_t lastStandbyEntryCycles() const;
+        /**
+        * @brief Number of CPU cycles the last call to standbySystem() waited for the M4 core to enter Standby Mode.
+        * @return The number of cycles, as counted by the DWT cycle counter.
+        */
+        uint32_t lastStandbyHandshakeCycles() const;
+        /**
+        * @brief The time at each step of the last traced entry into Standby Mode.
+        * @return The trace, which is not valid if there is none.
+        */
+        StandbyTrace lastStandbyTrace() const;
+        /**
+        * @brief Check if the last call to standbyM7() reused an already configured RTC.
+        * @return Reused: true. Set up from scratch, or no RTC wakeup: false.
+        */
+        bool lastStandbyUsedRTCFastPath() const;
+        /**
+        * @brief Time the last call to stopM7() spent awake, entering Stop Mode and restoring the clocks after waking up.
+        * @return Number of microseconds, as counted by the DWT cycle counter at the clock of each part.
+        */
+        uint32_t lastStopOverhead() const;
+        /**
+        * @brief Take a Deep Sleep lock, and record who holds it.
+        * @param holder A name for the holder, e.g. the name of a driver. Pass the same string to unlockDeepSleep(). The string must stay valid, so a string literal is best.
+        */
+        void lockDeepSleep(const char* const holder) const;
+        /**
+        * @brief Read the residency that the M4 core last published in SRAM4, from either core.
+        * @return The residency, with valid set to false if the M4 core hasn't published anything since SRAM4 was powered up.
+        */
+        M4Residency m4Residency() const;
+        /**
+        * @brief Time since boot, counted by the low power ticker, so that it keeps counting in Deep Sleep Mode.
+        * @return Number of microseconds, with a resolution of about 31 microseconds.
+        */
+        uint64_t micros() const;
+        /**
+        * @brief Keep the core out of Deep Sleep for a while, with a tracked lock that releases itself.
+        * A call while an earlier one is still running only makes the time longer, never shorter.
+        * The lock is held by "noDeepSleepFor" in deepSleepLocks(). Can be called from interrupts.
+        * @param duration How long Deep Sleep stays locked.
+        */
+        void noDeepSleepFor(const RTCWakeupDelay duration) const;
+        /**
+        * @brief Get data that is kept in the backup SRAM through resets and Standby Mode.
+        * The data is only kept if its checksum is correct, which standbyM7() and
+        * commitPersistent() make sure of. Otherwise, or if the size or the version
+        * differs from before, the data is created again with its default constructor.
+        * @tparam T The type of the data, which must be trivially copyable.
+        * @param version A number that should be changed whenever the layout of T changes.
+        * @return A reference to the data.
+        */
+        template <typename T>
+        T& persistent(const uint16_t version = 0) const
+        {
+            static_assert(std::is_trivially_copyable<T>::value,
+                          "Persistent data must be trivially copyable");
+            static_assert(sizeof(T) <= persistentCapacity,
+                          "Persistent data must fit in persistentCapacity");
+            static_assert(alignof(T) <= 8,
+                          "Persistent data must not need more than 8 byte alignment");
+
+            bool fresh = false;
+            void* const data = persistentData(sizeof(T), version, fresh);
+            if (fresh)
+            {
+                return *new (data) T();
+            }
+            return *static_cast<T*>(data);
+        }
+        /**
+        * @brief Check if the last call to persistent() found the data from before the reset.
+        * @return Kept: true. Created again: false.
+        */
+        bool persistentRestored() const;
+        /**
         * @brief Prepare the option bytes for entry into Standby Mode.
         * @return A constant from the LowPowerReturnCode enum.
         */
         LowPowerReturnCode prepareOptionBytes() const;
         /**
+        * @brief Publish how the M4 core has spent its time in SRAM4, for m4Residency() on the M7 core.
+        * Call this on the M4 core, e.g. periodically from its loop(). stopM4() and standbyM4() do this automatically.
+        */
+        void publishM4Residency() const;
+        /**
+        * @brief Make the M7 core and D2 domain enter standby mode as soon as the flash controller is done with any ongoing operation.
+        * Contrary to standbyM7(), interrupts stay enabled and the core sleeps while it waits for the end of the operation.
+        * @param delay The delay before waking up again.
+        * @param setup How to prepare the RTC before programming the wakeup timer.
+        * @param timeout The longest time to wait for the flash controller, in milliseconds.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode requestStandby(RTCWakeupDelay delay
+                                            = RTCWakeupDelay::infinite,
+                                          RTCSetup setup
+                                            = RTCSetup::reuseIfConfigured,
+                                          const uint32_t timeout = 2000) const;
+        /**
+        * @brief Make the M7 core and D2 domain enter standby mode as soon as the flash controller is done with any ongoing operation.
+        * Contrary to standbyM7(), interrupts stay enabled and the core sleeps while it waits for the end of the operation.
+        * @param sources The wakeup pins and RTC delay that wake the microcontroller up again.
+        * @param setup How to prepare the RTC before programming the wakeup timer.
+        * @param timeout The longest time to wait for the flash controller, in milliseconds.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode requestStandby(const WakeupSources& sources,
+                                          RTCSetup setup
+                                            = RTCSetup::reuseIfConfigured,
+                                          const uint32_t timeout = 2000) const;
+        /**
         * @brief Reset the flags behind the wasInCPUMode() function.
         */
         void resetPreviousCPUModeFlags() const;
         /**
+        * @brief The current RTC time, which is kept through Standby Mode. The RTC is set up first if it isn't running.
+        * @return Milliseconds since the start of the RTC calendar, with a resolution of 1/256 second.
+        */
+        uint64_t rtcMilliseconds() const;
+        /**
+        * @brief Set the currents that idleFor() weighs the modes by, e.g. the same as for an EnergyEstimator.
+        * @param profile The currents.
+        */
+        void setIdleProfile(const CurrentProfile& profile) const;
+        /**
+        * @brief Change the CPU frequency and voltage scaling of the M7 core, to save power while awake.
+        * SysTick and the Mbed microsecond ticker are adjusted to the new frequency.
+        * @param level The new performance level.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode setPerformanceLevel(const PerformanceLevel level) const;
+        /**
         * @brief Make the M4 core and domain D2 enter standby mode.
         * @return A constant from the LowPowerReturnCode enum.
         */
         LowPowerReturnCode standbyM4() const;
+        /**
+        * @brief Make the M4 core and domain D2 enter standby mode, and wake the M4 core up again after a delay.
+        * The M4 core uses RTC Alarm B, so that the M7 core keeps the wakeup timer and Alarm A.
+        * It also wakes up if the M7 core's Alarm A goes off first, since both alarms share an EXTI line.
+        * @param delay The delay before waking up, which must be less than 28 days.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode standbyM4(RTCWakeupDelay delay) const;
         // -->
         /**
         * @brief Make the M7 core and D2 domain enter standby mode, and make it possible for the D3 domain to do so.
         * @param delay The delay before waking up again.
+        * @param setup How to prepare the RTC before programming the wakeup timer.
         * @return A constant from the LowPowerReturnCode enum.
         */
         LowPowerReturnCode standbyM7(RTCWakeupDelay delay
-                                        = RTCWakeupDelay::infinite) const;
+                                        = RTCWakeupDelay::infinite,
+                                     RTCSetup setup
+                                        = RTCSetup::reuseIfConfigured) const;
         // <--
         /**
+        * @brief Make the M7 core and D2 domain enter standby mode, and make it possible for the D3 domain to do so.
+        * @param sources The wakeup pins and RTC delay that wake the microcontroller up again.
+        * @param setup How to prepare the RTC before programming the wakeup timer.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode standbyM7(const WakeupSources& sources,
+                                     RTCSetup setup
+                                        = RTCSetup::reuseIfConfigured) const;
+        /**
+        * @brief Make the M7 core and D2 domain enter standby mode, with only the given optional steps.
+        * Without StandbySteps::cleanCache, only the given range and the backup SRAM are cleaned.
+        * @tparam steps The optional steps to take, e.g. StandbySteps::resetBuses.
+        * @param delay The delay before waking up again.
+        * @param setup How to prepare the RTC before programming the wakeup timer.
+        * @param cleanStart The start of the range in the D-cache to clean, or nullptr for none.
+        * @param cleanSize The size of the range in bytes.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        template <StandbySteps steps>
+        LowPowerReturnCode standbyM7(RTCWakeupDelay delay
+                                        = RTCWakeupDelay::infinite,
+                                     RTCSetup setup
+                                        = RTCSetup::reuseIfConfigured,
+                                     const void* const cleanStart = nullptr,
+                                     const size_t cleanSize = 0) const
+        {
+            static_assert(0 == (static_cast<uint32_t>(steps) &
+                                ~static_cast<uint32_t>(StandbySteps::all)),
+                          "Only the steps in StandbySteps can be combined");
+            return standbyM7Sequence<steps>(WakeupSources().rtc(delay), setup,
+                                            cleanStart, cleanSize);
+        }
+        /**
+        * @brief Make the M7 core and D2 domain enter standby mode, with only the given optional steps.
+        * Without StandbySteps::cleanCache, only the given range and the backup SRAM are cleaned.
+        * @tparam steps The optional steps to take, e.g. StandbySteps::resetBuses.
+        * @param sources The wakeup pins and RTC delay that wake the microcontroller up again.
+        * @param setup How to prepare the RTC before programming the wakeup timer.
+        * @param cleanStart The start of the range in the D-cache to clean, or nullptr for none.
+        * @param cleanSize The size of the range in bytes.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        template <StandbySteps steps>
+        LowPowerReturnCode standbyM7(const WakeupSources& sources,
+                                     RTCSetup setup
+                                        = RTCSetup::reuseIfConfigured,
+                                     const void* const cleanStart = nullptr,
+                                     const size_t cleanSize = 0) const
+        {
+            static_assert(0 == (static_cast<uint32_t>(steps) &
+                                ~static_cast<uint32_t>(StandbySteps::all)),
+                          "Only the steps in StandbySteps can be combined");
+            return standbyM7Sequence<steps>(sources, setup,
+                                            cleanStart, cleanSize);
+        }
+        /**
+        * @brief Make the whole microcontroller enter Standby Mode from the M7 core.
+        * The M4 core is told to enter Standby Mode first, and must have called enableStandbyRequests().
+        * If the M4 core is running, the flags from wasInCPUMode() are cleared first, as with resetPreviousCPUModeFlags().
+        * @param delay The delay before waking up again.
+        * @param setup How to prepare the RTC before programming the wakeup timer.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode standbySystem(RTCWakeupDelay delay
+                                            = RTCWakeupDelay::infinite,
+                                         RTCSetup setup
+                                            = RTCSetup::reuseIfConfigured) const;
+        /**
+        * @brief Make the whole microcontroller enter Standby Mode from the M7 core.
+        * The M4 core is told to enter Standby Mode first, and must have called enableStandbyRequests().
+        * If the M4 core is running, the flags from wasInCPUMode() are cleared first, as with resetPreviousCPUModeFlags().
+        * @param sources The wakeup pins and RTC delay that wake the microcontroller up again.
+        * @param setup How to prepare the RTC before programming the wakeup timer.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode standbySystem(const WakeupSources& sources,
+                                         RTCSetup setup
+                                            = RTCSetup::reuseIfConfigured) const;
+        /**
+        * @brief Make the M4 core and D2 domain enter Stop Mode until one of the M4 core's enabled interrupts occurs.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode stopM4() const;
+        // -->
+        /**
+        * @brief Make the M7 core and D1 domain enter Stop Mode, and make it possible for the D3 domain to do so. SRAM and peripheral state are kept, and the clocks are restored after waking up.
+        * @param delay The delay before waking up again.
+        * @param setup How to prepare the RTC before programming the wakeup timer.
+        * @param restore Whether to wait for the clocks after waking up, or to restore them in the background.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode stopM7(RTCWakeupDelay delay,
+                                  RTCSetup setup
+                                    = RTCSetup::reuseIfConfigured,
+                                  ClockRestore restore
+                                    = ClockRestore::wait) const;
+        // <--
+        /**
+        * @brief Make the M7 core and D1 domain enter Stop Mode, and make it possible for the D3 domain to do so. SRAM and peripheral state are kept, and the clocks are restored after waking up.
+        * @param sources The wakeup pins, EXTI lines, and RTC delay that wake the M7 core up again.
+        * @param setup How to prepare the RTC before programming the wakeup timer.
+        * @param restore Whether to wait for the clocks after waking up, or to restore them in the background.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode stopM7(const WakeupSources& sources,
+                                  RTCSetup setup
+                                    = RTCSetup::reuseIfConfigured,
+                                  ClockRestore restore
+                                    = ClockRestore::wait) const;
+        /**
         * @brief Time since the board was booted.
         * @return Number of microseconds.
         */
         uint64_t timeSinceBoot() const;
         /**
+        * @brief Time spent awake at a performance level, as set with setPerformanceLevel().
+        * @param level The performance level.
+        * @return Number of microseconds.
+        */
+        uint64_t timeSpentAtPerformanceLevel(const PerformanceLevel level) const;
+        /**
         * @brief Time spent in idle.
         * @return Number of microseconds.
         */
@@ -228,6 +1331,17 @@ class LowPowerNiclaVision {
         * @return Number of microseconds.
         */
         uint64_t timeSpentInDeepSleep() const;
+        /**
+        * @brief Time spent in Stop Mode through stopM7().
+        * Only Stop Mode with the RTC running is counted. Mbed counts this time as awake.
+        * @return Number of microseconds.
+        */
+        uint64_t timeSpentInStop() const;
+        /**
+        * @brief Release a Deep Sleep lock taken with lockDeepSleep().
+        * @param holder The same name as passed to lockDeepSleep().
+        */
+        void unlockDeepSleep(const char* const holder) const;
         /**
          * Checks if the microcontroller was in the given CPU mode before starting.
          * Note: It's possible that the microcontroller was in more than one of these modes
@@ -238,6 +1352,11 @@ class LowPowerNiclaVision {
          * @return True if the microcontroller was in the given mode, false otherwise.
          */
         bool wasInCPUMode(CPUMode mode) const;
+        /**
+        * @brief Information about why and when the microcontroller woke up, captured once before setup().
+        * @return The wakeup information.
+        */
+        const WakeupInfo& wakeupInfo() const;
 };
 
 /*
@@ -251,6 +1370,17 @@ class LowPowerNiclaVision {
  */
 extern const LowPowerNiclaVision& LowPower;
 
+/**
+ * @brief Take a tracked Deep Sleep lock with the current source file as the
+ * holder, in the same way as Mbed's sleep tracing.
+*/
+#define LOWPOWER_LOCK_DEEP_SLEEP()      LowPower.lockDeepSleep(__FILE__)
+
+/**
+ * @brief Release a tracked Deep Sleep lock taken with LOWPOWER_LOCK_DEEP_SLEEP().
+*/
+#define LOWPOWER_UNLOCK_DEEP_SLEEP()    LowPower.unlockDeepSleep(__FILE__)
+
 /*
 ********************************************************************************
 *                           Overloaded operators
@@ -258,32 +1388,103 @@ extern const LowPowerNiclaVision& LowPower;
 */
 
 /**
- * @brief Literals operator to add multiple delays together. e.g. 5_s + 10_min + 2_h
+ * @brief Operator to combine options for allowDeepSleep(). e.g. DeepSleepOption::usb | DeepSleepOption::microsTimer
+ * @param o1 The first option.
+ * @param o2 The second option.
+ * @return The combination of the two options.
+*/
+DeepSleepOption operator|(const DeepSleepOption o1, const DeepSleepOption o2);
+
+/**
+ * @brief Literals operator to add multiple delays together. e.g. 250_ms + 5_s + 10_min + 2_h
+ * The sum saturates instead of overflowing, and stays infinite if one of the delays is.
  * @param d1 The first delay.
  * @param d2 The second delay.
  * @return The sum of the two delays.
 */
-RTCWakeupDelay operator+(const RTCWakeupDelay d1, const RTCWakeupDelay d2);
+constexpr RTCWakeupDelay operator+(const RTCWakeupDelay d1,
+                                   const RTCWakeupDelay d2)
+{
+    return ((RTCWakeupDelay::infinite == d1.value) ||
+            (RTCWakeupDelay::infinite == d2.value)) ?
+           RTCWakeupDelay(RTCWakeupDelay::infinite) :
+           RTCWakeupDelay(RTCWakeupDelay::add(d1.value, d2.value));
+}
+
+/**
+ * @brief Literals operator to create a delay in milliseconds.
+ * A literal that doesn't fit in the delay fails to compile.
+ * @tparam digits The characters of the literal, e.g. 500 for 500_ms.
+ * @return The delay object.
+*/
+template <char... digits>
+constexpr RTCWakeupDelay operator""_ms()
+{
+    static_assert(RTCWakeupDelay::literalValue<1, digits...>() !=
+                  RTCWakeupDelay::saturated,
+                  "The delay must be a whole number that fits in 64 bits");
+    return RTCWakeupDelay(RTCWakeupDelay::literalValue<1, digits...>());
+}
 
 /**
  * @brief Literals operator to create a delay in seconds.
- * @param seconds The number of seconds to wait before waking up.
+ * A literal that doesn't fit in the delay fails to compile.
+ * @tparam digits The characters of the literal, e.g. 10 for 10_s.
  * @return The delay object.
 */
-RTCWakeupDelay operator""_s(const unsigned long long int seconds);
+template <char... digits>
+constexpr RTCWakeupDelay operator""_s()
+{
+    static_assert(RTCWakeupDelay::literalValue<1000, digits...>() !=
+                  RTCWakeupDelay::saturated,
+                  "The delay must be a whole number that fits in 64 bits");
+    return RTCWakeupDelay(RTCWakeupDelay::literalValue<1000, digits...>());
+}
 
 /**
  * @brief Literals operator to create a delay in minutes.
- * @param minutes The number of minutes to wait before waking up.
+ * A literal that doesn't fit in the delay fails to compile.
+ * @tparam digits The characters of the literal, e.g. 5 for 5_min.
  * @return The delay object.
 */
-RTCWakeupDelay operator""_min(const unsigned long long int minutes);
+template <char... digits>
+constexpr RTCWakeupDelay operator""_min()
+{
+    static_assert(RTCWakeupDelay::literalValue<60 * 1000, digits...>() !=
+                  RTCWakeupDelay::saturated,
+                  "The delay must be a whole number that fits in 64 bits");
+    return RTCWakeupDelay(RTCWakeupDelay::literalValue<60 * 1000, digits...>());
+}
 
 /**
  * @brief Literals operator to create a delay in hours.
- * @param hours The number of hours to wait before waking up.
+ * A literal that doesn't fit in the delay fails to compile.
+ * @tparam digits The characters of the literal, e.g. 2 for 2_h.
  * @return The delay object.
 */
-RTCWakeupDelay operator""_h(const unsigned long long int hours);
+template <char... digits>
+constexpr RTCWakeupDelay operator""_h()
+{
+    static_assert(RTCWakeupDelay::literalValue<60 * 60 * 1000, digits...>() !=
+                  RTCWakeupDelay::saturated,
+                  "The delay must be a whole number that fits in 64 bits");
+    return RTCWakeupDelay(RTCWakeupDelay::literalValue<60 * 60 * 1000, digits...>());
+}
+
+/*
+********************************************************************************
+*                       Classes built on the ones above
+********************************************************************************
+*/
+
+#include "D3Batch.h"
+#include "DeepSleepGuard.h"
+#include "EnergyEstimator.h"
+#include "FastBoot.h"
+#include "FrameCapture.h"
+#include "LowPowerLog.h"
+#include "PowerDomains.h"
+#include "PowerMonitor.h"
+#include "WakeupScheduler.h"
 
 #endif  // End of header guard
@@ -0,0 +1,69 @@
+/*
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         The layout of the backup SRAM, which keeps its contents through
+*         Standby Mode, as used internally by the library
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "BackupSRAM.h"
+
+/*
+********************************************************************************
+*                                Functions
+********************************************************************************
+*/
+
+BackupSRAMLayout& backupSRAM()
+{
+    static bool enabled = false;
+
+    if (!enabled)
+    {
+        // The backup SRAM is in the backup domain, which is write protected.
+        // Its contents are only kept in Standby Mode while the backup
+        // regulator is on.
+        HAL_PWR_EnableBkUpAccess();
+        __HAL_RCC_BKPRAM_CLK_ENABLE();
+        HAL_PWREx_EnableBkUpReg();
+        enabled = true;
+    }
+
+    return *reinterpret_cast<BackupSRAMLayout*>(D3_BKPSRAM_BASE);
+}
+
+uint32_t backupSRAMChecksum(const void* const data, const size_t size)
+{
+    // The reflected CRC-32 polynomial, one bit at a time. This is fast enough
+    // for the small parts of the backup SRAM, and doesn't need the CRC
+    // peripheral, which standbyM7() resets.
+    const uint8_t* const bytes = static_cast<const uint8_t*>(data);
+    uint32_t crc = 0xffffffff;
+
+    for (size_t i = 0; i < size; ++i)
+    {
+        crc ^= bytes[i];
+        for (auto bit = 0; bit < 8; ++bit)
+        {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+
+    return ~crc;
+}
@@ -0,0 +1,166 @@
+/**
+* @file
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         The layout of the backup SRAM, which keeps its contents through
+*         Standby Mode, as used internally by the library
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+#ifndef BackupSRAM_H
+#define BackupSRAM_H
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+#include "EnergyEstimator.h"
+#include "LowPowerLog.h"
+#include "PowerMonitor.h"
+#include "WakeupScheduler.h"
+
+/*
+********************************************************************************
+*                                 Classes
+********************************************************************************
+*/
+
+/// @cond DEV
+
+// The contents of the backup SRAM are random after power-on, so every part
+// starts with a magic number that tells if it has been initialized.
+struct BackupSRAMLayout
+{
+    struct
+    {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t size;
+        uint32_t checksum;
+        alignas(8) uint8_t data[LowPowerNiclaVision::persistentCapacity];
+    } persistent;
+
+    struct
+    {
+        uint32_t magic;
+        uint16_t head;
+        uint16_t count;
+        uint16_t boot;
+        PowerSnapshot previous;
+        PowerProfiler::Interval intervals[PowerProfiler::capacity];
+    } profiler;
+
+    struct SchedulerJob
+    {
+        char name[WakeupScheduler::nameLength + 1];
+        uint32_t period;                // In milliseconds, or 0 for a free slot
+        uint32_t tolerance;             // In milliseconds
+        uint64_t epoch;                 // RTC time of the first run
+        uint64_t next;                  // RTC time of the next run
+    };
+
+    struct
+    {
+        uint32_t magic;
+        uint32_t runs;
+        uint32_t wakeups;
+        uint32_t runsThisWakeup;
+        SchedulerJob jobs[WakeupScheduler::capacity];
+    } scheduler;
+
+    struct
+    {
+        uint32_t magic;
+        uint64_t standbyStart;          // RTC time of entering Standby Mode, or 0
+        Residency previous;             // The times of the boots before this one
+    } energy;
+
+    struct
+    {
+        uint32_t magic;
+        uint32_t coreClock;
+        uint32_t total;
+        uint32_t cycles[StandbyTrace::checkpoints];
+    } standbyTrace;
+
+    struct
+    {
+        uint32_t magic;
+        uint32_t request;               // The DMAMUX2 request of the peripheral
+        uint32_t source;                // The address of the data register
+        uint32_t batchSize;             // In bytes
+        uint32_t readIndex;             // The next byte for read()
+    } d3Batch;
+
+    struct
+    {
+        uint32_t magic;
+        uint32_t stopCost;              // In microseconds
+        uint32_t standbyCost;           // In microseconds
+        uint16_t stopSamples;
+        uint16_t standbySamples;
+        uint8_t lastMode;               // An IdleMode
+        bool standbyPending;            // Measure the standby cost after waking up
+    } idleGovernor;
+
+    struct
+    {
+        uint32_t magic;
+        volatile uint32_t head;         // Bytes logged, counting up
+        volatile uint32_t tail;         // Bytes written to the output
+        uint32_t dropped;
+        uint8_t data[LowPowerLog::capacity];
+    } lowPowerLog;
+
+    struct
+    {
+        uint32_t magic;
+        uint32_t wakeups;               // Through the fast path since arm()
+        uint16_t autoReload;
+        uint8_t wakeupClock;            // As in RTCWakeupDelay
+    } fastBoot;
+
+    struct
+    {
+        uint32_t magic;
+        uint32_t calibration;           // CALFACT of ADC3, if calibrated
+        bool calibrated;
+        uint16_t head;                  // Where the next reading goes
+        uint16_t count;
+        PowerReading readings[PowerMonitor::capacity];
+    } powerMonitor;
+};
+
+static_assert(sizeof(BackupSRAMLayout) <= 4096,
+              "The backup SRAM is only 4 KB");
+
+/**
+ * @brief Enable access to the backup SRAM and its retention in Standby Mode.
+ * @return The contents of the backup SRAM.
+*/
+BackupSRAMLayout& backupSRAM();
+
+/**
+ * @brief Calculate the CRC-32 of a part of the backup SRAM.
+ * @param data The start of the part.
+ * @param size The size of the part in bytes.
+ * @return The CRC-32.
+*/
+uint32_t backupSRAMChecksum(const void* const data, const size_t size);
+
+/// @endcond
+
+#endif  // End of header guard
@@ -0,0 +1,228 @@
+/*
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         Collection of data into SRAM4 by the BDMA in the D3 domain,
+*         while the M7 core is in Standby Mode
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "D3Batch.h"
+#include "BackupSRAM.h"
+
+/*
+********************************************************************************
+*                      Variables shared by all objects
+********************************************************************************
+*/
+
+// The buffer takes the upper half of SRAM4, below the M4 residency block at
+// the end. The RPC library keeps its buffers at the start of SRAM4, and the
+// BDMA can only reach SRAM4 and the backup SRAM.
+static uint8_t* const BATCH_BUFFER = reinterpret_cast<uint8_t*>(0x38008000);
+
+static const uint32_t D3_BATCH_MAGIC = 0x44334231;        // "D3B1"
+
+// The BDMA channel, and its DMAMUX2 channel, that Mbed doesn't use. Its
+// interrupt line is EXTI line 73, which is bit 9 in IMR3.
+#define BATCH_CHANNEL           BDMA_Channel7
+#define BATCH_MUX_CHANNEL       DMAMUX2_Channel7
+static const uint32_t BATCH_ALL_FLAGS = BDMA_IFCR_CGIF7 | BDMA_IFCR_CTCIF7 |
+                                        BDMA_IFCR_CHTIF7 | BDMA_IFCR_CTEIF7;
+static const uint32_t BATCH_EXTI_IMR3 = 1 << 9;
+
+/*
+********************************************************************************
+*                             Helper functions
+********************************************************************************
+*/
+
+// The bytes between the end of the last read() and where the BDMA writes next
+static size_t collected(const uint32_t batchSize, const uint32_t readIndex)
+{
+    const uint32_t bufferSize = 2 * batchSize;
+    const uint32_t writeIndex = (bufferSize - BATCH_CHANNEL->CNDTR) % bufferSize;
+    return (writeIndex + bufferSize - readIndex) % bufferSize;
+}
+
+/*
+********************************************************************************
+*                             Member functions
+********************************************************************************
+*/
+
+size_t D3Batch::available() const
+{
+    if (!isRunning())
+    {
+        return 0;
+    }
+    const auto& state = backupSRAM().d3Batch;
+    return collected(state.batchSize, state.readIndex);
+}
+
+bool D3Batch::batchReady() const
+{
+    return isRunning() && (available() >= backupSRAM().d3Batch.batchSize);
+}
+
+LowPowerReturnCode D3Batch::begin(const uint8_t request,
+                                  const volatile void* const source,
+                                  const size_t batchSize)
+{
+    if ((0 == batchSize) || (batchSize > maxBatchSize))
+    {
+        return LowPowerReturnCode::invalidBatchSize;
+    }
+
+    // The BDMA and SRAM4 keep going while the M7 core is in Standby Mode, so
+    // after waking up, the batching only has to be picked up again
+    auto& state = backupSRAM().d3Batch;
+    const uint32_t sourceAddress = reinterpret_cast<uint32_t>(source);
+    if (isRunning() && (D3_BATCH_MAGIC == state.magic) &&
+        (request == state.request) && (sourceAddress == state.source) &&
+        (batchSize == state.batchSize))
+    {
+        return LowPowerReturnCode::success;
+    }
+
+    BATCH_CHANNEL->CCR &= ~BDMA_CCR_EN;
+    while (BATCH_CHANNEL->CCR & BDMA_CCR_EN)
+        ;
+
+    // Keep the clocks of the BDMA and SRAM4 running without the CPUs
+    __HAL_RCC_BDMA_CLK_ENABLE();
+    __HAL_RCC_BDMA_CLKAM_ENABLE();
+    __HAL_RCC_D3SRAM1_CLKAM_ENABLE();
+
+    BATCH_MUX_CHANNEL->CCR = request;
+    BDMA->IFCR = BATCH_ALL_FLAGS;
+    BATCH_CHANNEL->CPAR = sourceAddress;
+    BATCH_CHANNEL->CM0AR = reinterpret_cast<uint32_t>(BATCH_BUFFER);
+    BATCH_CHANNEL->CNDTR = 2 * batchSize;
+    // Bytes from the peripheral into a circular buffer of two batches, with
+    // an interrupt as each half fills up
+    BATCH_CHANNEL->CCR = BDMA_CCR_PL_1 | BDMA_CCR_MINC | BDMA_CCR_CIRC |
+                         BDMA_CCR_HTIE | BDMA_CCR_TCIE;
+
+    state.magic = D3_BATCH_MAGIC;
+    state.request = request;
+    state.source = sourceAddress;
+    state.batchSize = batchSize;
+    state.readIndex = 0;
+
+    BATCH_CHANNEL->CCR |= BDMA_CCR_EN;
+
+    return LowPowerReturnCode::success;
+}
+
+LowPowerReturnCode D3Batch::beginLPUART1(const size_t batchSize)
+{
+    __HAL_RCC_LPUART1_CLKAM_ENABLE();
+    LPUART1->CR3 |= USART_CR3_DMAR;
+    return begin(BDMA_REQUEST_LPUART1_RX, &LPUART1->RDR, batchSize);
+}
+
+void D3Batch::end()
+{
+    auto& state = backupSRAM().d3Batch;
+
+    BATCH_CHANNEL->CCR &= ~BDMA_CCR_EN;
+    while (BATCH_CHANNEL->CCR & BDMA_CCR_EN)
+        ;
+    BDMA->IFCR = BATCH_ALL_FLAGS;
+    BATCH_MUX_CHANNEL->CCR = 0;
+
+    if ((D3_BATCH_MAGIC == state.magic) &&
+        (BDMA_REQUEST_LPUART1_RX == state.request))
+    {
+        LPUART1->CR3 &= ~USART_CR3_DMAR;
+        __HAL_RCC_LPUART1_CLKAM_DISABLE();
+    }
+    __HAL_RCC_BDMA_CLKAM_DISABLE();
+    __HAL_RCC_D3SRAM1_CLKAM_DISABLE();
+    HAL_PWREx_ConfigD3Domain(PWR_D3_DOMAIN_STOP);
+
+    state.magic = 0;
+}
+
+bool D3Batch::isRunning() const
+{
+    return 0 != (BATCH_CHANNEL->CCR & BDMA_CCR_EN);
+}
+
+bool D3Batch::prepareStandby()
+{
+    if (!D3Batch().isRunning())
+    {
+        return false;
+    }
+
+    // A half that was filled before the last read() mustn't wake the M7 core
+    // up again right away. If a whole batch is left, the flags are kept, so
+    // that the M7 core wakes up to read it.
+    const auto& state = backupSRAM().d3Batch;
+    if (collected(state.batchSize, state.readIndex) < state.batchSize)
+    {
+        BDMA->IFCR = BATCH_ALL_FLAGS;
+    }
+
+    // The BDMA interrupt is a direct EXTI line, which wakes the D1 domain up
+    // from Standby Mode as long as the D3 domain keeps running
+    HAL_PWREx_ConfigD3Domain(PWR_D3_DOMAIN_RUN);
+    EXTI->IMR3 |= BATCH_EXTI_IMR3;
+
+    return true;
+}
+
+size_t D3Batch::read(uint8_t* const data, const size_t size)
+{
+    if (!isRunning())
+    {
+        return 0;
+    }
+
+    auto& state = backupSRAM().d3Batch;
+    const uint32_t bufferSize = 2 * state.batchSize;
+    const size_t waiting = collected(state.batchSize, state.readIndex);
+    const size_t count = (size < waiting) ? size : waiting;
+
+    for (size_t copied = 0; copied < count; )
+    {
+        // Up to the end of the buffer at a time
+        const size_t toEnd = bufferSize - state.readIndex;
+        const size_t part = (count - copied < toEnd) ? count - copied : toEnd;
+        uint8_t* const start = BATCH_BUFFER + state.readIndex;
+#if defined CORE_CM7
+        // The BDMA writes to SRAM4 behind the back of the D-cache. The buffer
+        // starts on a cache line, and the M7 core never writes to it.
+        const uint32_t lineSize = 32;
+        const uint32_t lineStart = reinterpret_cast<uint32_t>(start) &
+                                   ~(lineSize - 1);
+        SCB_InvalidateDCache_by_Addr(
+            reinterpret_cast<uint32_t*>(lineStart),
+            static_cast<int32_t>(reinterpret_cast<uint32_t>(start) + part -
+                                 lineStart));
+#endif
+        memcpy(data + copied, start, part);
+        copied += part;
+        state.readIndex = (state.readIndex + part) % bufferSize;
+    }
+
+    return count;
+}
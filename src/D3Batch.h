@@ -0,0 +1,113 @@
+/**
+* @file
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         Collection of data into SRAM4 by the BDMA in the D3 domain,
+*         while the M7 core is in Standby Mode
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+#ifndef D3Batch_H
+#define D3Batch_H
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+/*
+********************************************************************************
+*                                 Classes
+********************************************************************************
+*/
+
+/**
+ * @class D3Batch
+ * @brief A class that keeps the D3 domain running while the M7 core is in Standby Mode, so that the BDMA collects data from a D3 peripheral into SRAM4.
+ *
+ * The BDMA fills a circular buffer of two batches in SRAM4, and standbyM7()
+ * wakes the M7 core up each time one of the two halves has been filled,
+ * instead of for each sample. The M7 core restarts from the beginning when it
+ * wakes up, and begin() with the same settings then continues with the data
+ * collected so far, so that read() gets all of it. The sketch sets up the
+ * peripheral itself, with a kernel clock that keeps running without the CPUs,
+ * such as HSI or LSE. All D3Batch objects share the same buffer.
+ *
+ * @note Data is overwritten if it isn't read before the BDMA has filled the
+ * other half of the buffer. While the batching runs, standbyM7() leaves the
+ * peripherals on AHB4 and APB4, including the GPIOs, as they are.
+ */
+class D3Batch {
+    public:
+        /**
+         * @brief The largest batch, in bytes, so that two batches fit in the part of SRAM4 that is used.
+        */
+        static const size_t maxBatchSize = 16256;
+
+        /**
+        * @brief The number of bytes collected that haven't been read yet.
+        * @return The number of bytes.
+        */
+        size_t available() const;
+        /**
+        * @brief Check if at least a whole batch has been collected, for example after waking up.
+        * @return A batch or more to read: true. Less: false.
+        */
+        bool batchReady() const;
+        /**
+        * @brief Start collecting bytes from a D3 peripheral, or continue after waking up if it's already collecting with the same settings.
+        * @param request The DMAMUX2 request of the peripheral, e.g. BDMA_REQUEST_SPI6_RX.
+        * @param source The data register of the peripheral.
+        * @param batchSize The number of bytes that makes standbyM7() wake the M7 core up, up to maxBatchSize.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode begin(const uint8_t request,
+                                 const volatile void* const source,
+                                 const size_t batchSize);
+        /**
+        * @brief Start collecting the bytes that LPUART1 receives, or continue after waking up.
+        * LPUART1 must already be set up for reception.
+        * @param batchSize The number of bytes that makes standbyM7() wake the M7 core up, up to maxBatchSize.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode beginLPUART1(const size_t batchSize);
+        /**
+        * @brief Stop collecting and let the D3 domain follow the CPUs again. The bytes that haven't been read are dropped.
+        */
+        void end();
+        /**
+        * @brief Check if the BDMA is collecting.
+        * @return Collecting: true. Stopped: false.
+        */
+        bool isRunning() const;
+        /**
+        * @brief Copy collected bytes out of SRAM4, oldest first.
+        * @param data Where to copy the bytes.
+        * @param size The largest number of bytes to copy.
+        * @return The number of bytes copied.
+        */
+        size_t read(uint8_t* const data, const size_t size);
+
+    private:
+        // Keep the D3 domain running in Standby Mode and let a filled half of
+        // the buffer wake the M7 core up. Must be called with the external
+        // interrupts masked, from within a critical section.
+        static bool prepareStandby();
+
+        friend class LowPowerNiclaVision;
+};
+
+#endif  // End of header guard
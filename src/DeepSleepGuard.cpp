@@ -0,0 +1,64 @@
+/*
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         A scoped Deep Sleep lock that is released when it goes out of
+*         scope, on every return path
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "DeepSleepGuard.h"
+
+/*
+********************************************************************************
+*                             Member functions
+********************************************************************************
+*/
+
+DeepSleepGuard::DeepSleepGuard(const char* const holder,
+                               const RTCWakeupDelay holdLimit) :
+    holder(holder),
+    held(true)
+{
+    // The limit is kept in milliseconds, where 0 means none, so anything
+    // that doesn't fit is taken as no limit
+    const uint32_t limit = (holdLimit.value > UINT32_MAX) ?
+                           0 :
+                           static_cast<uint32_t>(holdLimit.value);
+    // This isn't inline, so the return address is where the guard is created
+    LowPower.lockDeepSleepFrom(holder, __builtin_return_address(0), limit);
+}
+
+DeepSleepGuard::~DeepSleepGuard()
+{
+    release();
+}
+
+bool DeepSleepGuard::isHeld() const
+{
+    return held;
+}
+
+void DeepSleepGuard::release()
+{
+    if (held)
+    {
+        held = false;
+        LowPower.unlockDeepSleep(holder);
+    }
+}
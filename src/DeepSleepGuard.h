@@ -0,0 +1,89 @@
+/**
+* @file
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         A scoped Deep Sleep lock that is released when it goes out of
+*         scope, on every return path
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+#ifndef DeepSleepGuard_H
+#define DeepSleepGuard_H
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+/*
+********************************************************************************
+*                                 Classes
+********************************************************************************
+*/
+
+/**
+ * @class DeepSleepGuard
+ * @brief A class that holds a tracked Deep Sleep lock from its construction until it goes out of scope, e.g. around a DMA transfer.
+ *
+ * The lock is the same as from LowPower.lockDeepSleep(), so it shows up in
+ * deepSleepLocks() under the name of the holder, with the code address that
+ * created the guard, how long it has been held, and how often it was taken
+ * while the same holder already held it, for example from another thread.
+ * Since the destructor releases the lock, an early return can't leak it.
+ *
+ * A guard can be given a hold limit. While a holder has held its lock for
+ * longer than that, it counts as overdue in deepSleepLocks(), and
+ * LowPower.canDeepSleep(overdueHolder) names it. That finds guards that are
+ * stuck, and locks of the same holder that were taken with lockDeepSleep()
+ * and never released.
+ *
+ * @note The name is DeepSleepGuard rather than DeepSleepLock, which is
+ * already the name of an Mbed class that sketches see without a namespace.
+ * Guards can be created in any thread and in interrupts, and don't allocate
+ * memory.
+ */
+class DeepSleepGuard {
+    public:
+        /**
+        * @brief Take a tracked Deep Sleep lock.
+        * @param holder A name for the holder, as for lockDeepSleep(). The string must stay valid, so a string literal is best.
+        * @param holdLimit How long the lock may be held before it counts as overdue, or 0_ms for no limit. The latest limit given for a holder applies.
+        */
+        explicit DeepSleepGuard(const char* const holder,
+                                const RTCWakeupDelay holdLimit = 0_ms);
+        /**
+        * @brief Release the lock, unless release() has already done so.
+        */
+        ~DeepSleepGuard();
+        DeepSleepGuard(const DeepSleepGuard&)               = delete;
+        DeepSleepGuard& operator=(const DeepSleepGuard&)    = delete;
+
+        /**
+        * @brief Check if the guard still holds its lock.
+        * @return Held: true. Released: false.
+        */
+        bool isHeld() const;
+        /**
+        * @brief Release the lock before the guard goes out of scope. Further calls do nothing.
+        */
+        void release();
+
+    private:
+        const char* const holder;
+        bool held;
+};
+
+#endif  // End of header guard
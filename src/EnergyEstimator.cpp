@@ -0,0 +1,211 @@
+/*
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         An estimator of the charge used by the Nicla Vision, based on
+*         the time spent in each power mode and a table of currents
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "EnergyEstimator.h"
+#include "BackupSRAM.h"
+
+/*
+********************************************************************************
+*                                Constants
+********************************************************************************
+*/
+
+static const uint32_t ENERGY_MAGIC = 0x454e4531;       // "ENE1"
+
+// Microamperes times microseconds in one microampere-hour
+static const double MICROSECONDS_PER_HOUR = 3600.0 * 1000000.0;
+
+/*
+********************************************************************************
+*                     Variables shared by all estimators
+********************************************************************************
+*/
+
+// The times of this boot at the last call to clear(), which are kept in SRAM
+// since they only apply to this boot
+static Residency bootBaseline;
+
+// Set when an estimator is used, since only then are the times of this boot
+// added to the backup SRAM before Standby Mode
+static bool energyUsed = false;
+
+/*
+********************************************************************************
+*                             Helper functions
+********************************************************************************
+*/
+
+static Residency thisBoot()
+{
+    Residency result;
+
+    const PowerSnapshot now = PowerProfiler::snapshot();
+    for (auto level = 0; level < 4; ++level)
+    {
+        result.run[level] = LowPower.timeSpentAtPerformanceLevel(
+            static_cast<PerformanceLevel>(level));
+    }
+    result.sleep = now.sleep;
+    result.stop = now.deepSleep + LowPower.timeSpentInStop();
+
+    // Leave out what clear() has already counted
+    for (auto level = 0; level < 4; ++level)
+    {
+        result.run[level] -= bootBaseline.run[level];
+    }
+    result.sleep -= bootBaseline.sleep;
+    result.stop -= bootBaseline.stop;
+
+    return result;
+}
+
+static decltype(BackupSRAMLayout::energy)& energyData()
+{
+    auto& energy = backupSRAM().energy;
+
+    if (ENERGY_MAGIC != energy.magic)
+    {
+        energy.previous = Residency();
+        energy.standbyStart = 0;
+        energy.magic = ENERGY_MAGIC;
+    }
+
+    // Count the Standby Mode that this boot woke up from, once
+    if (0 != energy.standbyStart)
+    {
+        const uint64_t bootTime = LowPower.rtcMilliseconds() -
+                                  LowPower.timeSinceBoot() / 1000;
+        if (bootTime > energy.standbyStart)
+        {
+            energy.previous.standby += (bootTime - energy.standbyStart) * 1000;
+        }
+        energy.standbyStart = 0;
+    }
+
+    energyUsed = true;
+    return energy;
+}
+
+/*
+********************************************************************************
+*                             Member functions
+********************************************************************************
+*/
+
+EnergyEstimator::EnergyEstimator(const CurrentProfile& profile)
+    : currents(profile)
+{
+}
+
+float EnergyEstimator::averageCurrent() const
+{
+    const uint64_t total = residency().total();
+    if (0 == total)
+    {
+        return 0;
+    }
+    return static_cast<float>(microampHours() * MICROSECONDS_PER_HOUR / total);
+}
+
+void EnergyEstimator::clear()
+{
+    core_util_critical_section_enter();
+    energyData().previous = Residency();
+    bootBaseline = Residency();
+    bootBaseline = thisBoot();
+    core_util_critical_section_exit();
+}
+
+float EnergyEstimator::microampHours() const
+{
+    const Residency times = residency();
+
+    // Double precision, since the product of a current and a time in
+    // microseconds quickly gets larger than a float can hold exactly
+    double charge = 0;
+    for (auto level = 0; level < 4; ++level)
+    {
+        charge += static_cast<double>(currents.run[level]) * times.run[level];
+    }
+    charge += static_cast<double>(currents.sleep) * times.sleep;
+    charge += static_cast<double>(currents.stop) * times.stop;
+    charge += static_cast<double>(currents.standby) * times.standby;
+
+    return static_cast<float>(charge / MICROSECONDS_PER_HOUR);
+}
+
+CurrentProfile& EnergyEstimator::profile()
+{
+    return currents;
+}
+
+float EnergyEstimator::projectedBatteryLife(const float capacity,
+                                            const float used) const
+{
+    const float current = averageCurrent();
+    const float remaining = capacity * 1000 - used;
+    if ((0 == current) || (remaining <= 0))
+    {
+        return 0;
+    }
+    return remaining / current;
+}
+
+void EnergyEstimator::recordStandbyEntry(const uint64_t rtcMilliseconds)
+{
+    // Don't turn on the backup regulator if no estimator has been used,
+    // because it draws extra current in Standby Mode
+    if (!energyUsed)
+    {
+        return;
+    }
+
+    auto& energy = energyData();
+    const Residency times = thisBoot();
+    for (auto level = 0; level < 4; ++level)
+    {
+        energy.previous.run[level] += times.run[level];
+    }
+    energy.previous.sleep += times.sleep;
+    energy.previous.stop += times.stop;
+    energy.standbyStart = rtcMilliseconds;
+}
+
+Residency EnergyEstimator::residency() const
+{
+    core_util_critical_section_enter();
+    const Residency previous = energyData().previous;
+    const Residency times = thisBoot();
+    core_util_critical_section_exit();
+
+    Residency result = previous;
+    for (auto level = 0; level < 4; ++level)
+    {
+        result.run[level] += times.run[level];
+    }
+    result.sleep += times.sleep;
+    result.stop += times.stop;
+
+    return result;
+}
@@ -0,0 +1,140 @@
+/**
+* @file
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         An estimator of the charge used by the Nicla Vision, based on
+*         the time spent in each power mode and a table of currents
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+#ifndef EnergyEstimator_H
+#define EnergyEstimator_H
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+/*
+********************************************************************************
+*                                 Classes
+********************************************************************************
+*/
+
+/**
+ * @brief The CurrentProfile struct holds the current that the board draws in each power mode.
+ * All currents are in microamperes. The defaults are rough figures for a Nicla
+ * Vision without any sensors in use, and should be replaced with measurements
+ * of the actual board and sketch.
+*/
+struct CurrentProfile
+{
+    /// Awake at each PerformanceLevel, in the same order as the enum
+    uint32_t run[4] = {110000, 70000, 45000, 30000};
+    uint32_t sleep = 25000;             ///< In Sleep Mode
+    uint32_t stop = 2500;               ///< In Deep Sleep Mode, and in Stop Mode through stopM7()
+    uint32_t standby = 150;             ///< In Standby Mode
+};
+
+/**
+ * @brief The Residency struct holds the time spent in each power mode.
+ * All times are in microseconds.
+*/
+struct Residency
+{
+    /// Awake at each PerformanceLevel, in the same order as the enum
+    uint64_t run[4] = {};
+    uint64_t sleep = 0;                 ///< In Sleep Mode
+    uint64_t stop = 0;                  ///< In Deep Sleep Mode, and in Stop Mode through stopM7()
+    uint64_t standby = 0;               ///< In Standby Mode
+
+    /**
+    * @brief The total time in all the power modes.
+    * @return Number of microseconds.
+    */
+    uint64_t total() const
+    {
+        return run[0] + run[1] + run[2] + run[3] + sleep + stop + standby;
+    }
+};
+
+/**
+ * @class EnergyEstimator
+ * @brief A class that estimates the charge used since power-on, and the battery life that it leads to.
+ *
+ * The time spent awake, in Sleep and in Deep Sleep comes from the Mbed CPU
+ * statistics, split by PerformanceLevel, and the time spent in Standby Mode
+ * comes from the RTC. The times from before Standby Mode are kept in the
+ * backup SRAM, so the estimate covers every boot since power-on or since the
+ * last call to clear(). Each time is multiplied by the current from the
+ * CurrentProfile.
+ *
+ * @note Only boots in which an EnergyEstimator was used add their times, and
+ * Standby Mode is only counted if the RTC was running when it was entered.
+ * All EnergyEstimator objects share the same times.
+ */
+class EnergyEstimator {
+    public:
+        /**
+        * @brief Create an estimator.
+        * @param profile The currents to use for the estimate.
+        */
+        explicit EnergyEstimator(const CurrentProfile& profile = CurrentProfile());
+
+        /**
+        * @brief The average current since power-on, or since the last call to clear().
+        * @return Number of microamperes, or 0 if no time has been recorded.
+        */
+        float averageCurrent() const;
+        /**
+        * @brief Start estimating from zero, as if the board had just been powered on.
+        */
+        void clear();
+        /**
+        * @brief The estimated charge used since power-on, or since the last call to clear().
+        * @return Number of microampere-hours.
+        */
+        float microampHours() const;
+        /**
+        * @brief The currents used for the estimate.
+        * @return The profile, which can be changed.
+        */
+        CurrentProfile& profile();
+        /**
+        * @brief How long a battery lasts at the average current so far.
+        * @param capacity The capacity of the battery in milliampere-hours.
+        * @param used The charge already taken from the battery in microampere-hours, such as microampHours() if it was full at power-on.
+        * @return Number of hours, or 0 if no time has been recorded.
+        */
+        float projectedBatteryLife(const float capacity,
+                                   const float used = 0) const;
+        /**
+        * @brief The time spent in each power mode since power-on, or since the last call to clear().
+        * @return The times.
+        */
+        Residency residency() const;
+
+    private:
+        CurrentProfile currents;
+
+        // Add the times from this boot to the backup SRAM, together with the
+        // RTC time, or 0 if the RTC isn't running
+        static void recordStandbyEntry(const uint64_t rtcMilliseconds);
+
+        friend class LowPowerNiclaVision;
+};
+
+#endif  // End of header guard
@@ -0,0 +1,155 @@
+/*
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         A short path through the boot after a timed wakeup from
+*         Standby Mode, which goes back to Standby Mode before Mbed starts
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "FastBoot.h"
+#include "BackupSRAM.h"
+
+/*
+********************************************************************************
+*                      Variables shared by all objects
+********************************************************************************
+*/
+
+static const uint32_t FAST_BOOT_MAGIC = 0x46424f31;      // "FBO1"
+
+/*
+********************************************************************************
+*                             Member functions
+********************************************************************************
+*/
+
+LowPowerReturnCode FastBoot::arm(const RTCWakeupDelay delay)
+{
+    if (RTCWakeupDelay::infinite == delay.value)
+    {
+        return LowPowerReturnCode::noWakeupSource;
+    }
+    if (!delay.fitsWakeupTimer())
+    {
+        return LowPowerReturnCode::wakeupDelayTooLong;
+    }
+    if (delay.value < RTCWakeupDelay::minWakeupTimerDelay)
+    {
+        return LowPowerReturnCode::wakeupDelayTooShort;
+    }
+
+    auto& state = backupSRAM().fastBoot;
+    state.wakeupClock = delay.wakeupClock;
+    state.autoReload = delay.autoReload;
+    state.wakeups = 0;
+    state.magic = FAST_BOOT_MAGIC;
+
+    return LowPowerReturnCode::success;
+}
+
+void FastBoot::disarm()
+{
+    backupSRAM().fastBoot.magic = 0;
+}
+
+bool FastBoot::isArmed() const
+{
+    return FAST_BOOT_MAGIC == backupSRAM().fastBoot.magic;
+}
+
+void FastBoot::run(bool (*const callback)())
+{
+#if defined CORE_CM7
+    // Only a wakeup by the RTC wakeup timer from Standby Mode takes the fast
+    // path. The flags are left as they are, so that the usual boot still
+    // finds them.
+    const bool fromStandby = 0 != (PWR->CPUCR & (PWR_CPUCR_SBF |
+                                                 PWR_CPUCR_SBF_D1));
+    if (!fromStandby || (nullptr == callback) ||
+        !LowPowerNiclaVision::isRTCConfigured() ||
+        (0 == (RTC->ISR & RTC_ISR_WUTF)))
+    {
+        return;
+    }
+    auto& state = backupSRAM().fastBoot;
+    if (FAST_BOOT_MAGIC != state.magic)
+    {
+        return;
+    }
+
+    // The shadow registers must be synchronized after a reset before the
+    // time can be read, by the callback or by fastStandby()
+    HAL_PWR_EnableBkUpAccess();
+    LL_RTC_DisableWriteProtection(RTC);
+    LL_RTC_WaitForSynchro(RTC);
+    LL_RTC_EnableWriteProtection(RTC);
+
+    // Mbed has already set up PLL1 from HSE. Switch to HSI and turn the rest
+    // off, but keep the PLL setup, so that the clocks can be restored the
+    // same way as after Stop Mode if the usual boot goes on.
+    const uint32_t oscillators = RCC->CR & (RCC_CR_HSEON |
+                                            RCC_CR_PLL1ON |
+                                            RCC_CR_PLL2ON |
+                                            RCC_CR_PLL3ON);
+    const uint32_t sysclkSource = RCC->CFGR & RCC_CFGR_SW;
+    const uint32_t voltageScaling = HAL_PWREx_GetVoltageRange();
+    // Mbed may have turned HSI off after switching to PLL1
+    RCC->CR |= RCC_CR_HSION;
+    if (!LowPowerNiclaVision::waitForRegister(RCC->CR, RCC_CR_HSIRDY,
+                                              RCC_CR_HSIRDY, HSI_TIMEOUT_VALUE))
+    {
+        return;
+    }
+    MODIFY_REG(RCC->CFGR, RCC_CFGR_SW, RCC_CFGR_SW_HSI);
+    if (!LowPowerNiclaVision::waitForRegister(RCC->CFGR, RCC_CFGR_SWS,
+                                              RCC_CFGR_SW_HSI << RCC_CFGR_SWS_Pos,
+                                              CLOCKSWITCH_TIMEOUT_VALUE))
+    {
+        MODIFY_REG(RCC->CFGR, RCC_CFGR_SW, sysclkSource);
+        return;
+    }
+    RCC->CR &= ~oscillators;
+    SystemCoreClockUpdate();
+    // VOS3 also keeps the voltage scaling out of VOS0 for Standby Mode
+    const bool voltageLowered =
+        HAL_OK == HAL_PWREx_ControlVoltageScaling(PWR_REGULATOR_VOLTAGE_SCALE3);
+
+    if (callback() && voltageLowered)
+    {
+        state.wakeups++;
+        LowPowerNiclaVision::fastStandby(state.wakeupClock, state.autoReload);
+        // Only reached if Standby Mode couldn't be entered
+        state.wakeups--;
+    }
+
+    // If the clocks can't be restored, the usual boot goes on from HSI,
+    // which is slower but safe
+    LowPowerNiclaVision::restoreClocks(oscillators, sysclkSource,
+                                       voltageScaling);
+    SystemCoreClockUpdate();
+#else
+    (void) callback;
+#endif
+}
+
+uint32_t FastBoot::wakeups() const
+{
+    const auto& state = backupSRAM().fastBoot;
+    return (FAST_BOOT_MAGIC == state.magic) ? state.wakeups : 0;
+}
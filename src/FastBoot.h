@@ -0,0 +1,124 @@
+/**
+* @file
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         A short path through the boot after a timed wakeup from
+*         Standby Mode, which goes back to Standby Mode before Mbed starts
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+#ifndef FastBoot_H
+#define FastBoot_H
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+/*
+********************************************************************************
+*                                 Macros
+********************************************************************************
+*/
+
+/**
+ * @brief Run a function early in the boot after each timed wakeup from Standby Mode, while a FastBoot is armed.
+ * Put it once in the sketch, outside of any function, e.g. LOWPOWER_FAST_BOOT(checkSensor).
+ * The function takes no parameters, and returns true to go back to Standby
+ * Mode right away, or false to boot as usual and run setup().
+ *
+ * This defines TargetBSP_Init(), which Mbed calls after the clocks and the
+ * caches have been set up, but before static initialization and the RTOS.
+ */
+#define LOWPOWER_FAST_BOOT(callback) \
+    extern "C" void TargetBSP_Init(void) \
+    { \
+        FastBoot::run(callback); \
+    }
+
+/*
+********************************************************************************
+*                                 Classes
+********************************************************************************
+*/
+
+/**
+ * @class FastBoot
+ * @brief A class that lets short timed wakeups from Standby Mode skip the Mbed boot, static initialization and setup().
+ *
+ * After arm(), each wakeup by the RTC wakeup timer from standbyM7() runs the
+ * function from LOWPOWER_FAST_BOOT(), before the RTOS starts. The function
+ * runs on HSI at 64 MHz, with the PLL and HSE turned off and the voltage
+ * scaling at VOS3. When it returns true, the M7 core goes back to Standby
+ * Mode with the same delay, through a shorter sequence than standbyM7().
+ * When it returns false, the clocks from boot are restored, and the sketch
+ * starts over with setup(), where wasInCPUMode() and wakeupInfo() tell about
+ * the last wakeup as usual. Wakeups by a pin, an alarm or a reset always boot
+ * the usual way.
+ *
+ * @note The function can't use the LowPower object, Serial, delay() or
+ * anything else that needs Mbed or the RTOS, since none of it is running yet.
+ * It can use the HAL and the registers, and the data from persistent()
+ * through FastBoot::persistent(). Only the M7 core has this path.
+ */
+class FastBoot {
+    public:
+        /**
+        * @brief Let the following timed wakeups from Standby Mode go through the fast path.
+        * Call standbyM7() with the same delay afterwards. Also resets the count from wakeups().
+        * @param delay The delay for each time the fast path goes back to Standby Mode.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode arm(const RTCWakeupDelay delay);
+        /**
+        * @brief Let all the following wakeups boot the usual way.
+        */
+        void disarm();
+        /**
+        * @brief Check if the fast path is armed.
+        * @return Armed: true. Not armed: false.
+        */
+        bool isArmed() const;
+        /**
+        * @brief Get the data from LowPower.persistent() in the fast path, where the LowPower object isn't available.
+        * Changes are kept when the fast path goes back to Standby Mode.
+        * @tparam T The same type as given to persistent() before Standby Mode.
+        * @param version The same version as given to persistent().
+        * @return The data, or nullptr if the backup SRAM doesn't hold valid data of this type and version.
+        */
+        template <typename T>
+        static T* persistent(const uint16_t version = 0)
+        {
+            static_assert(sizeof(T) <= LowPowerNiclaVision::persistentCapacity,
+                          "Persistent data must fit in persistentCapacity");
+            return static_cast<T*>(LowPowerNiclaVision::fastBootPersistent(sizeof(T),
+                                                                           version));
+        }
+        /// @cond DEV
+        /**
+        * @brief Called by LOWPOWER_FAST_BOOT(), and returns only if the usual boot should go on.
+        * @param callback The function of the sketch.
+        */
+        static void run(bool (*const callback)());
+        /// @endcond
+        /**
+        * @brief The number of wakeups that went back to Standby Mode through the fast path since arm().
+        * @return The number of wakeups.
+        */
+        uint32_t wakeups() const;
+};
+
+#endif  // End of header guard
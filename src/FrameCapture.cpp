@@ -0,0 +1,183 @@
+/*
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         Capture of a camera frame through DCMI and DMA straight into
+*         a buffer, with the M7 core asleep during the transfer
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "FrameCapture.h"
+
+/*
+********************************************************************************
+*                      Variables shared by all objects
+********************************************************************************
+*/
+
+// The same DMA stream as the Arduino Camera library. DMA2 Stream 3 is
+// connected to DMAMUX1 channel 11.
+#define CAPTURE_STREAM          DMA2_Stream3
+#define CAPTURE_MUX_CHANNEL     DMAMUX1_Channel11
+static const IRQn_Type CAPTURE_IRQ = DMA2_Stream3_IRQn;
+// The flags of stream 3 are at the same positions in LISR and LIFCR
+static const uint32_t CAPTURE_DONE_FLAGS = DMA_LISR_TCIF3 | DMA_LISR_TEIF3;
+static const uint32_t CAPTURE_ALL_FLAGS = DMA_LIFCR_CFEIF3 | DMA_LIFCR_CDMEIF3 |
+                                          DMA_LIFCR_CTEIF3 | DMA_LIFCR_CHTIF3 |
+                                          DMA_LIFCR_CTCIF3;
+
+// A thread flag that neither Mbed nor requestStandby() uses
+static const uint32_t FRAME_CAPTURED_FLAG = 1UL << 29;
+static osThreadId_t captureThread = nullptr;
+static volatile uint32_t captureFlags = 0;
+
+// The DMA can reach the AXI SRAM and SRAM1 to SRAM4, but not the TCMs below
+static const uint32_t DMA_REACHABLE_START = 0x24000000;
+static const uint32_t DMA_REACHABLE_END = 0x40000000;
+static const uint32_t CACHE_LINE_SIZE = 32;
+
+/*
+********************************************************************************
+*                             Helper functions
+********************************************************************************
+*/
+
+static void frameCapturedHandler(void)
+{
+    const uint32_t flags = DMA2->LISR & CAPTURE_DONE_FLAGS;
+    if (0 != flags)
+    {
+        DMA2->LIFCR = flags;
+        CAPTURE_STREAM->CR &= ~(DMA_SxCR_TCIE | DMA_SxCR_TEIE);
+        captureFlags = captureFlags | flags;
+        if (nullptr != captureThread)
+        {
+            osThreadFlagsSet(captureThread, FRAME_CAPTURED_FLAG);
+        }
+    }
+}
+
+static void invalidateBuffer(void* const buffer, const size_t size)
+{
+#if defined CORE_CM7
+    SCB_InvalidateDCache_by_Addr(static_cast<uint32_t*>(buffer),
+                                 static_cast<int32_t>(size));
+#else
+    (void) buffer;
+    (void) size;
+#endif
+}
+
+/*
+********************************************************************************
+*                             Member functions
+********************************************************************************
+*/
+
+LowPowerReturnCode FrameCapture::capture(void* const buffer,
+                                         const size_t size,
+                                         const uint32_t timeout)
+{
+    const uint32_t address = reinterpret_cast<uint32_t>(buffer);
+    if ((0 == size) || (size > maxFrameSize) ||
+        (0 != (address % CACHE_LINE_SIZE)) || (0 != (size % CACHE_LINE_SIZE)) ||
+        (address < DMA_REACHABLE_START) || (address + size > DMA_REACHABLE_END))
+    {
+        return LowPowerReturnCode::invalidFrameBuffer;
+    }
+
+    // The idle thread would otherwise enter Deep Sleep, which stops the
+    // DCMI and the DMA along with the clocks
+    LowPower.lockDeepSleep("FrameCapture");
+
+    // Without dirty lines for the buffer, nothing can be written back over
+    // the frame while the DMA writes it
+    invalidateBuffer(buffer, size);
+
+    core_util_critical_section_enter();
+    const uint32_t previousHandler = NVIC_GetVector(CAPTURE_IRQ);
+    const bool interruptEnabled = NVIC_GetEnableIRQ(CAPTURE_IRQ);
+    captureThread = rtos::ThisThread::get_id();
+    captureFlags = 0;
+    rtos::ThisThread::flags_clear(FRAME_CAPTURED_FLAG);
+    NVIC_SetVector(CAPTURE_IRQ, reinterpret_cast<uint32_t>(&frameCapturedHandler));
+
+    __HAL_RCC_DMA2_CLK_ENABLE();
+    CAPTURE_STREAM->CR &= ~DMA_SxCR_EN;
+    while (CAPTURE_STREAM->CR & DMA_SxCR_EN)
+        ;
+    DMA2->LIFCR = CAPTURE_ALL_FLAGS;
+    CAPTURE_MUX_CHANNEL->CCR = DMA_REQUEST_DCMI;
+    CAPTURE_STREAM->PAR = reinterpret_cast<uint32_t>(&DCMI->DR);
+    CAPTURE_STREAM->M0AR = address;
+    CAPTURE_STREAM->NDTR = size / 4;
+    // Words from the DCMI into the buffer, through the full FIFO
+    CAPTURE_STREAM->FCR = DMA_SxFCR_DMDIS | DMA_SxFCR_FTH;
+    CAPTURE_STREAM->CR = DMA_SxCR_PL_1 | DMA_SxCR_MSIZE_1 | DMA_SxCR_PSIZE_1 |
+                         DMA_SxCR_MINC | DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+    CAPTURE_STREAM->CR |= DMA_SxCR_EN;
+    NVIC_ClearPendingIRQ(CAPTURE_IRQ);
+    NVIC_EnableIRQ(CAPTURE_IRQ);
+
+    // One frame in snapshot mode
+    DCMI->ICR = DCMI_ICR_OVR_ISC | DCMI_ICR_ERR_ISC | DCMI_ICR_FRAME_ISC;
+    DCMI->CR |= DCMI_CR_CM | DCMI_CR_ENABLE;
+    DCMI->CR |= DCMI_CR_CAPTURE;
+    core_util_critical_section_exit();
+
+    // The flag is kept if the interrupt comes before the wait starts
+    rtos::ThisThread::flags_wait_any_for(FRAME_CAPTURED_FLAG,
+        rtos::Kernel::Clock::duration_u32(timeout));
+
+    core_util_critical_section_enter();
+    const uint32_t flags = captureFlags;
+    if (0 == flags)
+    {
+        DCMI->CR &= ~DCMI_CR_CAPTURE;
+        CAPTURE_STREAM->CR &= ~(DMA_SxCR_EN | DMA_SxCR_TCIE | DMA_SxCR_TEIE);
+        while (CAPTURE_STREAM->CR & DMA_SxCR_EN)
+            ;
+        DMA2->LIFCR = CAPTURE_ALL_FLAGS;
+    }
+    const bool overrun = 0 != (DCMI->RIS & DCMI_RIS_OVR_RIS);
+    NVIC_ClearPendingIRQ(CAPTURE_IRQ);
+    if (!interruptEnabled)
+    {
+        NVIC_DisableIRQ(CAPTURE_IRQ);
+    }
+    NVIC_SetVector(CAPTURE_IRQ, previousHandler);
+    captureThread = nullptr;
+    rtos::ThisThread::flags_clear(FRAME_CAPTURED_FLAG);
+    core_util_critical_section_exit();
+
+    // The core may have loaded lines of the buffer speculatively during the
+    // transfer, so they must be dropped before the frame is read
+    invalidateBuffer(buffer, size);
+
+    LowPower.unlockDeepSleep("FrameCapture");
+
+    if (0 == flags)
+    {
+        return LowPowerReturnCode::captureTimeout;
+    }
+    if ((flags & DMA_LISR_TEIF3) || overrun)
+    {
+        return LowPowerReturnCode::captureFailed;
+    }
+    return LowPowerReturnCode::success;
+}
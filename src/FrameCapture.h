@@ -0,0 +1,75 @@
+/**
+* @file
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         Capture of a camera frame through DCMI and DMA straight into
+*         a buffer, with the M7 core asleep during the transfer
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+#ifndef FrameCapture_H
+#define FrameCapture_H
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+/*
+********************************************************************************
+*                                 Classes
+********************************************************************************
+*/
+
+/**
+ * @class FrameCapture
+ * @brief A class that captures one camera frame through DCMI into a buffer of the sketch, while the M7 core sleeps.
+ *
+ * The DMA writes the frame straight into the buffer, so there is no copy
+ * afterwards. Only the cache lines of the buffer are invalidated, before and
+ * after the transfer, rather than the whole D-cache. While the transfer runs,
+ * the calling thread is blocked, and the core sleeps in the idle thread until
+ * the transfer complete interrupt. Deep Sleep is locked in the meantime,
+ * since it would stop the DCMI and the DMA.
+ *
+ * The camera and the DCMI must already be set up, for example by the begin()
+ * function of the Arduino Camera library, which also uses DMA2 Stream 3. Don't
+ * capture with the Camera library and FrameCapture at the same time.
+ *
+ * @note The buffer must start on a 32 byte cache line and have a size that is
+ * a multiple of 32 bytes, e.g. alignas(32) uint8_t frame[320 * 240 * 2]. It
+ * can't be in DTCM, which the DMA can't reach.
+ */
+class FrameCapture {
+    public:
+        /**
+         * @brief The largest frame in bytes that one DMA transfer can hold.
+        */
+        static const size_t maxFrameSize = 65535 * 4;
+
+        /**
+        * @brief Capture one frame into a buffer, and sleep until it's there.
+        * @param buffer The buffer, aligned to 32 bytes and outside DTCM.
+        * @param size The size of the frame in bytes, a multiple of 32 up to maxFrameSize.
+        * @param timeout How long to wait for the frame, in milliseconds.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode capture(void* const buffer,
+                                   const size_t size,
+                                   const uint32_t timeout = 1000);
+};
+
+#endif  // End of header guard
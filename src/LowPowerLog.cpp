@@ -0,0 +1,210 @@
+/*
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         A log that collects text in the backup SRAM while USB or the
+*         UART is off, and writes it out in bursts
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "LowPowerLog.h"
+#include "BackupSRAM.h"
+
+/*
+********************************************************************************
+*                      Variables shared by all objects
+********************************************************************************
+*/
+
+static const uint32_t LOG_MAGIC = 0x4c504c31;          // "LPL1"
+
+static Print* logOutput = nullptr;
+static bool (*flushHook)() = nullptr;
+static bool usbTurnedOff = false;
+static core_util_atomic_flag flushing = CORE_UTIL_ATOMIC_FLAG_INIT;
+
+/*
+********************************************************************************
+*                             Helper functions
+********************************************************************************
+*/
+
+static decltype(BackupSRAMLayout::lowPowerLog)& logBuffer()
+{
+    auto& log = backupSRAM().lowPowerLog;
+
+    // Also reject more pending bytes than fit in the buffer, in case the
+    // backup SRAM has been partly overwritten
+    core_util_critical_section_enter();
+    if ((LOG_MAGIC != log.magic) ||
+        ((log.head - log.tail) > LowPowerLog::capacity))
+    {
+        log.head = 0;
+        log.tail = 0;
+        log.dropped = 0;
+        log.magic = LOG_MAGIC;
+    }
+    core_util_critical_section_exit();
+
+    return log;
+}
+
+static bool outputAvailable()
+{
+    if (nullptr == logOutput)
+    {
+        return false;
+    }
+#if defined(SERIAL_CDC)
+    if (usbTurnedOff && (static_cast<Print*>(&Serial) == logOutput))
+    {
+        return false;
+    }
+#endif
+    return (nullptr == flushHook) || flushHook();
+}
+
+/*
+********************************************************************************
+*                             Member functions
+********************************************************************************
+*/
+
+void LowPowerLog::begin(Print& output)
+{
+    logOutput = &output;
+    flushPending();
+}
+
+void LowPowerLog::clear()
+{
+    auto& log = logBuffer();
+
+    // A flush that runs at the same time sees that the tail has moved, and
+    // stops without moving it back
+    core_util_critical_section_enter();
+    log.tail = log.head;
+    log.dropped = 0;
+    core_util_critical_section_exit();
+}
+
+uint32_t LowPowerLog::dropped() const
+{
+    return logBuffer().dropped;
+}
+
+void LowPowerLog::flush()
+{
+    flushPending();
+}
+
+void LowPowerLog::flushBeforeStandby()
+{
+    flushPending();
+
+    // The output may still be sending, and Standby Mode would cut it off
+    if (!core_util_is_isr_active() && !core_util_in_critical_section() &&
+        outputAvailable())
+    {
+        logOutput->flush();
+    }
+}
+
+void LowPowerLog::flushPending()
+{
+    // The output may block, or take a lock of its own, which Mbed doesn't
+    // allow with interrupts disabled either
+    if (core_util_is_isr_active() || core_util_in_critical_section() ||
+        !outputAvailable())
+    {
+        return;
+    }
+    if (core_util_atomic_flag_test_and_set(&flushing))
+    {
+        return;
+    }
+
+    // Only this function moves the tail forward, and the bytes up to the head
+    // have all been copied in, so none of this needs a critical section
+    auto& log = logBuffer();
+    uint32_t tail = core_util_atomic_load_u32(&log.tail);
+    const uint32_t head = core_util_atomic_load_u32(&log.head);
+    while (tail != head)
+    {
+        // Up to the end of the buffer at a time
+        const uint32_t index = tail % capacity;
+        const size_t toEnd = capacity - index;
+        const size_t part = (head - tail < toEnd) ? head - tail : toEnd;
+        const size_t written = logOutput->write(&log.data[index], part);
+
+        uint32_t expected = tail;
+        if ((0 == written) ||
+            !core_util_atomic_cas_u32(&log.tail, &expected, tail + written))
+        {
+            break;
+        }
+        tail += written;
+    }
+
+    core_util_atomic_flag_clear(&flushing);
+}
+
+size_t LowPowerLog::pending() const
+{
+    const auto& log = logBuffer();
+    return log.head - log.tail;
+}
+
+void LowPowerLog::setFlushHook(bool (*hook)())
+{
+    flushHook = hook;
+}
+
+void LowPowerLog::usbChanged(const bool on)
+{
+    usbTurnedOff = !on;
+    if (on)
+    {
+        flushPending();
+    }
+}
+
+size_t LowPowerLog::write(uint8_t byte)
+{
+    return write(&byte, 1);
+}
+
+size_t LowPowerLog::write(const uint8_t* buffer, size_t size)
+{
+    auto& log = logBuffer();
+
+    core_util_critical_section_enter();
+    const uint32_t space = capacity - (log.head - log.tail);
+    const size_t count = (size < space) ? size : space;
+    for (size_t i = 0; i < count; ++i)
+    {
+        log.data[(log.head + i) % capacity] = buffer[i];
+    }
+    log.head = log.head + count;
+    log.dropped = log.dropped + (size - count);
+    core_util_critical_section_exit();
+
+    flushPending();
+
+    return count;
+}
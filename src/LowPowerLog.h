@@ -0,0 +1,119 @@
+/**
+* @file
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         A log that collects text in the backup SRAM while USB or the
+*         UART is off, and writes it out in bursts
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+#ifndef LowPowerLog_H
+#define LowPowerLog_H
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include <Arduino.h>
+#include "Arduino_LowPowerNiclaVision.h"
+
+/*
+********************************************************************************
+*                                 Classes
+********************************************************************************
+*/
+
+/**
+ * @class LowPowerLog
+ * @brief A class that logs text into a ring buffer in the backup SRAM, and writes it to an output such as Serial in one burst when the output is available.
+ *
+ * print() and the other Print functions don't hold a Deep Sleep lock, and
+ * only copy the text into the buffer while the output is unavailable, so
+ * they can be called while Deep Sleep is allowed, and from interrupts. The
+ * text is written to the output right away whenever it's available, except
+ * from interrupts, and otherwise kept until the next flush. The buffer is
+ * flushed when disallowDeepSleep() turns USB on again, and before standbyM7()
+ * enters Standby Mode. It survives Standby Mode and resets, so text that
+ * couldn't be written before is written after waking up. All LowPowerLog
+ * objects share the same buffer and output.
+ *
+ * @note When the buffer is full, new text is dropped rather than old text,
+ * and dropped() counts how many bytes were lost. Only log from one of the two
+ * cores, since they would both write to the same buffer.
+ */
+class LowPowerLog : public Print {
+    public:
+        /**
+         * @brief The number of bytes that the ring buffer holds.
+        */
+        static const size_t capacity = 1024;
+
+        /**
+        * @brief Set where the text is written to, and write what's left from before.
+        * @param output The output, e.g. Serial or Serial1.
+        */
+        void begin(Print& output);
+        /**
+        * @brief Drop all the text that hasn't been written yet, and reset the count of dropped bytes.
+        */
+        void clear();
+        /**
+        * @brief The number of bytes that didn't fit in the buffer since clear().
+        * @return The number of bytes.
+        */
+        uint32_t dropped() const;
+        /**
+        * @brief Write all the text in the buffer to the output in one burst, if the output is available.
+        * Does nothing when called from an interrupt, or while another flush runs.
+        */
+        void flush() override;
+        /**
+        * @brief The number of bytes in the buffer that haven't been written to the output yet.
+        * @return The number of bytes.
+        */
+        size_t pending() const;
+        /**
+        * @brief Set a function that tells if the output is available, e.g. if the Serial Monitor is open.
+        * The output is taken as unavailable anyway while allowDeepSleep() has turned off USB, if the output is Serial over USB.
+        * @param hook A function that returns true to let the flush go ahead, or nullptr to always flush.
+        */
+        void setFlushHook(bool (*hook)());
+        /**
+        * @brief Log one byte.
+        * @param byte The byte.
+        * @return 1 if the byte fit in the buffer, and 0 otherwise.
+        */
+        size_t write(uint8_t byte) override;
+        /**
+        * @brief Log some bytes.
+        * @param buffer The bytes.
+        * @param size The number of bytes.
+        * @return The number of bytes that fit in the buffer.
+        */
+        size_t write(const uint8_t* buffer, size_t size) override;
+        using Print::write;
+
+    private:
+        // Called by disallowDeepSleep() and allowDeepSleep()
+        static void usbChanged(const bool on);
+        // Called by standbyM7() and requestStandby() before anything else.
+        // Does nothing with interrupts disabled.
+        static void flushBeforeStandby();
+        static void flushPending();
+
+        friend class LowPowerNiclaVision;
+};
+
+#endif  // End of header guard
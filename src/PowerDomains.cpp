@@ -0,0 +1,225 @@
+/*
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         Power gating of the camera, the WiFi/BT module, and the ToF
+*         sensor on the Nicla Vision, with reference counting
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "PowerDomains.h"
+
+/*
+********************************************************************************
+*                      Variables shared by all objects
+********************************************************************************
+*/
+
+struct DomainState
+{
+    PowerDomainControl control;
+    gpio_t gpio;
+    uint16_t users;
+    bool on;
+};
+
+// The pins depend on the revision of the board, so they must be set up with
+// configure(). The waits are from the datasheets: the camera needs a few
+// milliseconds before it answers on I2C, the WiFi/BT module 150 ms after
+// WL_REG_ON goes high and 10 ms in the off state before it can start again,
+// and the ToF sensor 1.2 ms to boot.
+static DomainState domainStates[PowerDomains::count] = {
+    {{NC, false, 10, 1}, {}, 0, false},
+    {{NC, true, 150, 10}, {}, 0, false},
+    {{NC, true, 2, 1}, {}, 0, false}
+};
+
+// The users from before Standby Mode, while it's being entered
+static uint16_t standbyUsers[PowerDomains::count] = {};
+static bool standbyPending = false;
+
+/*
+********************************************************************************
+*                             Helper functions
+********************************************************************************
+*/
+
+static DomainState& domainState(const PowerDomain domain)
+{
+    return domainStates[static_cast<size_t>(domain)];
+}
+
+// A pin that is shared by several parts stays on while any of them has a user
+static bool pinInUse(const PinName pin)
+{
+    for (const auto& state : domainStates)
+    {
+        if ((state.control.pin == pin) && (0 != state.users))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void setPower(DomainState& state, const bool on)
+{
+    gpio_write(&state.gpio, (on == state.control.activeHigh) ? 1 : 0);
+
+    // Every part that shares the pin is now in the same state
+    for (auto& other : domainStates)
+    {
+        if (other.control.pin == state.control.pin)
+        {
+            other.on = on;
+        }
+    }
+
+    wait_us(1000 * (on ? state.control.powerUpTime :
+                         state.control.powerDownTime));
+}
+
+/*
+********************************************************************************
+*                             Member functions
+********************************************************************************
+*/
+
+LowPowerReturnCode PowerDomains::acquire(const PowerDomain domain)
+{
+    DomainState& state = domainState(domain);
+    if (NC == state.control.pin)
+    {
+        return LowPowerReturnCode::domainNotConfigured;
+    }
+
+    if (UINT16_MAX != state.users)
+    {
+        ++state.users;
+    }
+    if (!state.on)
+    {
+        setPower(state, true);
+    }
+
+    return LowPowerReturnCode::success;
+}
+
+void PowerDomains::configure(const PowerDomain domain, const PinName pin)
+{
+    PowerDomainControl control = domainState(domain).control;
+    control.pin = pin;
+    configure(domain, control);
+}
+
+void PowerDomains::configure(const PowerDomain domain,
+                             const PowerDomainControl& control)
+{
+    DomainState& state = domainState(domain);
+    state.control = control;
+    state.users = 0;
+    state.on = false;
+
+    if (NC != control.pin)
+    {
+        // Take the state from another part that shares the pin, or turn the
+        // pin off if none of them is in use
+        state.on = pinInUse(control.pin);
+        gpio_init_out_ex(&state.gpio, control.pin,
+                         (state.on == control.activeHigh) ? 1 : 0);
+    }
+}
+
+bool PowerDomains::isOn(const PowerDomain domain) const
+{
+    return domainState(domain).on;
+}
+
+void PowerDomains::powerDownAll()
+{
+    for (auto& state : domainStates)
+    {
+        state.users = 0;
+    }
+    for (auto& state : domainStates)
+    {
+        if ((NC != state.control.pin) && state.on)
+        {
+            setPower(state, false);
+        }
+    }
+}
+
+void PowerDomains::powerDownForStandby()
+{
+    // requestStandby() calls standbyM7(), which mustn't forget the users
+    if (!standbyPending)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            standbyUsers[i] = domainStates[i].users;
+        }
+        standbyPending = true;
+    }
+    PowerDomains().powerDownAll();
+}
+
+void PowerDomains::release(const PowerDomain domain)
+{
+    DomainState& state = domainState(domain);
+    // Ignore unbalanced calls
+    if (0 == state.users)
+    {
+        return;
+    }
+
+    --state.users;
+    if (state.on && !pinInUse(state.control.pin))
+    {
+        setPower(state, false);
+    }
+}
+
+void PowerDomains::restoreAfterStandby()
+{
+    if (!standbyPending)
+    {
+        return;
+    }
+    standbyPending = false;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (NC != domainStates[i].control.pin)
+        {
+            domainStates[i].users = standbyUsers[i];
+        }
+    }
+    for (auto& state : domainStates)
+    {
+        if ((NC != state.control.pin) && !state.on && pinInUse(state.control.pin))
+        {
+            setPower(state, true);
+        }
+    }
+}
+
+uint16_t PowerDomains::users(const PowerDomain domain) const
+{
+    return domainState(domain).users;
+}
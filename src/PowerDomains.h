@@ -0,0 +1,141 @@
+/**
+* @file
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         Power gating of the camera, the WiFi/BT module, and the ToF
+*         sensor on the Nicla Vision, with reference counting
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+#ifndef PowerDomains_H
+#define PowerDomains_H
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+/*
+********************************************************************************
+*                                  Enums
+********************************************************************************
+*/
+
+/**
+ * @enum PowerDomain
+ * @brief Provides the parts of the board that PowerDomains can turn on and off.
+*/
+enum class PowerDomain : uint8_t
+{
+    camera,                 ///< The GC2145 camera, through its power down pin
+    wifi,                   ///< The Murata WiFi/BT module, through WL_REG_ON
+    tof                     ///< The VL53L1X time-of-flight sensor, through XSHUT
+};
+
+/*
+********************************************************************************
+*                                 Classes
+********************************************************************************
+*/
+
+/**
+ * @brief The PowerDomainControl struct tells how to turn a part of the board on and off.
+*/
+struct PowerDomainControl
+{
+    PinName pin = NC;               ///< The pin that turns the part on, or NC if not in use
+    bool activeHigh = true;         ///< The pin is high when the part is on: true. Low: false.
+    uint16_t powerUpTime = 0;       ///< Milliseconds to wait after turning the part on, before it can be used
+    uint16_t powerDownTime = 0;     ///< Milliseconds to wait after turning the part off, before it can be turned on again
+};
+
+/**
+ * @class PowerDomains
+ * @brief A class that turns the camera, the WiFi/BT module, and the ToF sensor on only while they are in use.
+ *
+ * Each call to acquire() counts one more user of a part, and each call to
+ * release() one less. The part is turned on for its first user and off after
+ * its last one, with the wait that it needs after each. Parts that are set up
+ * with the same pin share it, so it stays on while any of them has a user.
+ * standbyM7() turns all the parts off before entering Standby Mode, and
+ * back on for their users if it returns with an error. All PowerDomains
+ * objects share the same setup and counts.
+ *
+ * @note The pins float in Standby Mode, so the board must keep each part off
+ * with a pull resistor. Don't set up a pin that another library drives, such
+ * as the WiFi library, while that library is in use.
+ */
+class PowerDomains {
+    public:
+        /**
+         * @brief The number of parts in the PowerDomain enum.
+        */
+        static const size_t count = 3;
+
+        /**
+        * @brief Count one more user of a part, and turn it on if it's the first one.
+        * @param domain The part to turn on.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode acquire(const PowerDomain domain);
+        /**
+        * @brief Set up the pin that turns a part on, with the polarity and the waits that the part needs.
+        * The part is turned off right away, unless it shares the pin with a part that is in use.
+        * @param domain The part to set up.
+        * @param pin The pin, as found in the schematics of the board.
+        */
+        void configure(const PowerDomain domain, const PinName pin);
+        /**
+        * @brief Set up how to turn a part on and off, with a polarity and waits of your own.
+        * The part is turned off right away, unless it shares the pin with a part that is in use.
+        * @param domain The part to set up.
+        * @param control The pin, the polarity, and the waits of the part.
+        */
+        void configure(const PowerDomain domain,
+                       const PowerDomainControl& control);
+        /**
+        * @brief Check if a part is turned on.
+        * @param domain The part to check.
+        * @return On: true. Off: false.
+        */
+        bool isOn(const PowerDomain domain) const;
+        /**
+        * @brief Turn all the parts off, regardless of their users, which are all forgotten.
+        */
+        void powerDownAll();
+        /**
+        * @brief Count one less user of a part, and turn it off if it was the last one.
+        * @param domain The part to turn off.
+        */
+        void release(const PowerDomain domain);
+        /**
+        * @brief The number of users of a part.
+        * @param domain The part.
+        * @return The number of calls to acquire() without a matching call to release().
+        */
+        uint16_t users(const PowerDomain domain) const;
+
+    private:
+        // Called by standbyM7() and requestStandby(). The users are kept, so
+        // that the parts can be turned on again if Standby Mode isn't entered.
+        static void powerDownForStandby();
+        // Called after an error return, outside of any critical section
+        static void restoreAfterStandby();
+
+        friend class LowPowerNiclaVision;
+};
+
+#endif  // End of header guard
@@ -0,0 +1,291 @@
+/*
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         Measurements of the VBAT voltage, the analog supply voltage and
+*         the temperature of the microcontroller through ADC3
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "PowerMonitor.h"
+#include "BackupSRAM.h"
+
+/*
+********************************************************************************
+*                      Variables shared by all objects
+********************************************************************************
+*/
+
+static const uint32_t MONITOR_MAGIC = 0x504d4f31;      // "PMO1"
+
+// The internal channels of ADC3, in the order of the conversions
+static const uint32_t VREFINT_CHANNEL = 19;
+static const uint32_t VBAT_CHANNEL = 17;
+static const uint32_t TEMPERATURE_CHANNEL = 18;
+static const uint32_t CONVERSIONS = 3;
+
+// 387.5 ADC clock cycles, which is 13 microseconds at 30 MHz. The temperature
+// sensor needs at least 9 microseconds.
+static const uint32_t SAMPLING_TIME = 6;
+// 16 conversions per result, shifted back down to 16 bits
+static const uint32_t OVERSAMPLING_RATIO = 16;
+static const uint32_t OVERSAMPLING_SHIFT = 4;
+static const float FULL_SCALE = 65535.0f;
+
+// In milliseconds, which is much longer than any of the steps should take,
+// even at PerformanceLevel::low
+static const uint32_t ADC_TIMEOUT = 10;
+
+/*
+********************************************************************************
+*                             Helper functions
+********************************************************************************
+*/
+
+static decltype(BackupSRAMLayout::powerMonitor)& monitorState()
+{
+    auto& state = backupSRAM().powerMonitor;
+
+    if ((MONITOR_MAGIC != state.magic) || (state.count > PowerMonitor::capacity) ||
+        (state.head >= PowerMonitor::capacity))
+    {
+        state.calibrated = false;
+        state.head = 0;
+        state.count = 0;
+        state.magic = MONITOR_MAGIC;
+    }
+
+    return state;
+}
+
+/*
+********************************************************************************
+*                             Member functions
+********************************************************************************
+*/
+
+PowerReading PowerMonitor::at(const size_t index) const
+{
+    const auto& state = monitorState();
+    if (index >= state.count)
+    {
+        return PowerReading();
+    }
+    const size_t oldest = (state.head + capacity - state.count) % capacity;
+    return state.readings[(oldest + index) % capacity];
+}
+
+void PowerMonitor::clear()
+{
+    auto& state = monitorState();
+    state.calibrated = false;
+    state.head = 0;
+    state.count = 0;
+}
+
+size_t PowerMonitor::count() const
+{
+    return monitorState().count;
+}
+
+PowerReading PowerMonitor::latest() const
+{
+    const size_t readings = count();
+    return (0 != readings) ? at(readings - 1) : PowerReading();
+}
+
+void PowerMonitor::powerDown()
+{
+    if (ADC3->CR & ADC_CR_ADEN)
+    {
+        ADC3->CR |= ADC_CR_ADDIS;
+        LowPowerNiclaVision::waitForRegister(ADC3->CR, ADC_CR_ADEN, 0,
+                                             ADC_TIMEOUT);
+    }
+    // The VBAT bridge draws current from VBAT while it's enabled
+    ADC3_COMMON->CCR &= ~(ADC_CCR_VBATEN | ADC_CCR_TSEN | ADC_CCR_VREFEN);
+    ADC3->CR = 0;
+    ADC3->CR = ADC_CR_DEEPPWD;
+    __HAL_RCC_ADC3_CLK_DISABLE();
+}
+
+LowPowerReturnCode PowerMonitor::read(PowerReading& reading)
+{
+    auto& state = monitorState();
+
+    __HAL_RCC_ADC3_CLK_ENABLE();
+    if (ADC3->CR & (ADC_CR_ADEN | ADC_CR_ADSTART))
+    {
+        return LowPowerReturnCode::adcBusy;
+    }
+
+    // The AHB clock divided by 4, and by another 2 inside the ADC of the
+    // revision V microcontroller on the Nicla Vision, which is 30 MHz at
+    // PerformanceLevel::max. It doesn't need PLL2 or PLL3, which the
+    // asynchronous clocks come from.
+    ADC3_COMMON->CCR = ADC_CCR_CKMODE | ADC_CCR_VBATEN | ADC_CCR_TSEN |
+                       ADC_CCR_VREFEN;
+
+    // Out of deep power-down, and wait for the voltage regulator as the HAL
+    // does, since LDORDY only exists on some revisions
+    ADC3->CR = 0;
+    ADC3->CR = ADC_CR_ADVREGEN | ADC_CR_BOOST;
+    volatile uint32_t waitLoops = (SystemCoreClock / (100000UL * 2UL)) + 1UL;
+    while (0 != waitLoops)
+    {
+        waitLoops = waitLoops - 1;
+    }
+
+    // The offset calibration is kept from the first reading, so that the
+    // following ones don't have to wait for it
+    if (!state.calibrated)
+    {
+        ADC3->CR = (ADC3->CR & ~(ADC_CR_ADCALDIF | ADC_CR_ADCALLIN)) |
+                   ADC_CR_ADCAL;
+        if (!LowPowerNiclaVision::waitForRegister(ADC3->CR, ADC_CR_ADCAL, 0,
+                                                  ADC_TIMEOUT))
+        {
+            powerDown();
+            return LowPowerReturnCode::adcTimeout;
+        }
+        state.calibration = ADC3->CALFACT;
+        state.calibrated = true;
+    }
+
+    ADC3->ISR = ADC_ISR_ADRDY;
+    ADC3->CR |= ADC_CR_ADEN;
+    if (!LowPowerNiclaVision::waitForRegister(ADC3->ISR, ADC_ISR_ADRDY,
+                                              ADC_ISR_ADRDY, ADC_TIMEOUT))
+    {
+        powerDown();
+        return LowPowerReturnCode::adcTimeout;
+    }
+    // Only writable while the ADC is enabled and not converting
+    ADC3->CALFACT = state.calibration;
+
+    // One software-started sequence at 16 bits, read by the CPU
+    ADC3->CFGR = ADC_CFGR_JQDIS;
+    ADC3->CFGR2 = ((OVERSAMPLING_RATIO - 1) << ADC_CFGR2_OVSR_Pos) |
+                  (OVERSAMPLING_SHIFT << ADC_CFGR2_OVSS_Pos) |
+                  ADC_CFGR2_ROVSE;
+    ADC3->PCSEL = (1UL << VREFINT_CHANNEL) | (1UL << VBAT_CHANNEL) |
+                  (1UL << TEMPERATURE_CHANNEL);
+    ADC3->SMPR2 = (SAMPLING_TIME << ADC_SMPR2_SMP17_Pos) |
+                  (SAMPLING_TIME << ADC_SMPR2_SMP18_Pos) |
+                  (SAMPLING_TIME << ADC_SMPR2_SMP19_Pos);
+    ADC3->SQR1 = ((CONVERSIONS - 1) << ADC_SQR1_L_Pos) |
+                 (VREFINT_CHANNEL << ADC_SQR1_SQ1_Pos) |
+                 (VBAT_CHANNEL << ADC_SQR1_SQ2_Pos) |
+                 (TEMPERATURE_CHANNEL << ADC_SQR1_SQ3_Pos);
+
+    ADC3->ISR = ADC_ISR_EOC | ADC_ISR_EOS | ADC_ISR_OVR;
+    ADC3->CR |= ADC_CR_ADSTART;
+    uint32_t data[CONVERSIONS];
+    for (auto& value : data)
+    {
+        if (!LowPowerNiclaVision::waitForRegister(ADC3->ISR, ADC_ISR_EOC,
+                                                  ADC_ISR_EOC, ADC_TIMEOUT))
+        {
+            powerDown();
+            return LowPowerReturnCode::adcTimeout;
+        }
+        // Reading DR clears EOC
+        value = ADC3->DR;
+    }
+    powerDown();
+
+    // The factory calibration was made at 3.3 V and 30 and 110 degrees
+    const float calibrationVoltage = VREFINT_CAL_VREF / 1000.0f;
+    const float vdda = (0 != data[0]) ?
+                       calibrationVoltage * *VREFINT_CAL_ADDR / data[0] :
+                       0;
+    const float cal1 = *TEMPSENSOR_CAL1_ADDR;
+    const float cal2 = *TEMPSENSOR_CAL2_ADDR;
+    const float temperatureData = data[2] * vdda /
+                                  (TEMPSENSOR_CAL_VREFANALOG / 1000.0f);
+
+    reading.time = LowPowerNiclaVision::isRTCConfigured() ?
+                   LowPowerNiclaVision::readRTCMilliseconds() : 0;
+    reading.vdda = vdda;
+    reading.vbat = 4 * vdda * data[1] / FULL_SCALE;
+    reading.temperature = (cal2 != cal1) ?
+        TEMPSENSOR_CAL1_TEMP +
+        (TEMPSENSOR_CAL2_TEMP - TEMPSENSOR_CAL1_TEMP) *
+        (temperatureData - cal1) / (cal2 - cal1) :
+        0;
+
+    return LowPowerReturnCode::success;
+}
+
+LowPowerReturnCode PowerMonitor::sample(const RTCWakeupDelay interval)
+{
+    auto& state = monitorState();
+
+    if ((0 != state.count) && LowPowerNiclaVision::isRTCConfigured())
+    {
+        const uint64_t last = latest().time;
+        const uint64_t now = LowPowerNiclaVision::readRTCMilliseconds();
+        if ((0 != last) && (now >= last) && ((now - last) < interval.value))
+        {
+            return LowPowerReturnCode::success;
+        }
+    }
+
+    PowerReading reading;
+    const LowPowerReturnCode result = read(reading);
+    if (LowPowerReturnCode::success != result)
+    {
+        return result;
+    }
+
+    state.readings[state.head] = reading;
+    state.head = (state.head + 1) % capacity;
+    if (state.count < capacity)
+    {
+        state.count++;
+    }
+
+    return LowPowerReturnCode::success;
+}
+
+RTCWakeupDelay PowerMonitor::stretch(const RTCWakeupDelay period,
+                                     const float lowVoltage,
+                                     const float emptyVoltage,
+                                     const uint32_t maxFactor) const
+{
+    if ((0 == count()) || (lowVoltage <= emptyVoltage) || (maxFactor <= 1) ||
+        (RTCWakeupDelay::infinite == period.value))
+    {
+        return period;
+    }
+
+    const float vbat = latest().vbat;
+    uint32_t factor = 1;
+    if (vbat <= emptyVoltage)
+    {
+        factor = maxFactor;
+    }
+    else if (vbat < lowVoltage)
+    {
+        factor += static_cast<uint32_t>((maxFactor - 1) *
+                                        (lowVoltage - vbat) /
+                                        (lowVoltage - emptyVoltage));
+    }
+
+    return RTCWakeupDelay(RTCWakeupDelay::multiply(period.value, factor));
+}
@@ -0,0 +1,131 @@
+/**
+* @file
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         Measurements of the VBAT voltage, the analog supply voltage and
+*         the temperature of the microcontroller through ADC3
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+#ifndef PowerMonitor_H
+#define PowerMonitor_H
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+/*
+********************************************************************************
+*                                 Classes
+********************************************************************************
+*/
+
+/**
+ * @brief The PowerReading struct holds one set of measurements from the PowerMonitor.
+*/
+struct PowerReading
+{
+    uint64_t time = 0;                  ///< The RTC time in milliseconds, as from rtcMilliseconds(), or 0 if the RTC isn't running
+    float vdda = 0;                     ///< The analog supply voltage in volts, found from VREFINT
+    float vbat = 0;                     ///< The voltage at the VBAT pin in volts
+    float temperature = 0;              ///< The temperature of the microcontroller in degrees Celsius
+};
+
+/**
+ * @class PowerMonitor
+ * @brief A class that measures the VBAT voltage, the analog supply voltage and the temperature of the microcontroller with ADC3, and keeps the last readings in the backup SRAM.
+ *
+ * Each reading powers ADC3 up, converts VREFINT, VBAT/4 and the temperature
+ * sensor in one sequence with 16 times oversampling, and powers it down
+ * again, which keeps the M7 core awake for about a millisecond at full
+ * speed. The calibration of ADC3 is only done once, and then kept in the
+ * backup SRAM. ADC3 is clocked from the AHB clock, so a reading also works
+ * at every PerformanceLevel, in the fast path of FastBoot, and while
+ * D3Batch keeps the D3 domain running. The voltages are worked out from the
+ * factory calibration of VREFINT, and the temperature from the one of the
+ * temperature sensor.
+ *
+ * sample() only takes a reading if the last one is old enough, so that it
+ * can be called after every wakeup. The readings are kept through Standby
+ * Mode together with their RTC times. All PowerMonitor objects share the
+ * same readings.
+ *
+ * @note Don't use ADC3 for anything else at the same time. A reading returns
+ * LowPowerReturnCode::adcBusy if ADC3 is already enabled.
+ */
+class PowerMonitor {
+    public:
+        /**
+         * @brief The number of readings kept in the backup SRAM.
+        */
+        static const size_t capacity = 16;
+
+        /**
+        * @brief Get one of the readings kept so far.
+        * @param index 0 for the oldest, up to count() - 1 for the latest.
+        * @return The reading, or an empty one if there is no such reading.
+        */
+        PowerReading at(const size_t index) const;
+        /**
+        * @brief Drop all the readings, and calibrate ADC3 again at the next reading.
+        */
+        void clear();
+        /**
+        * @brief The number of readings kept so far.
+        * @return The number of readings, up to capacity.
+        */
+        size_t count() const;
+        /**
+        * @brief Get the latest reading.
+        * @return The reading, or an empty one if there is none yet.
+        */
+        PowerReading latest() const;
+        /**
+        * @brief Take a reading right away, without keeping it.
+        * @param reading Where the reading goes.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode read(PowerReading& reading);
+        /**
+        * @brief Take a reading and keep it, if the latest one is older than the interval. The oldest one is dropped when all are in use.
+        * @param interval The shortest time between two readings. A reading is always taken if the RTC isn't running.
+        * @return A constant from the LowPowerReturnCode enum, which is success if no reading was due.
+        */
+        LowPowerReturnCode sample(const RTCWakeupDelay interval = 0_ms);
+        /**
+        * @brief Lengthen a period as the VBAT voltage drops, for example to add a job to the WakeupScheduler with.
+        * The period stays the same down to lowVoltage, and grows in whole
+        * multiples up to maxFactor times at emptyVoltage, so that a job only
+        * starts over when the multiple changes.
+        * @param period The period with a full battery.
+        * @param lowVoltage The VBAT voltage below which the period grows.
+        * @param emptyVoltage The VBAT voltage at which the period is the longest.
+        * @param maxFactor The longest period as a multiple of the given one.
+        * @return The period to use, which is the given one if there is no reading yet.
+        */
+        RTCWakeupDelay stretch(const RTCWakeupDelay period,
+                               const float lowVoltage,
+                               const float emptyVoltage,
+                               const uint32_t maxFactor = 4) const;
+
+    private:
+        // Disable ADC3 and its internal channels, and put it in deep
+        // power-down, whichever step a reading stopped at
+        static void powerDown();
+};
+
+#endif  // End of header guard
@@ -0,0 +1,213 @@
+/*
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         A profiler that records how much of the time the STM32H747 on
+*         the Nicla Vision spends awake, in Sleep, and in Deep Sleep
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "PowerProfiler.h"
+#include "BackupSRAM.h"
+
+/*
+********************************************************************************
+*                                Constants
+********************************************************************************
+*/
+
+static const uint32_t PROFILER_MAGIC = 0x50505231;     // "PPR1"
+
+/*
+********************************************************************************
+*                      Variables shared by all objects
+********************************************************************************
+*/
+
+// In RAM rather than the backup SRAM, so that it starts over on every boot
+static bool recordedThisBoot = false;
+
+/*
+********************************************************************************
+*                             Helper functions
+********************************************************************************
+*/
+
+static uint32_t saturate(const uint64_t value)
+{
+    return (value > UINT32_MAX) ? UINT32_MAX : static_cast<uint32_t>(value);
+}
+
+// The statistics only count up within one boot, and record() starts over at
+// the first call after each boot, so a decrease only comes from a snapshot
+// that has been partly overwritten.
+static uint64_t since(const uint64_t now, const uint64_t previous)
+{
+    return (now >= previous) ? (now - previous) : now;
+}
+
+static decltype(BackupSRAMLayout::profiler)& profilerLog()
+{
+    auto& log = backupSRAM().profiler;
+
+    // Also reject a head or count that doesn't fit in the ring buffer, in
+    // case the backup SRAM has been partly overwritten.
+    if (PROFILER_MAGIC != log.magic ||
+        log.head >= PowerProfiler::capacity ||
+        log.count > PowerProfiler::capacity)
+    {
+        log.head = 0;
+        log.count = 0;
+        log.boot = 0;
+        log.previous = PowerSnapshot();
+        log.magic = PROFILER_MAGIC;
+    }
+
+    return log;
+}
+
+/*
+********************************************************************************
+*                             Member functions
+********************************************************************************
+*/
+
+void PowerProfiler::clear()
+{
+    core_util_critical_section_enter();
+    auto& log = profilerLog();
+    log.head = 0;
+    log.count = 0;
+    core_util_critical_section_exit();
+}
+
+void PowerProfiler::histogram(const Metric metric,
+                              uint16_t* const bins,
+                              const size_t binCount) const
+{
+    if (nullptr == bins || 0 == binCount)
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < binCount; ++i)
+    {
+        bins[i] = 0;
+    }
+
+    const size_t intervals = size();
+    for (size_t i = 0; i < intervals; ++i)
+    {
+        const Interval entry = interval(i);
+        if (0 == entry.duration)
+        {
+            continue;
+        }
+
+        const uint64_t part = (Metric::dutyCycle == metric) ? entry.awake : entry.deepSleep;
+        size_t bin = static_cast<size_t>((part * binCount) / entry.duration);
+        if (bin >= binCount)
+        {
+            bin = binCount - 1;
+        }
+        if (UINT16_MAX != bins[bin])
+        {
+            ++bins[bin];
+        }
+    }
+}
+
+PowerProfiler::Interval PowerProfiler::interval(const size_t index) const
+{
+    Interval entry{};
+
+    core_util_critical_section_enter();
+    const auto& log = profilerLog();
+    if (index < log.count)
+    {
+        const size_t oldest = (log.head + capacity - log.count) % capacity;
+        entry = log.intervals[(oldest + index) % capacity];
+    }
+    core_util_critical_section_exit();
+
+    return entry;
+}
+
+void PowerProfiler::record(const uint16_t tag)
+{
+    core_util_critical_section_enter();
+
+    const PowerSnapshot now = snapshot();
+    auto& log = profilerLog();
+
+    // The uptime can't tell a new boot apart, since it may already be longer
+    // than the one at the last call of the boot before
+    if (!recordedThisBoot)
+    {
+        if (0 != log.previous.uptime)
+        {
+            ++log.boot;
+        }
+        log.previous = PowerSnapshot();
+        recordedThisBoot = true;
+    }
+
+    const uint64_t idle = since(now.idle, log.previous.idle);
+    const uint64_t duration = since(now.uptime, log.previous.uptime);
+
+    Interval& entry = log.intervals[log.head];
+    entry.duration = saturate(duration);
+    entry.awake = saturate((duration > idle) ? (duration - idle) : 0);
+    entry.sleep = saturate(since(now.sleep, log.previous.sleep));
+    entry.deepSleep = saturate(since(now.deepSleep, log.previous.deepSleep));
+    entry.tag = tag;
+    entry.boot = log.boot;
+
+    log.head = (log.head + 1) % capacity;
+    if (log.count < capacity)
+    {
+        ++log.count;
+    }
+    log.previous = now;
+
+    core_util_critical_section_exit();
+}
+
+size_t PowerProfiler::size() const
+{
+    core_util_critical_section_enter();
+    const size_t count = profilerLog().count;
+    core_util_critical_section_exit();
+
+    return count;
+}
+
+PowerSnapshot PowerProfiler::snapshot()
+{
+    // A single call, so that all the values are from the same instant.
+    mbed_stats_cpu_t stats{};
+    mbed_stats_cpu_get(&stats);
+
+    PowerSnapshot result;
+    result.uptime = stats.uptime;
+    result.idle = stats.idle_time;
+    result.sleep = stats.sleep_time;
+    result.deepSleep = stats.deep_sleep_time;
+
+    return result;
+}
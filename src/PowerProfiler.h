@@ -0,0 +1,129 @@
+/**
+* @file
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         A profiler that records how much of the time the STM32H747 on
+*         the Nicla Vision spends awake, in Sleep, and in Deep Sleep
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+#ifndef PowerProfiler_H
+#define PowerProfiler_H
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include <mbed.h>
+
+/*
+********************************************************************************
+*                                 Classes
+********************************************************************************
+*/
+
+/**
+ * @brief The PowerSnapshot struct holds the CPU time statistics from a single instant.
+ * All times are in microseconds since the board was booted.
+*/
+struct PowerSnapshot
+{
+    uint64_t uptime = 0;            ///< Time since boot
+    uint64_t idle = 0;              ///< Time spent in idle, including Sleep and Deep Sleep
+    uint64_t sleep = 0;             ///< Time spent in Sleep Mode
+    uint64_t deepSleep = 0;         ///< Time spent in Deep Sleep Mode
+};
+
+/**
+ * @class PowerProfiler
+ * @brief A class that records the time spent awake, in Sleep, and in Deep Sleep between calls to record().
+ *
+ * Each call to record() takes one consistent snapshot of the CPU time
+ * statistics and logs the interval since the previous call in a ring buffer.
+ * The ring buffer is kept in the backup SRAM without any allocation, so it
+ * survives Standby Mode. All PowerProfiler objects share the same ring buffer.
+ *
+ * @note The CPU time statistics restart from zero on every boot, so the time
+ * spent in Standby Mode itself is not part of any interval.
+ */
+class PowerProfiler {
+    public:
+        /**
+         * @brief The number of intervals that the ring buffer holds.
+        */
+        static const size_t capacity = 32;
+
+        /**
+         * @brief The Interval struct holds the times logged by one call to record().
+         * All times are in microseconds, and saturate at about 71 minutes.
+        */
+        struct Interval
+        {
+            uint32_t duration;      ///< Time since the previous call to record()
+            uint32_t awake;         ///< Time spent awake
+            uint32_t sleep;         ///< Time spent in Sleep Mode
+            uint32_t deepSleep;     ///< Time spent in Deep Sleep Mode
+            uint16_t tag;           ///< The tag passed to record()
+            uint16_t boot;          ///< Incremented for each boot, to tell intervals from different boots apart
+        };
+
+        /**
+         * @enum Metric
+         * @brief Provides the ratios that histogram() can count.
+        */
+        enum class Metric
+        {
+            dutyCycle,              ///< The share of the interval spent awake
+            deepSleepRatio          ///< The share of the interval spent in Deep Sleep Mode
+        };
+
+        /**
+        * @brief Take one consistent snapshot of the CPU time statistics.
+        * @return The snapshot.
+        */
+        static PowerSnapshot snapshot();
+
+        /**
+        * @brief Log the interval since the previous call, or since boot for the first call after a boot.
+        * @param tag A number that identifies the code path that ends the interval.
+        */
+        void record(const uint16_t tag = 0);
+        /**
+        * @brief Number of intervals in the ring buffer.
+        * @return The number of intervals, at most capacity.
+        */
+        size_t size() const;
+        /**
+        * @brief Get a logged interval.
+        * @param index The index of the interval, where 0 is the oldest one.
+        * @return The interval, or an interval with all zeros if the index is out of range.
+        */
+        Interval interval(const size_t index) const;
+        /**
+        * @brief Count the logged intervals in equally wide bins of the given ratio.
+        * @param metric The ratio to count.
+        * @param bins The bins, where the first bin counts ratios from 0 and the last bin counts ratios up to 1.
+        * @param binCount The number of bins.
+        */
+        void histogram(const Metric metric,
+                       uint16_t* const bins,
+                       const size_t binCount) const;
+        /**
+        * @brief Remove all logged intervals.
+        */
+        void clear();
+};
+
+#endif  // End of header guard
@@ -0,0 +1,247 @@
+/*
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         A scheduler for periodic jobs that wakes the STM32H747 on the
+*         Nicla Vision up at absolute times with the RTC alarm
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "WakeupScheduler.h"
+#include "BackupSRAM.h"
+
+/*
+********************************************************************************
+*                                Constants
+********************************************************************************
+*/
+
+static const uint32_t SCHEDULER_MAGIC = 0x57534332;     // "WSC2"
+// The RTC alarm compares the day of the month
+static const uint64_t MAX_PERIOD = 28ULL * 24 * 60 * 60 * 1000;
+
+/*
+********************************************************************************
+*                             Helper functions
+********************************************************************************
+*/
+
+using SchedulerJob = BackupSRAMLayout::SchedulerJob;
+
+static decltype(BackupSRAMLayout::scheduler)& schedulerJobs()
+{
+    auto& scheduler = backupSRAM().scheduler;
+
+    if (SCHEDULER_MAGIC != scheduler.magic)
+    {
+        for (auto& job : scheduler.jobs)
+        {
+            job.period = 0;
+        }
+        scheduler.runs = 0;
+        scheduler.wakeups = 0;
+        scheduler.runsThisWakeup = 0;
+        scheduler.magic = SCHEDULER_MAGIC;
+    }
+
+    return scheduler;
+}
+
+static SchedulerJob* findJob(const char* const name)
+{
+    for (auto& job : schedulerJobs().jobs)
+    {
+        if ((0 != job.period) &&
+            (0 == strncmp(job.name, name, WakeupScheduler::nameLength)))
+        {
+            return &job;
+        }
+    }
+    return nullptr;
+}
+
+// The first time in the schedule of the job that is after the given time
+static uint64_t nextSlot(const SchedulerJob& job, const uint64_t time)
+{
+    if (time < job.epoch)
+    {
+        return job.epoch;
+    }
+    return job.epoch + ((time - job.epoch) / job.period + 1) * job.period;
+}
+
+// The time the job is next due, as seen from the given time. A job that is
+// due but hasn't been checked with isDue() is at its next time after now, so
+// that the scheduler never wakes up in the past.
+static uint64_t nextDue(const SchedulerJob& job, const uint64_t now)
+{
+    return (job.next > now + job.tolerance) ? job.next : nextSlot(job, now);
+}
+
+/*
+********************************************************************************
+*                             Member functions
+********************************************************************************
+*/
+
+LowPowerReturnCode WakeupScheduler::add(const char* const name,
+                                        const RTCWakeupDelay period,
+                                        const RTCWakeupDelay tolerance)
+{
+    if ((0 == period.value) || (period.value >= MAX_PERIOD))
+    {
+        return LowPowerReturnCode::wakeupDelayTooLong;
+    }
+    // With more than half the period, two runs could share a wakeup
+    const uint32_t maxTolerance = static_cast<uint32_t>(period.value / 2);
+    const uint32_t jobTolerance = (tolerance.value > maxTolerance) ?
+                                  maxTolerance :
+                                  static_cast<uint32_t>(tolerance.value);
+
+    const uint64_t now = LowPower.rtcMilliseconds();
+
+    SchedulerJob* job = findJob(name);
+    if ((nullptr != job) && (job->period == period.value))
+    {
+        job->tolerance = jobTolerance;
+        return LowPowerReturnCode::success;
+    }
+    if (nullptr == job)
+    {
+        for (auto& candidate : schedulerJobs().jobs)
+        {
+            if (0 == candidate.period)
+            {
+                job = &candidate;
+                break;
+            }
+        }
+    }
+    if (nullptr == job)
+    {
+        return LowPowerReturnCode::tooManyJobs;
+    }
+
+    strncpy(job->name, name, nameLength);
+    job->name[nameLength] = '\0';
+    job->period = static_cast<uint32_t>(period.value);
+    job->tolerance = jobTolerance;
+    job->epoch = now + period.value;
+    job->next = job->epoch;
+
+    return LowPowerReturnCode::success;
+}
+
+bool WakeupScheduler::isDue(const char* const name)
+{
+    SchedulerJob* const job = findJob(name);
+    if (nullptr == job)
+    {
+        return false;
+    }
+
+    const uint64_t now = LowPower.rtcMilliseconds();
+    if (job->next > now + job->tolerance)
+    {
+        return false;
+    }
+    // Skip any times that were missed, rather than running the job once for
+    // each of them. A job that runs early moves on to the time after the one
+    // it ran for.
+    job->next = nextSlot(*job, (now > job->next) ? now : job->next);
+
+    auto& scheduler = schedulerJobs();
+    scheduler.runs++;
+    scheduler.runsThisWakeup++;
+    return true;
+}
+
+uint64_t WakeupScheduler::nextWakeup() const
+{
+    const uint64_t now = LowPower.rtcMilliseconds();
+    uint64_t earliest = 0;
+
+    for (const auto& job : schedulerJobs().jobs)
+    {
+        if (0 == job.period)
+        {
+            continue;
+        }
+        // The latest time the job may run. Waking up then serves every other
+        // job whose earliest time is before it.
+        const uint64_t latest = nextDue(job, now) + job.tolerance;
+        if ((0 == earliest) || (latest < earliest))
+        {
+            earliest = latest;
+        }
+    }
+
+    return earliest;
+}
+
+void WakeupScheduler::remove(const char* const name)
+{
+    SchedulerJob* const job = findJob(name);
+    if (nullptr != job)
+    {
+        job->period = 0;
+    }
+}
+
+void WakeupScheduler::resetStatistics()
+{
+    auto& scheduler = schedulerJobs();
+    scheduler.runs = 0;
+    scheduler.wakeups = 0;
+    scheduler.runsThisWakeup = 0;
+}
+
+uint32_t WakeupScheduler::runs() const
+{
+    return schedulerJobs().runs;
+}
+
+uint32_t WakeupScheduler::savedWakeups() const
+{
+    const auto& scheduler = schedulerJobs();
+    return scheduler.runs - scheduler.wakeups;
+}
+
+WakeupSources WakeupScheduler::wakeupSources()
+{
+    // This is the end of a wakeup, which counts if any job ran during it
+    auto& scheduler = schedulerJobs();
+    if (0 != scheduler.runsThisWakeup)
+    {
+        scheduler.wakeups++;
+        scheduler.runsThisWakeup = 0;
+    }
+
+    WakeupSources sources;
+    const uint64_t next = nextWakeup();
+    if (0 != next)
+    {
+        sources.rtcAlarm(next);
+    }
+    return sources;
+}
+
+uint32_t WakeupScheduler::wakeups() const
+{
+    return schedulerJobs().wakeups;
+}
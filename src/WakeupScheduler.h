@@ -0,0 +1,116 @@
+/**
+* @file
+********************************************************************************
+*                      Arduino_LowPowerNiclaVision Library
+*
+*                 Copyright 2024 Arduino SA. http://arduino.cc
+*
+*         A scheduler for periodic jobs that wakes the STM32H747 on the
+*         Nicla Vision up at absolute times with the RTC alarm
+*
+*                    SPDX-License-Identifier: MPL-2.0
+*
+*      This Source Code Form is subject to the terms of the Mozilla Public
+*      License, v. 2.0. If a copy of the MPL was not distributed with this
+*      file, you can obtain one at: http://mozilla.org/MPL/2.0/
+*
+********************************************************************************
+*/
+
+#ifndef WakeupScheduler_H
+#define WakeupScheduler_H
+
+/*
+********************************************************************************
+*                           Included header files
+********************************************************************************
+*/
+
+#include "Arduino_LowPowerNiclaVision.h"
+
+/*
+********************************************************************************
+*                                 Classes
+********************************************************************************
+*/
+
+/**
+ * @class WakeupScheduler
+ * @brief A class that keeps track of named periodic jobs, and finds the next time to wake up for them.
+ *
+ * Each job is due at fixed times counted from the RTC time when it was first
+ * added, so the time spent awake doesn't add to the period. If the
+ * microcontroller misses one or more times, the job is only due once, and the
+ * next time is the next one in the original schedule. Each job can have a
+ * tolerance, which lets it run that much earlier or later than its time, so
+ * that jobs with nearby times are lined up to share one wakeup. The jobs are kept in
+ * the backup SRAM together with their schedules, so they survive Standby
+ * Mode. All WakeupScheduler objects share the same jobs.
+ */
+class WakeupScheduler {
+    public:
+        /**
+         * @brief The number of jobs that can be scheduled at the same time.
+        */
+        static const size_t capacity = 8;
+        /**
+         * @brief The number of characters of a job name that are kept.
+        */
+        static const size_t nameLength = 15;
+
+        /**
+        * @brief Add a periodic job, or keep its schedule if it's already there with the same period.
+        * @param name The name of the job. Only the first nameLength characters are used.
+        * @param period The time between two runs of the job, which must be less than 28 days.
+        * @param tolerance How much earlier or later than its time the job may run, at most half the period.
+        * @return A constant from the LowPowerReturnCode enum.
+        */
+        LowPowerReturnCode add(const char* const name,
+                               const RTCWakeupDelay period,
+                               const RTCWakeupDelay tolerance = 0_ms);
+        /**
+        * @brief Check if a job is due, taking its tolerance into account, and if so, move it to its next time.
+        * Call this once for every job after waking up.
+        * @param name The name of the job.
+        * @return Due: true. Not due, or no such job: false.
+        */
+        bool isDue(const char* const name);
+        /**
+        * @brief The next time to wake up, which is the latest time that the most urgent job may run.
+        * Every other job whose tolerance allows it to run at that time is due then too.
+        * @return Milliseconds since the start of the RTC calendar, or 0 if there are no jobs.
+        */
+        uint64_t nextWakeup() const;
+        /**
+        * @brief Remove a job.
+        * @param name The name of the job.
+        */
+        void remove(const char* const name);
+        /**
+        * @brief Set wakeups() and runs() to zero.
+        */
+        void resetStatistics();
+        /**
+        * @brief Number of times that isDue() has returned true, which is the number of wakeups that one wakeup per job run would need.
+        * @return The number of job runs.
+        */
+        uint32_t runs() const;
+        /**
+        * @brief Number of wakeups saved by running several jobs in the same wakeup.
+        * @return runs() minus wakeups().
+        */
+        uint32_t savedWakeups() const;
+        /**
+        * @brief The wakeup sources for standbyM7() or stopM7() that wake up for the next job.
+        * Call this once before each sleep, since it also counts the wakeups.
+        * @return The wakeup sources, with the RTC alarm set to nextWakeup().
+        */
+        WakeupSources wakeupSources();
+        /**
+        * @brief Number of wakeups where at least one job was due, counted by wakeupSources().
+        * @return The number of wakeups.
+        */
+        uint32_t wakeups() const;
+};
+
+#endif  // End of header guard